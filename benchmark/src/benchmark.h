@@ -15,6 +15,7 @@ typedef struct BenchmarkResult {
 	double fps;
 	double cpu_time_ms;
 	double pixels_per_second;
+	double vertices_per_second;
 	size_t current_memory;
 	size_t peak_memory;
 } BenchmarkResult;
@@ -35,7 +36,9 @@ void run_milestone1(Framebuffer *fb, BenchmarkResult *result);
 void run_milestone2(Framebuffer *fb, BenchmarkResult *result);
 void run_texture_stream(Framebuffer *fb, BenchmarkResult *result);
 void run_toggle_blend(Framebuffer *fb, BenchmarkResult *result);
-void run_fill_rate_suite(Framebuffer *fb, BenchmarkResult results[3]);
+void run_fill_rate_suite(Framebuffer *fb, BenchmarkResult results[5]);
+/* Scalar, 4-wide and 8-wide vertex transform and lighting kernels. */
+void run_vertex_kernels(BenchmarkResult results[3]);
 void run_stress_test(Framebuffer *fb, BenchmarkResult *result, bool stream_fb,
 		     int frames);
 
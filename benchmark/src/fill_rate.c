@@ -79,7 +79,82 @@ static void run_fill_upload(Framebuffer *fb, BenchmarkResult *result)
 		(double)(fb->width * fb->height * 1000) / secs;
 }
 
-void run_fill_rate_suite(Framebuffer *fb, BenchmarkResult results[3])
+#define LAYERS 8
+#define LAYER_FRAMES 20
+
+/* Full-screen textured quads stacked in depth and drawn nearest first or
+ * farthest first. Front to back, every layer after the first is hidden,
+ * so depth rejection ahead of texturing shows up as a higher fill rate
+ * than back to front, where every layer is shaded. */
+static void run_fill_layers(Framebuffer *fb, BenchmarkResult *result,
+			    bool front_to_back)
+{
+	static const GLfloat texcoords[] = { 0.0f, 0.0f, 1.0f, 0.0f,
+					     1.0f, 1.0f, 0.0f, 1.0f };
+	static const GLubyte indices[] = { 0, 1, 2, 0, 2, 3 };
+	GLubyte *tex_data = tracked_malloc(fb->width * fb->height * 4);
+	memset(tex_data, 0x80, fb->width * fb->height * 4);
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, fb->width, fb->height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, tex_data);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glEnable(GL_TEXTURE_2D);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	GLfloat verts[LAYERS][12];
+	for (int i = 0; i < LAYERS; ++i) {
+		int layer = front_to_back ? i : LAYERS - 1 - i;
+		GLfloat z = -0.8f + 1.6f * layer / (LAYERS - 1);
+		const GLfloat quad[12] = { -1.0f, -1.0f, z, 1.0f, -1.0f, z,
+					   1.0f,  1.0f,  z, -1.0f, 1.0f, z };
+		memcpy(verts[i], quad, sizeof(quad));
+	}
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, 0, texcoords);
+
+	clock_t start = clock();
+	for (int frame = 0; frame < LAYER_FRAMES; ++frame) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		for (int i = 0; i < LAYERS; ++i) {
+			glVertexPointer(3, GL_FLOAT, 0, verts[i]);
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE,
+				       indices);
+		}
+	}
+	glFinish();
+	clock_t end = clock();
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_TEXTURE_2D);
+	glDeleteTextures(1, &tex);
+	tracked_free(tex_data, fb->width * fb->height * 4);
+
+	compute_result(start, end, result);
+	double secs = (double)(end - start) / CLOCKS_PER_SEC;
+	result->pixels_per_second =
+		(double)fb->width * fb->height * LAYERS * LAYER_FRAMES / secs;
+}
+
+void run_fill_rate_suite(Framebuffer *fb, BenchmarkResult results[5])
 {
 	run_fill_clear(fb, &results[0]);
 	LOG_INFO("Clear Fill: %.2f MP/s", results[0].pixels_per_second / 1e6);
@@ -92,9 +167,24 @@ void run_fill_rate_suite(Framebuffer *fb, BenchmarkResult results[3])
 	LOG_INFO("Texture Upload: %.2f MP/s",
 		 results[2].pixels_per_second / 1e6);
 
-	LOG_INFO("| Fill Test | MP/s |");
-	LOG_INFO("|-----------|------|");
-	LOG_INFO("| Clear     | %.2f |", results[0].pixels_per_second / 1e6);
-	LOG_INFO("| Textured  | %.2f |", results[1].pixels_per_second / 1e6);
-	LOG_INFO("| Upload    | %.2f |", results[2].pixels_per_second / 1e6);
+	run_fill_layers(fb, &results[3], true);
+	LOG_INFO("Depth Layers Front to Back: %.2f MP/s",
+		 results[3].pixels_per_second / 1e6);
+
+	run_fill_layers(fb, &results[4], false);
+	LOG_INFO("Depth Layers Back to Front: %.2f MP/s",
+		 results[4].pixels_per_second / 1e6);
+
+	LOG_INFO("| Fill Test     | MP/s |");
+	LOG_INFO("|---------------|------|");
+	LOG_INFO("| Clear         | %.2f |",
+		 results[0].pixels_per_second / 1e6);
+	LOG_INFO("| Textured      | %.2f |",
+		 results[1].pixels_per_second / 1e6);
+	LOG_INFO("| Upload        | %.2f |",
+		 results[2].pixels_per_second / 1e6);
+	LOG_INFO("| Front to back | %.2f |",
+		 results[3].pixels_per_second / 1e6);
+	LOG_INFO("| Back to front | %.2f |",
+		 results[4].pixels_per_second / 1e6);
 }
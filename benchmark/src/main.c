@@ -6,6 +6,7 @@
 #include "gl_thread.h"
 #include "command_buffer.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
@@ -13,9 +14,15 @@
 int main(int argc, char **argv)
 {
 	bool profile = false;
-	for (int i = 1; i < argc; ++i)
+	const char *trace = NULL;
+	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--profile") == 0)
 			profile = true;
+		else if (strncmp(argv[i], "--trace=", 8) == 0)
+			trace = argv[i] + 8;
+		else if (strncmp(argv[i], "--affinity=", 11) == 0)
+			setenv("MICROGLES_AFFINITY", argv[i] + 11, 1);
+	}
 	if (!logger_init("benchmark.log", LOG_LEVEL_INFO)) {
 		fprintf(stderr, "Failed to initialize logger.\n");
 		return -1;
@@ -31,6 +38,8 @@ int main(int argc, char **argv)
 	command_buffer_init();
 	if (profile)
 		thread_profile_start();
+	if (trace)
+		thread_trace_start(trace);
 	InitGLState(&gl_state);
 	Framebuffer *fb = GL_init_with_framebuffer(256, 256);
 	if (!fb) {
@@ -103,11 +112,13 @@ int main(int argc, char **argv)
 #ifdef DEBUG
 	assert(glGetError() == GL_NO_ERROR);
 #endif
-	BenchmarkResult fill_results[3];
+	BenchmarkResult fill_results[5];
 	run_fill_rate_suite(fb, fill_results);
 #ifdef DEBUG
 	assert(glGetError() == GL_NO_ERROR);
 #endif
+	BenchmarkResult kernel_results[3];
+	run_vertex_kernels(kernel_results);
 
 	thread_pool_wait();
 	command_buffer_shutdown();
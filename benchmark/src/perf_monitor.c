@@ -170,8 +170,12 @@ static void usage(const char *prog)
 	printf("Usage: %s [options]\n\n", prog);
 	printf("Options:\n");
 	printf("  --profile           Enable per-thread profiling.\n");
+	printf("  --trace=<file>      Write a Chrome trace of every task to\n");
+	printf("                      <file> on exit.\n");
 	printf("  --threads=<n>       Number of worker threads (overrides\n");
 	printf("                      MICROGLES_THREADS env var).\n");
+	printf("  --affinity=<spec>   Pin workers: CPU list (0-3,6), compact,\n");
+	printf("                      scatter or physical.\n");
 	printf("  --tilesize=<n|fb>   Tile size in pixels or 'fb' for one tile\n");
 	printf("                      covering the framebuffer.\n");
 	printf("  --color-spec=<ARGB8888|XRGB8888>\n");
@@ -181,6 +185,7 @@ static void usage(const char *prog)
 	printf("  --help              Display this information and exit.\n\n");
 	printf("Environment variables:\n");
 	printf("  MICROGLES_THREADS   Default worker thread count (default 2).\n");
+	printf("  MICROGLES_AFFINITY  Default worker placement (unpinned).\n");
 	printf("  TILESIZE            Default tile size in pixels ('fb' disables\n");
 	printf("                      tiling).\n");
 	printf("  FB_COLOR_SPEC       Default colour format (ARGB8888).\n");
@@ -190,6 +195,7 @@ int main(int argc, char **argv)
 {
 	LogLevel log_level = LOG_LEVEL_INFO;
 	bool profile = false;
+	const char *trace = NULL;
 	const char *threads_arg = NULL;
 	const char *tilesize_arg = NULL;
 	const char *color_arg = NULL;
@@ -202,8 +208,12 @@ int main(int argc, char **argv)
 			return 0;
 		} else if (strcmp(arg, "--profile") == 0) {
 			profile = true;
+		} else if (strncmp(arg, "--trace=", 8) == 0) {
+			trace = arg + 8;
 		} else if (strncmp(arg, "--threads=", 10) == 0) {
 			threads_arg = arg + 10;
+		} else if (strncmp(arg, "--affinity=", 11) == 0) {
+			setenv("MICROGLES_AFFINITY", arg + 11, 1);
 		} else if (strncmp(arg, "--tilesize=", 11) == 0) {
 			tilesize_arg = arg + 11;
 		} else if (strncmp(arg, "--color-spec=", 13) == 0) {
@@ -243,6 +253,8 @@ int main(int argc, char **argv)
 	command_buffer_init();
 	if (profile)
 		thread_profile_start();
+	if (trace)
+		thread_trace_start(trace);
 	InitGLState(&gl_state);
 	Framebuffer *fb = GL_init_with_framebuffer(1024, 768);
 	if (!fb) {
@@ -322,11 +334,18 @@ int main(int argc, char **argv)
 		clock_gettime(CLOCK_MONOTONIC, &start);
 		cstart = thread_get_cycles();
 		double polys = 0.0, pix = 0.0;
+		struct microgles_metrics m0, m1;
+		microgles_metrics_snapshot(&m0);
+		uint64_t peak_queued = 0;
 		do {
 			LOG_FRAME_START(frame_idx);
 			LOG_DEBUG("before render_scene");
 			render_scene();
 			LOG_DEBUG("after render_scene");
+			/* Sample while the frame is in flight. */
+			microgles_metrics_snapshot(&m1);
+			if (m1.queued > peak_queued)
+				peak_queued = m1.queued;
 
 			LOG_DEBUG("before glFinish");
 			glFinish();
@@ -376,22 +395,30 @@ int main(int argc, char **argv)
 			clock_gettime(CLOCK_MONOTONIC, &now);
 		} while (ts_diff(&now, &start) < 1.0);
 		cend = thread_get_cycles();
+		microgles_metrics_snapshot(&m1);
 		double wall = ts_diff(&now, &start);
+		uint64_t tasks = m1.tasks - m0.tasks;
+		double steal_pct =
+			tasks ? 100.0 * (double)(m1.steals - m0.steals) /
+					(double)tasks :
+				0.0;
 		double cpu_us = thread_cycles_to_us(cend - cstart);
 		double cpu_pct = wall > 0.0 ? (cpu_us / (wall * 1e6)) * 100.0 :
 					      0.0;
 		static bool header_printed = false;
 		if (!header_printed) {
-			printf("%-7s %-10s %-6s %-11s %-11s\n", "TID",
-			       "Mem(KB)", "CPU%", "Poly(MP/s)", "Pix(MP/s)");
+			printf("%-7s %-10s %-6s %-11s %-11s %-10s %-7s %-7s\n",
+			       "TID", "Mem(KB)", "CPU%", "Poly(MP/s)",
+			       "Pix(MP/s)", "Tasks/s", "Steal%", "MaxQ");
 			header_printed = true;
 		}
-		printf("%7ld %10zu %6.1f %11.2f %11.2f\n", get_tid(),
-		       memory_tracker_current() / 1024, cpu_pct,
-		       polys / wall / 1e6, pix / wall / 1e6);
+		printf("%7ld %10zu %6.1f %11.2f %11.2f %10.0f %7.1f %7llu\n",
+		       get_tid(), memory_tracker_current() / 1024, cpu_pct,
+		       polys / wall / 1e6, pix / wall / 1e6,
+		       (double)tasks / wall, steal_pct,
+		       (unsigned long long)peak_queued);
 		LOG_INFO("Second %d summary: %.2f MP/s polys, %.2f MP/s pixels",
 			 sec + 1, polys / wall / 1e6, pix / wall / 1e6);
-		thread_realtime_report();
 		if (profile)
 			thread_profile_start();
 	}
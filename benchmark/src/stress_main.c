@@ -8,16 +8,22 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 int main(int argc, char **argv)
 {
 	bool profile = false;
+	const char *trace = NULL;
 	bool stream_fb = false;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--profile") == 0)
 			profile = true;
+		else if (strncmp(argv[i], "--trace=", 8) == 0)
+			trace = argv[i] + 8;
 		else if (strcmp(argv[i], "--stream-fb") == 0)
 			stream_fb = true;
+		else if (strncmp(argv[i], "--affinity=", 11) == 0)
+			setenv("MICROGLES_AFFINITY", argv[i] + 11, 1);
 	}
 	if (!logger_init("stress_test.log", LOG_LEVEL_INFO)) {
 		fprintf(stderr, "Failed to initialize logger.\n");
@@ -34,6 +40,8 @@ int main(int argc, char **argv)
 	command_buffer_init();
 	if (profile)
 		thread_profile_start();
+	if (trace)
+		thread_trace_start(trace);
 	InitGLState(&gl_state);
 	Framebuffer *fb = GL_init_with_framebuffer(256, 256);
 	if (!fb) {
@@ -0,0 +1,113 @@
+#include "benchmark.h"
+#include "gl_logger.h"
+#include "pipeline/gl_vertex_simd.h"
+#include <math.h>
+#include <string.h>
+
+#define KERNEL_VERTS 3072
+#define KERNEL_PASSES 1000
+
+typedef struct {
+	const char *name;
+	void (*transform)(VertexBatch *restrict, const mat4 *, mat4_class,
+			  const mat4 *);
+	void (*light)(VertexBatch *restrict, const LightingSetup *);
+} vertex_kernel_t;
+
+static const vertex_kernel_t kernels[3] = {
+	{ "scalar", vertex_transform_scalar, vertex_light_scalar },
+	{ "4-wide", vertex_transform_x4, vertex_light_x4 },
+	{ "8-wide", vertex_transform_x8, vertex_light_x8 },
+};
+
+/* Object-space attributes are restored before every pass since the kernels
+ * work in place; the copy is part of each kernel's time. */
+static void load_attributes(VertexBatch *dst, const VertexBatch *src)
+{
+	size_t bytes = KERNEL_VERTS * sizeof(GLfloat);
+	memcpy(dst->x, src->x, bytes);
+	memcpy(dst->y, src->y, bytes);
+	memcpy(dst->z, src->z, bytes);
+	memcpy(dst->w, src->w, bytes);
+	memcpy(dst->nx, src->nx, bytes);
+	memcpy(dst->ny, src->ny, bytes);
+	memcpy(dst->nz, src->nz, bytes);
+}
+
+void run_vertex_kernels(BenchmarkResult results[3])
+{
+	VertexBatch *src = vertex_batch_create(KERNEL_VERTS, GL_TRIANGLES, 0);
+	VertexBatch *b = vertex_batch_create(KERNEL_VERTS, GL_TRIANGLES, 0);
+	if (!src || !b) {
+		LOG_ERROR("Vertex kernels: out of memory");
+		vertex_batch_destroy(src);
+		vertex_batch_destroy(b);
+		return;
+	}
+	for (uint32_t i = 0; i < KERNEL_VERTS; ++i) {
+		GLfloat t = (GLfloat)i * 0.01f;
+		src->x[i] = cosf(t);
+		src->y[i] = sinf(t * 3.0f);
+		src->z[i] = sinf(t) - 5.0f;
+		src->w[i] = 1.0f;
+		src->nx[i] = cosf(t * 2.0f);
+		src->ny[i] = sinf(t * 2.0f);
+		src->nz[i] = 0.5f;
+	}
+	b->viewport[2] = 256;
+	b->viewport[3] = 256;
+
+	mat4 mvp, normal;
+	mat4_perspective(&mvp, 60.0f, 1.0f, 1.0f, 100.0f);
+	mat4_identity(&normal);
+	static LightState lights[8];
+	static MaterialState mat;
+	for (int i = 0; i < 2; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			lights[i].ambient[c] = 0.1f;
+			lights[i].diffuse[c] = 0.8f;
+			lights[i].specular[c] = 1.0f;
+			mat.ambient[c] = 0.2f;
+			mat.diffuse[c] = 0.8f;
+			mat.specular[c] = 0.5f;
+		}
+		lights[i].constant_attenuation = 1.0f;
+		lights[i].enabled = GL_TRUE;
+	}
+	lights[0].position[2] = -1.0f;
+	lights[1].position[0] = 1.0f;
+	mat.shininess = 32.0f;
+	LightingSetup setup;
+	lighting_setup_init(&setup, lights, &mat, NORMAL_NORMALIZE, &normal);
+
+	for (int k = 0; k < 3; ++k) {
+		const vertex_kernel_t *kern = &kernels[k];
+		clock_t start = clock();
+		for (int pass = 0; pass < KERNEL_PASSES; ++pass) {
+			load_attributes(b, src);
+			kern->transform(b, &mvp, MAT4_PERSPECTIVE, &normal);
+			kern->light(b, &setup);
+		}
+		clock_t end = clock();
+		compute_result(start, end, &results[k]);
+		double secs = (double)(end - start) / CLOCKS_PER_SEC;
+		results[k].vertices_per_second =
+			secs > 0.0 ?
+				(double)KERNEL_VERTS * KERNEL_PASSES / secs :
+				0.0;
+		LOG_INFO("Vertex kernels %s: %.2f Mverts/s", kern->name,
+			 results[k].vertices_per_second / 1e6);
+	}
+	vertex_batch_destroy(src);
+	vertex_batch_destroy(b);
+
+	LOG_INFO("| Kernel | Mverts/s | Speedup |");
+	LOG_INFO("|--------|----------|---------|");
+	for (int k = 0; k < 3; ++k)
+		LOG_INFO("| %s | %.2f | %.2fx |", kernels[k].name,
+			 results[k].vertices_per_second / 1e6,
+			 results[0].vertices_per_second > 0.0 ?
+				 results[k].vertices_per_second /
+					 results[0].vertices_per_second :
+				 0.0);
+}
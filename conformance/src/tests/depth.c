@@ -1,6 +1,8 @@
 #include "tests.h"
 #include "pipeline/gl_framebuffer.h"
+#include "pipeline/gl_raster.h"
 #include <GLES/gl.h>
+#include <math.h>
 
 static int test_depth_comparisons(void)
 {
@@ -37,8 +39,50 @@ static int test_depth_comparisons(void)
 	return ok;
 }
 
+/* Tiles bound their depths per tile and per block: exactly after a clear,
+ * after the fragment stage reports writes and after loading linear pixels,
+ * and not at all once resolved. */
+static int test_depth_bounds(void)
+{
+	Framebuffer *fb = framebuffer_create(40, 24);
+	if (!fb)
+		return 0;
+	framebuffer_clear(fb, 0x00000000u, 0.75f, 0);
+	int ok = fb->tiles[0].zmin == 0.75f && fb->tiles[0].zmax == 0.75f;
+
+	uint32_t x = fb->width - 1, y = 0;
+	FramebufferTile *tile = framebuffer_lock_tile(fb, x, y);
+	tile->depth[(y - tile->y0) * fb->tile_size + (x - tile->x0)] = 0.25f;
+	framebuffer_update_hiz(fb, tile, x, y, x, y);
+	const float *hit = framebuffer_block_depth(fb, tile, x, y);
+	const float *miss = framebuffer_block_depth(fb, tile, tile->x0, y);
+	ok &= hit[0] == 0.25f && hit[1] == 0.75f;
+	ok &= tile->zmin == 0.25f && tile->zmax == 0.75f;
+	if (x / FB_HIZ_BLOCK_SIZE != tile->x0 / FB_HIZ_BLOCK_SIZE) {
+		ok &= miss[0] == 0.75f && miss[1] == 0.75f;
+		ok &= raster_depth_rejects(GL_LESS, 0.75f, 0.75f, miss[0],
+					   miss[1]);
+	}
+	ok &= !raster_depth_rejects(GL_LESS, 0.5f, 0.5f, hit[0], hit[1]);
+	ok &= raster_depth_rejects(GL_GREATER, 0.2f, 0.2f, hit[0], hit[1]);
+	ok &= !raster_depth_rejects(GL_GREATER, 0.5f, 0.5f, hit[0], hit[1]);
+	framebuffer_unlock_tile(tile);
+
+	framebuffer_resolve(fb);
+	ok &= tile->zmin == -INFINITY && tile->zmax == INFINITY;
+	ok &= !raster_depth_rejects(GL_LESS, 1.0f, 1.0f, tile->zmin,
+				    tile->zmax);
+	tile = framebuffer_lock_tile(fb, x, y);
+	ok &= tile->zmin == 0.25f && tile->zmax == 0.75f;
+	framebuffer_unlock_tile(tile);
+
+	framebuffer_destroy(fb);
+	return ok;
+}
+
 static const struct Test tests[] = {
 	{ "depth_comparisons", test_depth_comparisons },
+	{ "depth_bounds", test_depth_bounds },
 };
 
 const struct Test *get_depth_tests(size_t *count)
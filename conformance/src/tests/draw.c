@@ -1,6 +1,14 @@
 #include "tests.h"
 #include "util.h"
 #include "gl_utils.h"
+#include "gl_init.h"
+#include "gl_context.h"
+#include "gl_thread.h"
+#include "command_buffer.h"
+#include "pipeline/gl_framebuffer.h"
+#include "pipeline/gl_raster.h"
+#include "pipeline/gl_vertex_simd.h"
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -43,8 +51,1000 @@ int test_framebuffer_colors(void)
 	return pass;
 }
 
+/* Render with @p draw on a cleared default framebuffer and copy it out. */
+static int render_quad(void (*draw)(void), uint32_t *out, int *drawn)
+{
+	Framebuffer *fb = GL_get_default_framebuffer();
+	if (!fb)
+		return 0;
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	draw();
+	glFinish();
+	*drawn = 0;
+	for (uint32_t y = 0; y < fb->height; ++y) {
+		for (uint32_t x = 0; x < fb->width; ++x) {
+			uint32_t c = framebuffer_get_pixel(fb, x, y);
+			out[y * fb->width + x] = c;
+			*drawn += c != 0;
+		}
+	}
+	return 1;
+}
+
+static const GLfloat quad_verts[] = { -0.5f, -0.5f, 0.5f,  -0.5f,
+				      0.5f,  0.5f,  -0.5f, 0.5f };
+static const GLubyte quad_indices[] = { 0, 2, 1, 0, 3, 2 };
+
+static void draw_quad_arrays(void)
+{
+	GLfloat expanded[12];
+	for (int i = 0; i < 6; ++i) {
+		expanded[i * 2] = quad_verts[quad_indices[i] * 2];
+		expanded[i * 2 + 1] = quad_verts[quad_indices[i] * 2 + 1];
+	}
+	glVertexPointer(2, GL_FLOAT, 0, expanded);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+static void draw_quad_elements(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, quad_verts);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, quad_indices);
+}
+
+/* Default framebuffer contents and GL state the quad tests change. Later
+ * tests read the default framebuffer without clearing it. */
+typedef struct {
+	Framebuffer *fb;
+	size_t n;
+	uint32_t *color;
+	float *depth;
+	GLint viewport[4];
+	GLboolean lighting;
+	GLboolean lights[8];
+	GLfloat emission[4];
+	GLfloat diffuse[4];
+} quad_scene_t;
+
+/* Save the framebuffer and set up unlit, untransformed drawing of
+ * quad_verts over the whole framebuffer. */
+static int quad_scene_begin(quad_scene_t *s)
+{
+	s->fb = GL_get_default_framebuffer();
+	if (!s->fb)
+		return 0;
+	s->n = (size_t)s->fb->width * s->fb->height;
+	s->color = tracked_malloc(s->n * sizeof(uint32_t));
+	s->depth = tracked_malloc(s->n * sizeof(float));
+	glFinish();
+	framebuffer_resolve(s->fb);
+	if (s->color && s->depth) {
+		memcpy(s->color, (void *)s->fb->color_buffer,
+		       s->n * sizeof(uint32_t));
+		memcpy(s->depth, (void *)s->fb->depth_buffer,
+		       s->n * sizeof(float));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glGetIntegerv(GL_VIEWPORT, s->viewport);
+	glViewport(0, 0, (GLsizei)s->fb->width, (GLsizei)s->fb->height);
+	/* Unlit draws take the current color as is. */
+	s->lighting = glIsEnabled(GL_LIGHTING);
+	glDisable(GL_LIGHTING);
+	for (int i = 0; i < 8; ++i)
+		s->lights[i] = glIsEnabled(GL_LIGHT0 + i);
+	glGetMaterialfv(GL_FRONT, GL_EMISSION, s->emission);
+	glGetMaterialfv(GL_FRONT, GL_DIFFUSE, s->diffuse);
+	glColor4f(1.f, 1.f, 1.f, 1.f);
+	return s->color && s->depth;
+}
+
+/* Draw the next quads in exactly @p r, @p g, @p b, @p a. STAGE_VERTEX
+ * plugins may recolor vertices, but lighting with every light off then
+ * replaces the color with the material's emission and diffuse alpha. */
+static void flat_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	const GLfloat emission[4] = { r, g, b, 1.f };
+	const GLfloat diffuse[4] = { 0.f, 0.f, 0.f, a };
+	glEnable(GL_LIGHTING);
+	for (int i = 0; i < 8; ++i)
+		glDisable(GL_LIGHT0 + i);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emission);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
+}
+
+static void quad_scene_end(quad_scene_t *s)
+{
+	glDisableClientState(GL_VERTEX_ARRAY);
+	if (s->lighting)
+		glEnable(GL_LIGHTING);
+	else
+		glDisable(GL_LIGHTING);
+	for (int i = 0; i < 8; ++i) {
+		if (s->lights[i])
+			glEnable(GL_LIGHT0 + i);
+		else
+			glDisable(GL_LIGHT0 + i);
+	}
+	glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, s->emission);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, s->diffuse);
+	glViewport(s->viewport[0], s->viewport[1], s->viewport[2],
+		   s->viewport[3]);
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glFinish();
+	framebuffer_resolve(s->fb);
+	if (s->color && s->depth) {
+		memcpy((void *)s->fb->color_buffer, s->color,
+		       s->n * sizeof(uint32_t));
+		memcpy((void *)s->fb->depth_buffer, s->depth,
+		       s->n * sizeof(float));
+	}
+	if (s->color)
+		tracked_free(s->color, s->n * sizeof(uint32_t));
+	if (s->depth)
+		tracked_free(s->depth, s->n * sizeof(float));
+}
+
+/* Indexed draws share transformed vertices between triangles; the result
+ * must match expanding the indices by hand. */
+int test_indexed_matches_arrays(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *a = tracked_malloc(n * sizeof(uint32_t));
+	uint32_t *b = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && a && b;
+	int drawn_a = 0, drawn_b = 0;
+	if (pass)
+		pass = render_quad(draw_quad_arrays, a, &drawn_a) &&
+		       render_quad(draw_quad_elements, b, &drawn_b);
+	quad_scene_end(&scene);
+	pass = pass && drawn_a > 0 && drawn_a == drawn_b &&
+	       memcmp(a, b, n * sizeof(uint32_t)) == 0;
+	if (a)
+		tracked_free(a, n * sizeof(uint32_t));
+	if (b)
+		tracked_free(b, n * sizeof(uint32_t));
+	return pass;
+}
+
+/* quad_indices wind clockwise. Each cull setting must discard the quad
+ * on both the per-triangle and the batched path, or on neither. */
+int test_cull_face(void)
+{
+	static const struct {
+		GLboolean enabled;
+		GLenum face, front;
+		int drawn;
+	} cases[] = {
+		{ GL_FALSE, GL_BACK, GL_CCW, 1 },
+		{ GL_TRUE, GL_BACK, GL_CCW, 0 },
+		{ GL_TRUE, GL_BACK, GL_CW, 1 },
+		{ GL_TRUE, GL_FRONT, GL_CCW, 1 },
+		{ GL_TRUE, GL_FRONT, GL_CW, 0 },
+		{ GL_TRUE, GL_FRONT_AND_BACK, GL_CCW, 0 },
+	};
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	if (!scene.fb)
+		return 0;
+	uint32_t *px = tracked_malloc(scene.n * sizeof(uint32_t));
+	pass = pass && px;
+	for (size_t i = 0; pass && i < sizeof(cases) / sizeof(cases[0]);
+	     ++i) {
+		if (cases[i].enabled)
+			glEnable(GL_CULL_FACE);
+		else
+			glDisable(GL_CULL_FACE);
+		glCullFace(cases[i].face);
+		glFrontFace(cases[i].front);
+		int drawn_a = 0, drawn_b = 0;
+		pass = render_quad(draw_quad_arrays, px, &drawn_a) &&
+		       render_quad(draw_quad_elements, px, &drawn_b) &&
+		       (drawn_a > 0) == cases[i].drawn &&
+		       (drawn_b > 0) == cases[i].drawn;
+	}
+	glDisable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glFrontFace(GL_CCW);
+	quad_scene_end(&scene);
+	if (px)
+		tracked_free(px, scene.n * sizeof(uint32_t));
+	return pass;
+}
+
+/* Four vertices whose two strip triangles have different bounds. Both
+ * triangles are provoked by a red vertex only when the second one swaps
+ * its first two vertices; overlapping triangles may rasterize in either
+ * order, so every correctly provoked triangle has the same color. */
+static const GLfloat strip_verts[] = { -0.5f, -0.5f, -0.5f, 0.5f,
+				       0.5f,  -0.5f, 0.75f, 0.75f };
+static const GLubyte strip_colors[] = { 255, 0, 0, 255, 0, 255, 0,   255,
+					255, 0, 0, 255, 0, 0,	255, 255 };
+
+static void draw_colored(const GLfloat *verts, GLenum mode, GLsizei count,
+			 const GLushort *indices)
+{
+	glEnableClientState(GL_COLOR_ARRAY);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, strip_colors);
+	glVertexPointer(2, GL_FLOAT, 0, verts);
+	if (indices)
+		glDrawElements(mode, count, GL_UNSIGNED_SHORT, indices);
+	else
+		glDrawArrays(mode, 0, count);
+	glDisableClientState(GL_COLOR_ARRAY);
+}
+
+static void draw_strip_list(void)
+{
+	static const GLushort list[] = { 0, 1, 2, 2, 1, 3 };
+	draw_colored(strip_verts, GL_TRIANGLES, 6, list);
+}
+
+static void draw_strip(void)
+{
+	draw_colored(strip_verts, GL_TRIANGLE_STRIP, 4, NULL);
+}
+
+static void draw_fan_list(void)
+{
+	static const GLushort list[] = { 0, 3, 2, 0, 2, 1 };
+	draw_colored(quad_verts, GL_TRIANGLES, 6, list);
+}
+
+static void draw_fan(void)
+{
+	static const GLushort fan[] = { 0, 3, 2, 1 };
+	draw_colored(quad_verts, GL_TRIANGLE_FAN, 4, fan);
+}
+
+static void draw_quad_outline(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, quad_verts);
+	glDrawArrays(GL_LINE_LOOP, 0, 4);
+}
+
+/* A strip and a fan over four vertices draw the same triangles, in the
+ * same order and winding, as the equivalent lists. The outline's segments
+ * each leave out their last pixel, so the loop touches every perimeter
+ * pixel exactly once. */
+int test_strip_fan_loop(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *want = tracked_malloc(n * sizeof(uint32_t));
+	uint32_t *got = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && want && got;
+	int drawn_want = 0, drawn_got = 0;
+	pass = pass && render_quad(draw_strip_list, want, &drawn_want) &&
+	       render_quad(draw_strip, got, &drawn_got) && drawn_want > 0 &&
+	       memcmp(want, got, n * sizeof(uint32_t)) == 0;
+	pass = pass && render_quad(draw_fan_list, want, &drawn_want) &&
+	       render_quad(draw_fan, got, &drawn_got) && drawn_want > 0 &&
+	       memcmp(want, got, n * sizeof(uint32_t)) == 0;
+	flat_color(1.f, 1.f, 1.f, 1.f);
+	pass = pass && render_quad(draw_quad_outline, got, &drawn_got);
+	quad_scene_end(&scene);
+	uint32_t w = fb->width, h = fb->height;
+	pass = pass && drawn_got == (int)(w / 2 + h / 2) * 2 &&
+	       got[(h / 2) * w + w / 2] == 0 &&
+	       got[(h / 4) * w + w / 2] == 0xFFFFFFFFu &&
+	       got[(3 * h / 4) * w + w / 2] == 0xFFFFFFFFu &&
+	       got[(h / 2) * w + w / 4] == 0xFFFFFFFFu &&
+	       got[(h / 2) * w + 3 * w / 4] == 0xFFFFFFFFu;
+	if (want)
+		tracked_free(want, n * sizeof(uint32_t));
+	if (got)
+		tracked_free(got, n * sizeof(uint32_t));
+	return pass;
+}
+
+/* A fan of thin triangles around an off-center point, so the shared
+ * edges run at many slopes. */
+static void draw_edge_fan(void)
+{
+	GLfloat fan[2 * 26];
+	fan[0] = 0.07f;
+	fan[1] = -0.03f;
+	for (int i = 0; i <= 24; ++i) {
+		float a = (float)i * 6.2831853f / 24.0f;
+		fan[2 + i * 2] = 0.8f * cosf(a);
+		fan[3 + i * 2] = 0.7f * sinf(a);
+	}
+	fan[2 + 24 * 2] = fan[2];
+	fan[3 + 24 * 2] = fan[3];
+	glVertexPointer(2, GL_FLOAT, 0, fan);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 26);
+}
+
+/* With additive blending a pixel covered twice comes out brighter, so
+ * every drawn pixel must match: triangles sharing an edge cover each
+ * pixel center on it exactly once. The quad covers exactly its area. */
+static int covered_once(const uint32_t *px, size_t n, int drawn)
+{
+	uint32_t first = 0;
+	for (size_t i = 0; i < n && !first; ++i)
+		first = px[i];
+	for (size_t i = 0; i < n; ++i)
+		if (px[i] && px[i] != first)
+			return 0;
+	return drawn > 0;
+}
+
+int test_shared_edges(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *got = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && got;
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glColor4f(0.25f, 0.25f, 0.25f, 0.25f);
+	int drawn = 0;
+	pass = pass && render_quad(draw_quad_elements, got, &drawn) &&
+	       covered_once(got, n, drawn) &&
+	       drawn == (int)((fb->width / 2) * (fb->height / 2));
+	pass = pass && render_quad(draw_edge_fan, got, &drawn) &&
+	       covered_once(got, n, drawn);
+	glBlendFunc(GL_ONE, GL_ZERO);
+	if (!blend)
+		glDisable(GL_BLEND);
+	if (depth)
+		glEnable(GL_DEPTH_TEST);
+	quad_scene_end(&scene);
+	if (got)
+		tracked_free(got, n * sizeof(uint32_t));
+	return pass;
+}
+
+/* Overlapping triangles of assorted sizes, most of them over the center
+ * so one tile's bin spans several chunks. */
+#define BIN_TRIANGLES 48
+static GLfloat bin_verts[BIN_TRIANGLES * 6];
+static GLushort bin_indices[BIN_TRIANGLES * 3];
+
+static void fill_bin_triangles(void)
+{
+	uint32_t seed = 12345u;
+	for (int i = 0; i < BIN_TRIANGLES * 6; ++i) {
+		seed = seed * 1664525u + 1013904223u;
+		GLfloat r = (GLfloat)(seed >> 8) / (GLfloat)(1u << 24);
+		GLfloat spread = i % 6 < 2 ? 0.2f : 1.8f;
+		bin_verts[i] = (r - 0.5f) * spread;
+	}
+	for (int i = 0; i < BIN_TRIANGLES * 3; ++i)
+		bin_indices[i] = (GLushort)i;
+}
+
+static void draw_bin_arrays_separately(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, bin_verts);
+	for (int i = 0; i < BIN_TRIANGLES; ++i)
+		glDrawArrays(GL_TRIANGLES, i * 3, 3);
+}
+
+static void draw_bin_arrays(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, bin_verts);
+	glDrawArrays(GL_TRIANGLES, 0, BIN_TRIANGLES * 3);
+}
+
+static void draw_bin_elements_separately(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, bin_verts);
+	for (int i = 0; i < BIN_TRIANGLES; ++i)
+		glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT,
+			       &bin_indices[i * 3]);
+}
+
+static void draw_bin_elements(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, bin_verts);
+	glDrawElements(GL_TRIANGLES, BIN_TRIANGLES * 3, GL_UNSIGNED_SHORT,
+		       bin_indices);
+}
+
+/* A draw's triangles are binned per tile and shaded together. Additive
+ * blending makes the result independent of the order triangles reach a
+ * pixel, so one draw must match a draw per triangle exactly. */
+int test_binned_draws(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *want = tracked_malloc(n * sizeof(uint32_t));
+	uint32_t *got = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && want && got;
+	fill_bin_triangles();
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glColor4f(1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f, 1.0f);
+	int want_drawn = 0, drawn = 0;
+	pass = pass &&
+	       render_quad(draw_bin_arrays_separately, want, &want_drawn) &&
+	       render_quad(draw_bin_arrays, got, &drawn) && want_drawn > 0 &&
+	       memcmp(want, got, n * sizeof(uint32_t)) == 0;
+	pass = pass &&
+	       render_quad(draw_bin_elements_separately, want, &want_drawn) &&
+	       render_quad(draw_bin_elements, got, &drawn) && want_drawn > 0 &&
+	       memcmp(want, got, n * sizeof(uint32_t)) == 0;
+	glBlendFunc(GL_ONE, GL_ZERO);
+	if (!blend)
+		glDisable(GL_BLEND);
+	if (depth)
+		glEnable(GL_DEPTH_TEST);
+	quad_scene_end(&scene);
+	if (want)
+		tracked_free(want, n * sizeof(uint32_t));
+	if (got)
+		tracked_free(got, n * sizeof(uint32_t));
+	return pass;
+}
+
+/* Fill @p b with a deterministic spread of positions and normals, some
+ * behind the near plane; a vertex count that is not a multiple of 8 covers
+ * the padded tail. */
+static void fill_kernel_batch(VertexBatch *b)
+{
+	static const GLint viewport[4] = { 0, 0, 64, 48 };
+	memcpy(b->viewport, viewport, sizeof(viewport));
+	for (uint32_t i = 0; i < b->nverts; ++i) {
+		GLfloat t = (GLfloat)i * 0.37f;
+		b->x[i] = sinf(t) * 2.0f;
+		b->y[i] = cosf(t * 1.3f) * 2.0f;
+		b->z[i] = sinf(t * 0.7f) * 3.0f - 2.0f;
+		b->w[i] = 1.0f;
+		b->nx[i] = cosf(t);
+		b->ny[i] = sinf(t * 2.1f);
+		b->nz[i] = i % 5 ? 0.5f : 0.0f;
+	}
+	b->nx[3] = b->ny[3] = b->nz[3] = 0.0f;
+}
+
+static int kernel_close(const GLfloat *a, const GLfloat *b, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; ++i)
+		if (fabsf(a[i] - b[i]) > 1e-4f * (1.0f + fabsf(a[i])))
+			return 0;
+	return 1;
+}
+
+/* Eye-space triangles under near_projection(): the first runs from two
+ * vertices in front of the near plane to one behind the eye and must be
+ * clipped, the second lies between the eye and the near plane. Each is
+ * listed in both windings. */
+static const GLfloat near_verts[] = { -1.0f, -0.5f, -2.0f, -1.0f, 0.5f,
+				      -2.0f, -0.5f, 0.0f,  1.0f,  -0.5f,
+				      -0.5f, -0.5f, 0.5f,  -0.5f, -0.5f,
+				      0.0f,  0.5f,  -0.5f };
+static const GLushort near_indices[] = { 0, 1, 2, 0, 2, 1,
+					 3, 4, 5, 3, 5, 4 };
+
+static void near_projection(void)
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glFrustumf(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 10.0f);
+	glMatrixMode(GL_MODELVIEW);
+	glVertexPointer(3, GL_FLOAT, 0, near_verts);
+}
+
+static void draw_near_elements(void)
+{
+	near_projection();
+	glDrawElements(GL_TRIANGLES, 12, GL_UNSIGNED_SHORT, near_indices);
+}
+
+static void draw_near_arrays(void)
+{
+	GLfloat expanded[36];
+	for (int i = 0; i < 12; ++i)
+		memcpy(&expanded[i * 3], &near_verts[near_indices[i] * 3],
+		       3 * sizeof(GLfloat));
+	near_projection();
+	glVertexPointer(3, GL_FLOAT, 0, expanded);
+	glDrawArrays(GL_TRIANGLES, 0, 12);
+}
+
+/* The visible part of a near-plane crosser spans NDC x -0.83 to -0.5.
+ * Projecting the vertex behind the eye without clipping would reach
+ * x = 0.5, and the triangle short of the near plane covers the center. */
+static int near_clipped(const uint32_t *px, uint32_t w, uint32_t h,
+			int drawn)
+{
+	if (drawn <= 0)
+		return 0;
+	for (uint32_t y = 0; y < h; ++y)
+		for (uint32_t x = w / 2; x < w; ++x)
+			if (px[y * w + x])
+				return 0;
+	return 1;
+}
+
+/* Both the indexed batch path and the per-triangle path clip triangles
+ * that cross the near plane and drop those in front of it. */
+int test_near_plane_clip(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *got = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && got;
+	int drawn = 0;
+	pass = pass && render_quad(draw_near_elements, got, &drawn) &&
+	       near_clipped(got, fb->width, fb->height, drawn);
+	pass = pass && render_quad(draw_near_arrays, got, &drawn) &&
+	       near_clipped(got, fb->width, fb->height, drawn);
+	quad_scene_end(&scene);
+	if (got)
+		tracked_free(got, n * sizeof(uint32_t));
+	return pass;
+}
+
+static void draw_vbo_arrays(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, NULL);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+static void draw_vbo_elements(void)
+{
+	glVertexPointer(2, GL_FLOAT, 0, NULL);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, quad_indices);
+}
+
+/* Draws from a vertex buffer are skipped when its cached bounds fall
+ * outside the frustum. The bounds must follow buffer updates and the
+ * MVP, so an on-screen quad is never dropped. */
+int test_vbo_frustum_cull(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	size_t n = scene.n;
+	uint32_t *want = tracked_malloc(n * sizeof(uint32_t));
+	uint32_t *got = tracked_malloc(n * sizeof(uint32_t));
+	pass = pass && want && got;
+	GLfloat tri[12], off[12];
+	for (int i = 0; i < 6; ++i) {
+		tri[i * 2] = quad_verts[quad_indices[i] * 2];
+		tri[i * 2 + 1] = quad_verts[quad_indices[i] * 2 + 1];
+		off[i * 2] = tri[i * 2] + 3.0f;
+		off[i * 2 + 1] = tri[i * 2 + 1];
+	}
+	int want_drawn = 0, drawn = -1;
+	pass = pass && render_quad(draw_quad_arrays, want, &want_drawn) &&
+	       want_drawn > 0;
+	GLuint buf = 0;
+	glGenBuffers(1, &buf);
+	glBindBuffer(GL_ARRAY_BUFFER, buf);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(off), off, GL_STATIC_DRAW);
+	pass = pass && render_quad(draw_vbo_arrays, got, &drawn) && !drawn;
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(tri), tri);
+	pass = pass && render_quad(draw_vbo_arrays, got, &drawn) &&
+	       drawn == want_drawn;
+	glTranslatef(3.0f, 0.0f, 0.0f);
+	pass = pass && render_quad(draw_vbo_arrays, got, &drawn) && !drawn;
+	glLoadIdentity();
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad_verts), quad_verts,
+		     GL_STATIC_DRAW);
+	pass = pass && render_quad(draw_vbo_elements, got, &drawn) &&
+	       drawn == want_drawn;
+	glTranslatef(0.0f, 0.0f, 2.0f);
+	pass = pass && render_quad(draw_vbo_elements, got, &drawn) && !drawn;
+	glLoadIdentity();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDeleteBuffers(1, &buf);
+	quad_scene_end(&scene);
+	if (want)
+		tracked_free(want, n * sizeof(uint32_t));
+	if (got)
+		tracked_free(got, n * sizeof(uint32_t));
+	return pass;
+}
+
+/* Draw quad_verts at depth @p z, scaled by @p scale, under depth function
+ * @p func and return the center pixel. */
+static uint32_t draw_depth_quad(GLfloat z, GLfloat scale, GLenum func,
+				GLfloat r, GLfloat g, GLfloat b)
+{
+	Framebuffer *fb = GL_get_default_framebuffer();
+	glDepthFunc(func);
+	flat_color(r, g, b, 1.f);
+	glLoadIdentity();
+	glTranslatef(0.0f, 0.0f, z);
+	glScalef(scale, scale, 1.0f);
+	draw_quad_elements();
+	glFinish();
+	return framebuffer_get_pixel(fb, fb->width / 2, fb->height / 2);
+}
+
+/* Tiles and blocks whose depth bounds hide a quad drop it early; the
+ * image must still follow every depth function, including quads that are
+ * hidden in some blocks of a tile and visible in others. */
+int test_hidden_quads(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	glEnable(GL_DEPTH_TEST);
+	glClearColor(0, 0, 0, 0);
+	glClearDepthf(1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	const uint32_t red = 0xFFFF0000u, green = 0xFF00FF00u;
+	const uint32_t blue = 0xFF0000FFu, white = 0xFFFFFFFFu;
+	/* Edges off the block grid, so blocks straddle them. */
+	const GLfloat k = 0.9f;
+	pass = pass && draw_depth_quad(-0.5f, k, GL_LESS, 1, 0, 0) == red;
+	pass = pass && draw_depth_quad(0.5f, k, GL_LESS, 0, 1, 0) == red;
+	pass = pass && draw_depth_quad(-0.5f, k, GL_LEQUAL, 0, 0, 1) == blue;
+	pass = pass && draw_depth_quad(0.0f, k, GL_GREATER, 1, 1, 1) == white;
+	pass = pass && draw_depth_quad(-0.75f, k, GL_GREATER, 0, 1, 0) == white;
+	pass = pass && draw_depth_quad(0.0f, k, GL_EQUAL, 1, 0, 0) == red;
+	/* Behind the center quad, in front of the cleared border. */
+	pass = pass && draw_depth_quad(0.5f, 4, GL_LESS, 0, 1, 0) == red;
+	float left = (0.5f - 0.25f * k) * fb->width;
+	uint32_t y = fb->height / 2;
+	pass = pass && framebuffer_get_pixel(fb, 0, 0) == green &&
+	       framebuffer_get_pixel(fb, (uint32_t)(left - 1), y) == green &&
+	       framebuffer_get_pixel(fb, (uint32_t)(left + 1), y) == red;
+	glLoadIdentity();
+	glDepthFunc(GL_LESS);
+	if (!depth)
+		glDisable(GL_DEPTH_TEST);
+	quad_scene_end(&scene);
+	return pass;
+}
+
+/* Holds the first tile for a while, as a slow fragment job would, so a
+ * clear queued behind it is still pending when the next draw bins. */
+static void hold_first_tile(void *arg)
+{
+	FramebufferTile *tile = framebuffer_lock_tile((Framebuffer *)arg, 0, 0);
+	thrd_sleep(&(struct timespec){ .tv_nsec = 20000000 }, NULL);
+	framebuffer_unlock_tile(tile);
+}
+
+/* A clear recorded between two draws must reset the depth bounds before
+ * the second draw bins against them, however the workers pick up the
+ * clear; otherwise the draw is rejected by the first draw's depths. */
+int test_clear_orders_draws(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	ThreadPool *workers =
+		thread_pool_create(&(thread_pool_config_t){ .num_threads = 3 });
+	pass = pass && workers && framebuffer_set_thread_pool(fb, workers);
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glClearDepthf(1.0f);
+	glClearColor(1, 0, 0, 1);
+	flat_color(0, 1, 0, 1);
+	glScalef(4.0f, 4.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	draw_quad_elements();
+	for (int i = 0; i < 8 && pass; ++i) {
+		command_buffer_record_task_group(hold_first_tile, fb,
+						 STAGE_FRAMEBUFFER, fb->tasks);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		draw_quad_elements();
+		glFinish();
+		pass = framebuffer_get_pixel(fb, fb->width / 2,
+					     fb->height / 2) == 0xFF00FF00u;
+	}
+	glLoadIdentity();
+	glClearColor(0, 0, 0, 0);
+	if (!depth)
+		glDisable(GL_DEPTH_TEST);
+	if (workers) {
+		framebuffer_set_thread_pool(fb,
+					    GetCurrentContext()->thread_pool);
+		thread_pool_destroy(workers);
+	}
+	quad_scene_end(&scene);
+	return pass;
+}
+
+/* A GL_ALWAYS draw can raise depth above the tile bounds while it is
+ * queued, so once one is recorded bins must not reject by those bounds
+ * until the buffer is waited on. A following GL_LESS draw in front of the
+ * raised depth but behind the cleared one must still show. */
+int test_depth_func_orders_draws(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	Framebuffer *fb = scene.fb;
+	if (!fb)
+		return 0;
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	glEnable(GL_DEPTH_TEST);
+	glClearDepthf(0.5f);
+	glClearColor(1, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDepthFunc(GL_ALWAYS);
+	flat_color(0, 0, 1, 1);
+	glTranslatef(0.0f, 0.0f, 0.8f);
+	glScalef(4.0f, 4.0f, 1.0f);
+	draw_quad_elements();
+	pass = pass && atomic_load(&fb->depth_raised);
+	glFinish();
+	pass = pass && !atomic_load(&fb->depth_raised);
+	glDepthFunc(GL_LESS);
+	flat_color(0, 1, 0, 1);
+	glLoadIdentity();
+	glTranslatef(0.0f, 0.0f, 0.4f);
+	glScalef(4.0f, 4.0f, 1.0f);
+	draw_quad_elements();
+	pass = pass && !atomic_load(&fb->depth_raised) &&
+	       raster_bin_hiz_func(fb) == GL_LESS;
+	glFinish();
+	pass = pass && framebuffer_get_pixel(fb, fb->width / 2,
+					     fb->height / 2) == 0xFF00FF00u;
+	glLoadIdentity();
+	glClearDepthf(1.0f);
+	glClearColor(0, 0, 0, 0);
+	if (!depth)
+		glDisable(GL_DEPTH_TEST);
+	quad_scene_end(&scene);
+	return pass;
+}
+
+/* Depth is tested ahead of texturing only without an alpha test; fragments
+ * the alpha test discards must leave the depth buffer alone. */
+int test_alpha_late_depth(void)
+{
+	quad_scene_t scene;
+	int pass = quad_scene_begin(&scene);
+	if (!scene.fb)
+		return 0;
+	GLboolean depth = glIsEnabled(GL_DEPTH_TEST);
+	glEnable(GL_DEPTH_TEST);
+	glClearColor(0, 0, 0, 0);
+	glClearDepthf(1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_ALPHA_TEST);
+	glAlphaFunc(GL_GREATER, 0.5f);
+	flat_color(1, 0, 0, 0.25f);
+	glLoadIdentity();
+	glTranslatef(0.0f, 0.0f, -0.5f);
+	draw_quad_elements();
+	glFinish();
+	glDisable(GL_ALPHA_TEST);
+	pass = pass && draw_depth_quad(0.5f, 1, GL_LESS, 0, 1, 0) ==
+			       0xFF00FF00u;
+	pass = pass && draw_depth_quad(0.75f, 1, GL_LESS, 0, 0, 1) ==
+			       0xFF00FF00u;
+	pass = pass && draw_depth_quad(0.75f, 1, GL_LESS, 0, 0, 1) ==
+			       0xFF00FF00u;
+	glLoadIdentity();
+	glAlphaFunc(GL_ALWAYS, 0.0f);
+	if (!depth)
+		glDisable(GL_DEPTH_TEST);
+	quad_scene_end(&scene);
+	return pass;
+}
+
+/* Every float array the transform and lighting kernels write. */
+static void kernel_outputs(const VertexBatch *b, const GLfloat *out[14])
+{
+	const GLfloat *arrays[14] = { b->x,	    b->y,	 b->z,
+				      b->w,	    b->sx,	 b->sy,
+				      b->sz,	    b->nx,	 b->ny,
+				      b->nz,	    b->color[0], b->color[1],
+				      b->color[2],  b->color[3] };
+	memcpy(out, arrays, sizeof(arrays));
+}
+
+/* The 4- and 8-wide transform and lighting kernels must agree with the
+ * scalar reference. */
+int test_vertex_kernels_match(void)
+{
+	mat4 mvp, normal, view;
+	mat4_perspective(&mvp, 60.0f, 4.0f / 3.0f, 0.5f, 50.0f);
+	mat4_identity(&view);
+	mat4_rotate_y(&view, 30.0f);
+	mat4_translate(&view, 0.5f, -0.25f, 0.0f);
+	mat4 proj = mvp;
+	mat4_multiply(&mvp, &proj, &view);
+	normal = view;
+	CHECK_OK(mat4_inverse(&normal));
+	mat4_transpose(&normal);
+	static LightState lights[8];
+	static MaterialState mat;
+	static const GLfloat white[4] = { 1.f, 1.f, 1.f, 1.f };
+	static const GLfloat grey[4] = { 0.2f, 0.2f, 0.2f, 1.f };
+	static const GLfloat black[4] = { 0.f, 0.f, 0.f, 1.f };
+	for (int i = 0; i < 2; ++i) {
+		memcpy(lights[i].ambient, grey, sizeof(grey));
+		memcpy(lights[i].diffuse, white, sizeof(white));
+		memcpy(lights[i].specular, white, sizeof(white));
+		lights[i].constant_attenuation = 1.0f;
+		lights[i].linear_attenuation = 0.1f * i;
+		lights[i].enabled = GL_TRUE;
+	}
+	lights[0].position[2] = -1.0f;
+	lights[1].position[0] = 2.0f;
+	lights[1].position[1] = -1.0f;
+	memcpy(mat.ambient, grey, sizeof(grey));
+	memcpy(mat.diffuse, white, sizeof(white));
+	memcpy(mat.specular, grey, sizeof(grey));
+	mat.emission[3] = 1.0f;
+	mat.shininess = 16.0f;
+
+	VertexBatch *ref = vertex_batch_create(37, GL_TRIANGLES, 0);
+	VertexBatch *x4 = vertex_batch_create(37, GL_TRIANGLES, 0);
+	VertexBatch *x8 = vertex_batch_create(37, GL_TRIANGLES, 0);
+	int pass = ref && x4 && x8;
+	/* Every specialization: each normal mode, with and without specular,
+	 * and with no lights at all. */
+	for (int variant = 0; pass && variant < 7; ++variant) {
+		int mode = variant % 3;
+		lights[0].enabled = variant < 6;
+		lights[1].enabled = variant < 6;
+		memcpy(mat.specular, variant < 3 ? grey : black,
+		       sizeof(grey));
+		LightingSetup setup;
+		lighting_setup_init(&setup, lights, &mat, mode, &normal);
+		fill_kernel_batch(ref);
+		fill_kernel_batch(x4);
+		fill_kernel_batch(x8);
+		vertex_transform_scalar(ref, &mvp, MAT4_PERSPECTIVE, &normal);
+		vertex_light_scalar(ref, &setup);
+		vertex_transform_x4(x4, &mvp, MAT4_PERSPECTIVE, &normal);
+		vertex_light_x4(x4, &setup);
+		vertex_transform_x8(x8, &mvp, MAT4_PERSPECTIVE, &normal);
+		vertex_light_x8(x8, &setup);
+		const GLfloat *want[14], *got4[14], *got8[14];
+		kernel_outputs(ref, want);
+		kernel_outputs(x4, got4);
+		kernel_outputs(x8, got8);
+		for (int k = 0; k < 14; ++k)
+			pass = pass && kernel_close(want[k], got4[k], 37) &&
+			       kernel_close(want[k], got8[k], 37);
+		pass = pass &&
+		       !memcmp(ref->clip, x4->clip, 37 * sizeof(int32_t)) &&
+		       !memcmp(ref->clip, x8->clip, 37 * sizeof(int32_t));
+	}
+	vertex_batch_destroy(ref);
+	vertex_batch_destroy(x4);
+	vertex_batch_destroy(x8);
+	return pass;
+}
+
+/* The affine and 2D transform loops must match the general one on the
+ * positions they accept; neither reads w and the 2D loop does not read z. */
+int test_transform_kinds_match(void)
+{
+	mat4 ortho, affine, rot;
+	mat4_orthographic(&ortho, -3.0f, 3.0f, -2.0f, 2.0f, -1.0f, 5.0f);
+	mat4_translate(&ortho, 0.25f, -0.5f, 0.0f);
+	mat4_identity(&rot);
+	mat4_rotate_z(&rot, 20.0f);
+	mat4_multiply(&affine, &ortho, &rot);
+	CHECK_OK(mat4_classify(&ortho) == MAT4_ORTHO);
+	CHECK_OK(mat4_classify(&affine) == MAT4_AFFINE);
+	const struct {
+		const mat4 *m;
+		mat4_class cls;
+		uint8_t size;
+	} cases[] = {
+		{ &ortho, MAT4_ORTHO, 2 },
+		{ &ortho, MAT4_ORTHO, 3 },
+		{ &affine, MAT4_AFFINE, 2 },
+		{ &affine, MAT4_AFFINE, 3 },
+	};
+	VertexBatch *ref = vertex_batch_create(37, GL_TRIANGLES, 0);
+	VertexBatch *got[3];
+	int pass = ref != NULL;
+	for (int k = 0; k < 3; ++k) {
+		got[k] = vertex_batch_create(37, GL_TRIANGLES, 0);
+		pass = pass && got[k];
+	}
+	for (size_t c = 0; pass && c < sizeof(cases) / sizeof(cases[0]);
+	     ++c) {
+		fill_kernel_batch(ref);
+		if (cases[c].size < 3)
+			memset(ref->z, 0, 37 * sizeof(GLfloat));
+		vertex_transform_scalar(ref, cases[c].m, MAT4_PERSPECTIVE,
+					NULL);
+		for (int k = 0; k < 3; ++k) {
+			VertexBatch *b = got[k];
+			fill_kernel_batch(b);
+			b->position_size = cases[c].size;
+			bool flat = vertex_transform_kind(b, cases[c].cls) ==
+				    TRANSFORM_2D;
+			for (uint32_t i = 0; i < 37; ++i) {
+				if (cases[c].size < 3)
+					b->z[i] = flat ? 9.0f : 0.0f;
+				b->w[i] = 7.0f;
+			}
+			if (k == 0)
+				vertex_transform_scalar(b, cases[c].m,
+							cases[c].cls, NULL);
+			else if (k == 1)
+				vertex_transform_x4(b, cases[c].m,
+						    cases[c].cls, NULL);
+			else
+				vertex_transform_x8(b, cases[c].m,
+						    cases[c].cls, NULL);
+			const GLfloat *want[14], *have[14];
+			kernel_outputs(ref, want);
+			kernel_outputs(b, have);
+			for (int a = 0; a < 7; ++a)
+				pass = pass && kernel_close(want[a], have[a],
+							    37);
+			pass = pass && !memcmp(ref->clip, b->clip,
+					       37 * sizeof(int32_t));
+		}
+	}
+	vertex_batch_destroy(ref);
+	for (int k = 0; k < 3; ++k)
+		vertex_batch_destroy(got[k]);
+	return pass;
+}
+
 static const struct Test tests[] = {
 	{ "framebuffer_colors", test_framebuffer_colors },
+	{ "indexed_matches_arrays", test_indexed_matches_arrays },
+	{ "cull_face", test_cull_face },
+	{ "strip_fan_loop", test_strip_fan_loop },
+	{ "near_plane_clip", test_near_plane_clip },
+	{ "vbo_frustum_cull", test_vbo_frustum_cull },
+	{ "shared_edges", test_shared_edges },
+	{ "binned_draws", test_binned_draws },
+	{ "hidden_quads", test_hidden_quads },
+	{ "clear_orders_draws", test_clear_orders_draws },
+	{ "depth_func_orders_draws", test_depth_func_orders_draws },
+	{ "alpha_late_depth", test_alpha_late_depth },
+	{ "vertex_kernels_match", test_vertex_kernels_match },
+	{ "transform_kinds_match", test_transform_kinds_match },
 };
 
 const struct Test *get_draw_tests(size_t *count)
@@ -52,10 +52,49 @@ int test_async_clear_destroy(void)
 	return 1;
 }
 
+/* Rendering into a tile leaves it resident until something reads it back;
+ * a clear only marks the tiles, and tiles nothing renders stay cleared
+ * until a resolve fills them in. */
+int test_tile_residency(void)
+{
+	Framebuffer *fb = framebuffer_create(40, 40);
+	if (!fb)
+		return 0;
+	size_t ntiles = (size_t)fb->tiles_x * fb->tiles_y;
+	uint32_t last = fb->width * fb->height - 1;
+	framebuffer_clear(fb, 0x000000FFu, 1.0f, 0); /* blue */
+	int ok = (fb->color_buffer[last] & 0xFFFFFFu) == 0;
+	for (size_t i = 0; i < ntiles; ++i)
+		ok &= fb->tiles[i].state == FB_TILE_CLEARED;
+
+	FramebufferTile *tile = framebuffer_lock_tile(fb, 1, 1);
+	framebuffer_enter_tile(tile);
+	framebuffer_set_pixel(fb, 1, 1, 0x00FF0000u, 0.0f); /* red */
+	framebuffer_leave_tile();
+	framebuffer_unlock_tile(tile);
+	ok &= tile->state == FB_TILE_RESIDENT;
+	ok &= (fb->color_buffer[fb->width + 1] & 0xFFFFFFu) == 0;
+
+	/* Reading a pixel resolves its tile alone. */
+	ok &= (framebuffer_get_pixel(fb, 1, 1) & 0xFFFFFFu) == 0xFF0000u;
+	ok &= tile->state == FB_TILE_LINEAR;
+	if (ntiles > 1)
+		ok &= fb->tiles[ntiles - 1].state == FB_TILE_CLEARED;
+
+	framebuffer_resolve(fb);
+	for (size_t i = 0; i < ntiles; ++i)
+		ok &= fb->tiles[i].state == FB_TILE_LINEAR;
+	ok &= (fb->color_buffer[last] & 0xFFFFFFu) == 0xFFu;
+	ok &= fb->depth_buffer[last] == 1.0f;
+	framebuffer_destroy(fb);
+	return ok;
+}
+
 static const struct Test tests[] = {
 	{ "framebuffer_complete", test_framebuffer_complete },
 	{ "framebuffer_module", test_framebuffer_module },
 	{ "async_clear_destroy", test_async_clear_destroy },
+	{ "tile_residency", test_tile_residency },
 };
 
 const struct Test *get_fbo_tests(size_t *count)
@@ -1,4 +1,5 @@
 #include "tests.h"
+#include "gl_context.h"
 #include <math.h>
 
 int test_matrix_stack(void)
@@ -30,9 +31,52 @@ int test_matrix_overflow(void)
 	return 1;
 }
 
+/* The entry points track the class the vertex stage specializes on; it
+ * must never be narrower than the matrix it describes. */
+int test_matrix_class(void)
+{
+	const RenderContext *ctx = GetCurrentContext();
+	static const GLfloat skew[16] = { 1, 0, 0, 0, 0.5f, 1, 0, 0,
+					  0, 0, 1, 0, 0,    0, 0, 1 };
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	CHECK_OK(ctx->modelview_class == MAT4_IDENTITY);
+	glTranslatef(1.0f, 2.0f, 0.0f);
+	CHECK_OK(ctx->modelview_class == MAT4_TRANSLATE);
+	glPushMatrix();
+	glScalef(2.0f, 2.0f, 1.0f);
+	CHECK_OK(ctx->modelview_class == MAT4_ORTHO);
+	glRotatef(30.0f, 0.0f, 0.0f, 1.0f);
+	CHECK_OK(ctx->modelview_class == MAT4_AFFINE);
+	glPopMatrix();
+	CHECK_OK(ctx->modelview_class ==
+		 mat4_classify(&ctx->modelview_matrix));
+	glMultMatrixf(skew);
+	CHECK_OK(ctx->modelview_class == MAT4_AFFINE);
+	CHECK_OK(ctx->modelview_class >=
+		 mat4_classify(&ctx->modelview_matrix));
+	glLoadMatrixf(skew);
+	CHECK_OK(ctx->modelview_class == MAT4_AFFINE);
+	glLoadIdentity();
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0.0f, 64.0f, 0.0f, 48.0f, -1.0f, 1.0f);
+	CHECK_OK(ctx->projection_class == MAT4_ORTHO);
+	glLoadIdentity();
+	glFrustumf(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 10.0f);
+	CHECK_OK(ctx->projection_class == MAT4_PERSPECTIVE);
+	glLoadIdentity();
+	CHECK_OK(ctx->projection_class == MAT4_IDENTITY);
+	glMatrixMode(GL_MODELVIEW);
+	CHECK_GLError(GL_NO_ERROR);
+	return 1;
+}
+
 static const struct Test tests[] = {
 	{ "matrix_stack", test_matrix_stack },
 	{ "matrix_overflow", test_matrix_overflow },
+	{ "matrix_class", test_matrix_class },
 };
 
 const struct Test *get_matrix_tests(size_t *count)
@@ -1,7 +1,11 @@
 #include "tests.h"
 #include "command_buffer.h"
 #include "gl_thread.h"
+#include "cpu_topology.h"
 #include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void inc_task(void *data)
 {
@@ -23,8 +27,310 @@ int test_command_buffer_ring(void)
 	return atomic_load_explicit(&counter, memory_order_relaxed) == total;
 }
 
+int test_submit_batch(void)
+{
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	/* Larger than a local queue so part of the batch spills. */
+	enum { BATCH = 200 };
+	task_t tasks[BATCH];
+	for (int i = 0; i < BATCH; ++i)
+		tasks[i] = (task_t){ inc_task, &counter, STAGE_FRAGMENT, NULL };
+	thread_pool_submit_batch(tasks, BATCH);
+	thread_pool_submit_batch(tasks, 0);
+	thread_pool_wait_timeout(2000);
+	return atomic_load_explicit(&counter, memory_order_relaxed) == BATCH;
+}
+
+static void fan_out_task(void *data)
+{
+	/* Runs on a worker, so these land in its own deque and force it to
+	 * grow past the initial ring. */
+	for (int i = 0; i < 1000; ++i)
+		thread_pool_submit(inc_task, data, STAGE_FRAGMENT);
+}
+
+int test_deque_growth(void)
+{
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	/* More tasks than the injection queue holds at once. */
+	for (int i = 0; i < 8; ++i)
+		thread_pool_submit(fan_out_task, &counter, STAGE_RASTER);
+	for (int i = 0; i < 6000; ++i)
+		thread_pool_submit(inc_task, &counter, STAGE_VERTEX);
+	thread_pool_wait_timeout(5000);
+	return atomic_load_explicit(&counter, memory_order_relaxed) == 14000;
+}
+
+struct isolation_state {
+	task_group_t *fast;
+	atomic_bool observed;
+};
+
+static void gate_task(void *data)
+{
+	/* Holds the slow group open until the fast group has drained, which
+	 * must happen independently of this task. */
+	struct isolation_state *st = data;
+	for (int i = 0; i < 2000000; ++i) {
+		if (task_group_pending(st->fast) == 0) {
+			atomic_store_explicit(&st->observed, true,
+					      memory_order_release);
+			return;
+		}
+		thrd_yield();
+	}
+}
+
+static void spawn_task(void *data)
+{
+	/* Children inherit the running task's group. */
+	thread_pool_submit(inc_task, data, STAGE_PRIMITIVE);
+}
+
+int test_task_group_isolation(void)
+{
+	task_group_t *slow = task_group_create();
+	task_group_t *fast = task_group_create();
+	if (!slow || !fast)
+		return 0;
+	struct isolation_state st = { .fast = fast };
+	atomic_init(&st.observed, false);
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	task_t gate = { gate_task, &st, STAGE_FRAGMENT, slow };
+	thread_pool_submit_batch(&gate, 1);
+	task_t spawn = { spawn_task, &counter, STAGE_VERTEX, fast };
+	thread_pool_submit_batch(&spawn, 1);
+	int ok = task_group_wait_timeout(fast, 2000) &&
+		 atomic_load_explicit(&counter, memory_order_relaxed) == 1;
+	task_group_wait(slow);
+	ok = ok && task_group_pending(slow) == 0 &&
+	     atomic_load_explicit(&st.observed, memory_order_acquire);
+	task_group_release(slow);
+	task_group_release(fast);
+	return ok;
+}
+
+static void cache_task(void *data)
+{
+	if (thread_get_texture_cache())
+		inc_task(data);
+}
+
+int test_help_while_waiting(void)
+{
+	/* thread_pool_wait() may run tasks on the caller; every task must
+	 * still see a per-thread texture cache. */
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	for (int i = 0; i < 3000; ++i)
+		thread_pool_submit(cache_task, &counter, STAGE_FRAGMENT);
+	thread_pool_wait();
+	return atomic_load_explicit(&counter, memory_order_relaxed) == 3000 &&
+	       thread_get_texture_cache() == NULL;
+}
+
+int test_affinity_plan(void)
+{
+	/* Two little clusters of two cores, one big cluster of two SMT
+	 * cores. */
+	static const cpu_info_t cpus[] = {
+		{ 0, 0, 0, 0, 0, 512 },  { 1, 0, 1, 0, 0, 512 },
+		{ 2, 0, 2, 2, 0, 512 },  { 3, 0, 3, 2, 0, 512 },
+		{ 4, 0, 4, 4, 0, 1024 }, { 5, 0, 4, 4, 1, 1024 },
+		{ 6, 0, 5, 4, 0, 1024 }, { 7, 0, 5, 4, 1, 1024 },
+	};
+	const int n = sizeof(cpus) / sizeof(cpus[0]);
+	int plan[4];
+	static const int compact[] = { 4, 5, 6, 7 };
+	static const int scatter[] = { 4, 6, 0, 2 };
+	static const int physical[] = { 4, 6, 0, 1 };
+	static const int list[] = { 2, 3, 2, 3 };
+	CHECK_OK(cpu_affinity_plan("compact", cpus, n, plan, 4));
+	CHECK_OK(memcmp(plan, compact, sizeof(plan)) == 0);
+	CHECK_OK(cpu_affinity_plan("scatter", cpus, n, plan, 4));
+	CHECK_OK(memcmp(plan, scatter, sizeof(plan)) == 0);
+	CHECK_OK(cpu_affinity_plan("physical", cpus, n, plan, 4));
+	CHECK_OK(memcmp(plan, physical, sizeof(plan)) == 0);
+	CHECK_OK(cpu_affinity_plan("2-3", cpus, n, plan, 4));
+	CHECK_OK(memcmp(plan, list, sizeof(plan)) == 0);
+	CHECK_OK(!cpu_affinity_plan("none", cpus, n, plan, 4));
+	CHECK_OK(!cpu_affinity_plan("1-", cpus, n, plan, 4));
+	return 1;
+}
+
+static void slow_tile_task(void *data)
+{
+	atomic_fetch_add_explicit((atomic_uint *)data, 1, memory_order_relaxed);
+	for (volatile int i = 0; i < 20000; ++i)
+		;
+}
+
+int test_lane_hwm_throttle(void)
+{
+	atomic_uint started;
+	atomic_uint counter;
+	atomic_init(&started, 0);
+	atomic_init(&counter, 0);
+	enum { TILES = 200, HWM = 8 };
+	task_t tiles[TILES];
+	for (int i = 0; i < TILES; ++i)
+		tiles[i] = (task_t){ slow_tile_task, &started, STAGE_FRAGMENT,
+				     NULL };
+	thread_pool_set_lane_hwm(STAGE_FRAGMENT, HWM);
+	thread_pool_submit_batch(tiles, TILES);
+	/* Vertex work may only be queued once the fragment lane is back
+	 * under its mark, so the submitter must have helped drain it. */
+	thread_pool_submit(inc_task, &counter, STAGE_VERTEX);
+	unsigned drained =
+		atomic_load_explicit(&started, memory_order_relaxed);
+	thread_pool_set_lane_hwm(STAGE_FRAGMENT, 256);
+	thread_pool_wait_timeout(5000);
+	CHECK_OK(drained >= TILES - HWM);
+	CHECK_OK(atomic_load_explicit(&started, memory_order_relaxed) ==
+		 TILES);
+	CHECK_OK(atomic_load_explicit(&counter, memory_order_relaxed) == 1);
+	return 1;
+}
+
+int test_idle_park_wakeup(void)
+{
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	/* Without a spin phase every submission after the first has to wake
+	 * a parked worker. */
+	thread_pool_set_spin_us(0);
+	for (int i = 0; i < 20; ++i) {
+		thread_pool_submit(inc_task, &counter, STAGE_VERTEX);
+		thrd_sleep(&(struct timespec){ .tv_nsec = 200000 }, NULL);
+	}
+	int idle = thread_pool_wait_timeout(2000);
+	thread_pool_set_spin_us(50);
+	CHECK_OK(idle);
+	CHECK_OK(atomic_load_explicit(&counter, memory_order_relaxed) == 20);
+	return 1;
+}
+
+static void hold_task(void *data)
+{
+	/* Spawned work inherits the group and so stays on the same pool. */
+	thread_pool_submit(inc_task, data, STAGE_FRAGMENT);
+	while (atomic_load_explicit((atomic_uint *)data,
+				    memory_order_acquire) < 2)
+		thrd_yield();
+}
+
+int test_pool_isolation(void)
+{
+	ThreadPool *tenant =
+		thread_pool_create(&(thread_pool_config_t){ .num_threads = 1 });
+	CHECK_OK(tenant != NULL);
+	task_group_t *group = task_group_create_on(tenant);
+	CHECK_OK(task_group_pool(group) == tenant);
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	task_t hold = { hold_task, &counter, STAGE_VERTEX, group };
+	thread_pool_submit_batch(&hold, 1);
+	/* The default pool must go idle while the tenant's task is held. */
+	int idle = thread_pool_wait_timeout(2000);
+	uint64_t held = task_group_pending(group);
+	atomic_fetch_add_explicit(&counter, 1, memory_order_release);
+	thread_pool_drain(tenant);
+	task_group_release(group);
+	thread_pool_destroy(tenant);
+	CHECK_OK(idle);
+	CHECK_OK(held > 0);
+	CHECK_OK(atomic_load_explicit(&counter, memory_order_relaxed) == 2);
+	return 1;
+}
+
+static size_t count_substr(const char *s, const char *sub)
+{
+	size_t n = 0;
+	for (const char *p = strstr(s, sub); p; p = strstr(p + 1, sub))
+		n++;
+	return n;
+}
+
+int test_trace_export(void)
+{
+	const char *path = "trace_out.json";
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	CHECK_OK(thread_trace_start(path));
+	CHECK_OK(!thread_trace_start(path));
+	for (int i = 0; i < 16; ++i)
+		thread_pool_submit(inc_task, &counter, STAGE_FRAGMENT);
+	thread_pool_wait();
+	thread_trace_next_frame();
+	for (int i = 0; i < 16; ++i)
+		thread_pool_submit(inc_task, &counter, STAGE_VERTEX);
+	thread_trace_stop();
+	FILE *f = fopen(path, "rb");
+	CHECK_OK(f != NULL);
+	static char buf[64 * 1024];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	remove(path);
+	buf[len] = '\0';
+	CHECK_OK(strncmp(buf, "{\"traceEvents\":[", 16) == 0);
+	CHECK_OK(strstr(buf, "],\"displayTimeUnit\":\"ns\"}") != NULL);
+	CHECK_OK(count_substr(buf, "\"ph\":\"X\"") == 32);
+	CHECK_OK(count_substr(buf, "\"name\":\"Fragment\"") == 16);
+	CHECK_OK(count_substr(buf, "\"name\":\"Vertex\"") == 16);
+	/* The two batches straddle a frame boundary. */
+	unsigned lo = ~0u, hi = 0;
+	for (const char *p = strstr(buf, "\"frame\":"); p;
+	     p = strstr(p + 1, "\"frame\":")) {
+		unsigned frame = (unsigned)strtoul(p + 8, NULL, 10);
+		lo = frame < lo ? frame : lo;
+		hi = frame > hi ? frame : hi;
+	}
+	CHECK_OK(hi == lo + 1);
+	CHECK_OK(atomic_load_explicit(&counter, memory_order_relaxed) == 32);
+	return 1;
+}
+
+int test_metrics_snapshot(void)
+{
+	struct microgles_metrics before, after;
+	CHECK_OK(microgles_metrics_snapshot(&before));
+	atomic_uint counter;
+	atomic_init(&counter, 0);
+	for (int i = 0; i < 32; ++i)
+		thread_pool_submit(inc_task, &counter, STAGE_RASTER);
+	thread_pool_wait();
+	CHECK_OK(microgles_metrics_snapshot(&after));
+	CHECK_OK(after.num_workers == before.num_workers);
+	CHECK_OK(after.timestamp_ns >= before.timestamp_ns);
+	CHECK_OK(after.tasks_by_stage[STAGE_RASTER] -
+			 before.tasks_by_stage[STAGE_RASTER] ==
+		 32);
+	CHECK_OK(after.tasks - before.tasks >= 32);
+	CHECK_OK(after.steals >= before.steals);
+	CHECK_OK(after.parks >= before.parks);
+	CHECK_OK(after.queued == 0);
+	uint64_t per_worker = 0;
+	for (int i = 0; i < after.num_workers; ++i)
+		per_worker += after.workers[i].tasks;
+	CHECK_OK(per_worker <= after.tasks);
+	return 1;
+}
+
 static const struct Test tests[] = {
 	{ "command_buffer_ring", test_command_buffer_ring },
+	{ "submit_batch", test_submit_batch },
+	{ "deque_growth", test_deque_growth },
+	{ "task_group_isolation", test_task_group_isolation },
+	{ "help_while_waiting", test_help_while_waiting },
+	{ "affinity_plan", test_affinity_plan },
+	{ "lane_hwm_throttle", test_lane_hwm_throttle },
+	{ "idle_park_wakeup", test_idle_park_wakeup },
+	{ "pool_isolation", test_pool_isolation },
+	{ "trace_export", test_trace_export },
+	{ "metrics_snapshot", test_metrics_snapshot },
 };
 
 const struct Test *get_thread_stress_tests(size_t *count)
@@ -3,6 +3,8 @@
 #include <stdalign.h>
 
 #define COMMAND_RING_SIZE 1024
+/* Commands are forwarded to the pool in chunks of this size. */
+#define COMMAND_SUBMIT_BATCH 128
 
 #ifdef USE_TLS_COMMAND_RING
 static _Thread_local _Alignas(64) GLCommand g_ring[COMMAND_RING_SIZE];
@@ -29,6 +31,12 @@ void command_buffer_shutdown(void)
 
 void command_buffer_record_task(task_function_t func, void *data,
 				stage_tag_t stage)
+{
+	command_buffer_record_task_group(func, data, stage, NULL);
+}
+
+void command_buffer_record_task_group(task_function_t func, void *data,
+				      stage_tag_t stage, task_group_t *group)
 {
 	uint32_t t = atomic_load_explicit(&g_tail, memory_order_relaxed);
 	uint32_t h = atomic_load_explicit(&g_head, memory_order_acquire);
@@ -43,6 +51,7 @@ void command_buffer_record_task(task_function_t func, void *data,
 	g_ring[slot].params.task.func = func;
 	g_ring[slot].params.task.data = data;
 	g_ring[slot].params.task.stage = stage;
+	g_ring[slot].params.task.group = group;
 	atomic_store_explicit(&g_tail, t + 1, memory_order_release);
 }
 
@@ -50,17 +59,25 @@ void command_buffer_flush(void)
 {
 	uint32_t h = atomic_load_explicit(&g_head, memory_order_relaxed);
 	uint32_t t = atomic_load_explicit(&g_tail, memory_order_acquire);
+	task_t batch[COMMAND_SUBMIT_BATCH];
+	size_t n = 0;
 	while (h < t) {
 		uint32_t slot = h % COMMAND_RING_SIZE;
 		GLCommand *cmd = &g_ring[slot];
 		if (cmd->op == 1) {
-			thread_pool_submit(cmd->params.task.func,
-					   cmd->params.task.data,
-					   cmd->params.task.stage);
+			batch[n++] = (task_t){ cmd->params.task.func,
+					       cmd->params.task.data,
+					       cmd->params.task.stage,
+					       cmd->params.task.group };
 			cmd->op = 0;
+			if (n == COMMAND_SUBMIT_BATCH) {
+				thread_pool_submit_batch(batch, n);
+				n = 0;
+			}
 		}
 		h++;
 	}
+	thread_pool_submit_batch(batch, n);
 	atomic_store_explicit(&g_head, t, memory_order_release);
 	atomic_store_explicit(&g_tail, t, memory_order_release);
 }
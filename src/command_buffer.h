@@ -18,6 +18,7 @@ typedef struct {
 			task_function_t func;
 			void *data;
 			stage_tag_t stage;
+			task_group_t *group;
 		} task;
 	} params;
 } GLCommand;
@@ -26,6 +27,9 @@ void command_buffer_init(void);
 void command_buffer_shutdown(void);
 void command_buffer_record_task(task_function_t func, void *data,
 				stage_tag_t stage);
+/* Record a task counted against @p group (see task_group_wait()). */
+void command_buffer_record_task_group(task_function_t func, void *data,
+				      stage_tag_t stage, task_group_t *group);
 void command_buffer_flush(void);
 
 #ifdef __cplusplus
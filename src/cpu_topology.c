@@ -0,0 +1,261 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "cpu_topology.h"
+#include "gl_logger.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+/* Parse a kernel style CPU list ("0-3,6"). Returns the number of CPUs
+ * written to @p out or -1 on a syntax error. */
+static int parse_cpu_list(const char *s, int *out, int max)
+{
+	int n = 0;
+	while (*s && *s != '\n') {
+		char *end;
+		if (!isdigit((unsigned char)*s))
+			return -1;
+		long lo = strtol(s, &end, 10);
+		long hi = lo;
+		s = end;
+		if (*s == '-') {
+			if (!isdigit((unsigned char)s[1]))
+				return -1;
+			hi = strtol(s + 1, &end, 10);
+			s = end;
+		}
+		if (hi < lo || hi >= CPU_TOPOLOGY_MAX)
+			return -1;
+		for (long c = lo; c <= hi && n < max; ++c)
+			out[n++] = (int)c;
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return n;
+}
+
+static bool read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+	bool ok = fgets(buf, (int)len, f) != NULL;
+	fclose(f);
+	return ok;
+}
+
+static int read_int(const char *path, int fallback)
+{
+	char buf[32];
+	if (!read_line(path, buf, sizeof(buf)))
+		return fallback;
+	return atoi(buf);
+}
+
+/* Lowest CPU sharing @p cpu's L2 cache, or -1 if sysfs has no L2 entry. */
+static int read_l2(int cpu)
+{
+	char path[128];
+	char buf[256];
+	for (int idx = 0; idx < 8; ++idx) {
+		snprintf(path, sizeof(path),
+			 SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, idx);
+		int level = read_int(path, -1);
+		if (level < 0)
+			break;
+		if (level != 2)
+			continue;
+		snprintf(path, sizeof(path),
+			 SYSFS_CPU "/cpu%d/cache/index%d/type", cpu, idx);
+		if (read_line(path, buf, sizeof(buf)) &&
+		    strncmp(buf, "Instruction", 11) == 0)
+			continue;
+		snprintf(path, sizeof(path),
+			 SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu,
+			 idx);
+		int first;
+		if (read_line(path, buf, sizeof(buf)) &&
+		    parse_cpu_list(buf, &first, 1) == 1)
+			return first;
+	}
+	return -1;
+}
+
+int cpu_topology_read(cpu_info_t *out, int max)
+{
+#ifdef __linux__
+	char buf[512];
+	int online[CPU_TOPOLOGY_MAX];
+	if (!read_line(SYSFS_CPU "/online", buf, sizeof(buf)))
+		return 0;
+	int count = parse_cpu_list(buf, online, CPU_TOPOLOGY_MAX);
+	if (count <= 0)
+		return 0;
+	if (count > max)
+		count = max;
+	char path[128];
+	for (int i = 0; i < count; ++i) {
+		int cpu = online[i];
+		cpu_info_t *c = &out[i];
+		c->cpu = cpu;
+		snprintf(path, sizeof(path),
+			 SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+		c->package = read_int(path, 0);
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id",
+			 cpu);
+		c->core = (c->package << 16) | (read_int(path, cpu) & 0xffff);
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cpu_capacity",
+			 cpu);
+		c->capacity = read_int(path, 1024);
+		c->smt = 0;
+		snprintf(path, sizeof(path),
+			 SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+		int sib[CPU_TOPOLOGY_MAX];
+		int ns = 0;
+		if (read_line(path, buf, sizeof(buf)))
+			ns = parse_cpu_list(buf, sib, CPU_TOPOLOGY_MAX);
+		for (int s = 0; s < ns; ++s)
+			if (sib[s] == cpu)
+				c->smt = s;
+		c->l2 = read_l2(cpu);
+		if (c->l2 < 0) {
+			/* No cache info: treat the cluster as the L2 domain. */
+			snprintf(path, sizeof(path),
+				 SYSFS_CPU "/cpu%d/topology/cluster_id", cpu);
+			c->l2 = 0x10000 * (c->package + 1) +
+				read_int(path, c->core & 0xffff);
+		}
+	}
+	return count;
+#else
+	(void)out;
+	(void)max;
+	return 0;
+#endif
+}
+
+const cpu_info_t *cpu_topology_find(const cpu_info_t *cpus, int ncpus,
+				    int cpu)
+{
+	for (int i = 0; i < ncpus; ++i)
+		if (cpus[i].cpu == cpu)
+			return &cpus[i];
+	return NULL;
+}
+
+typedef struct {
+	int key[5];
+	int cpu;
+} placement_t;
+
+static int placement_cmp(const void *a, const void *b)
+{
+	const placement_t *pa = a;
+	const placement_t *pb = b;
+	for (int i = 0; i < 5; ++i)
+		if (pa->key[i] != pb->key[i])
+			return pa->key[i] < pb->key[i] ? -1 : 1;
+	return pa->cpu - pb->cpu;
+}
+
+bool cpu_affinity_plan(const char *spec, const cpu_info_t *cpus, int ncpus,
+		       int *plan, int nworkers)
+{
+	if (!spec || !*spec || strcmp(spec, "none") == 0 || nworkers <= 0)
+		return false;
+	if (isdigit((unsigned char)*spec)) {
+		int list[CPU_TOPOLOGY_MAX];
+		int n = parse_cpu_list(spec, list, CPU_TOPOLOGY_MAX);
+		if (n <= 0) {
+			LOG_WARN("Invalid CPU list '%s'", spec);
+			return false;
+		}
+		for (int i = 0; i < nworkers; ++i)
+			plan[i] = list[i % n];
+		return true;
+	}
+	bool compact = strcmp(spec, "compact") == 0;
+	bool scatter = strcmp(spec, "scatter") == 0;
+	bool physical = strcmp(spec, "physical") == 0;
+	if (!compact && !scatter && !physical) {
+		LOG_WARN("Unknown affinity policy '%s'", spec);
+		return false;
+	}
+	if (ncpus <= 0)
+		return false;
+	placement_t *order = malloc(sizeof(placement_t) * ncpus);
+	if (!order)
+		return false;
+	int n = 0;
+	for (int i = 0; i < ncpus; ++i) {
+		const cpu_info_t *c = &cpus[i];
+		if (physical && c->smt != 0)
+			continue;
+		placement_t *p = &order[n++];
+		p->cpu = c->cpu;
+		if (scatter) {
+			/* Rank of this core within its L2 domain, so the first
+			 * pass takes one core from every cluster. */
+			int rank = 0;
+			for (int j = 0; j < ncpus; ++j)
+				if (cpus[j].l2 == c->l2 && cpus[j].smt == 0 &&
+				    cpus[j].core < c->core)
+					rank++;
+			p->key[0] = c->smt;
+			p->key[1] = -c->capacity;
+			p->key[2] = rank;
+			p->key[3] = c->l2;
+			p->key[4] = c->package;
+		} else {
+			p->key[0] = -c->capacity;
+			p->key[1] = c->package;
+			p->key[2] = c->l2;
+			p->key[3] = c->core;
+			p->key[4] = c->smt;
+		}
+	}
+	if (n == 0) {
+		free(order);
+		return false;
+	}
+	qsort(order, n, sizeof(placement_t), placement_cmp);
+	for (int i = 0; i < nworkers; ++i)
+		plan[i] = order[i % n].cpu;
+	free(order);
+	return true;
+}
+
+bool cpu_pin_current_thread(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
+
+bool cpu_set_current_thread_priority(int nice)
+{
+#ifdef __linux__
+	/* Linux applies PRIO_PROCESS to a single thread when given its TID. */
+	return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) ==
+	       0;
+#else
+	(void)nice;
+	return false;
+#endif
+}
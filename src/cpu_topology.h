@@ -0,0 +1,58 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+/**
+ * @file cpu_topology.h
+ * @brief CPU topology discovery and worker placement policies.
+ *
+ * Topology is read from /sys/devices/system/cpu on Linux. Elsewhere no CPUs
+ * are reported and placement is left to the OS.
+ */
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CPU_TOPOLOGY_MAX 256
+
+typedef struct {
+	int cpu; /* logical CPU number */
+	int package; /* physical package id */
+	int core; /* physical core, unique across packages */
+	int l2; /* lowest CPU sharing this CPU's L2 cache */
+	int smt; /* index among the core's SMT siblings, 0 = first */
+	int capacity; /* relative performance, larger is faster */
+} cpu_info_t;
+
+/* Fill @p out with up to @p max online CPUs. Returns the number found, or 0
+ * when the topology cannot be read. */
+int cpu_topology_read(cpu_info_t *out, int max);
+
+/*
+ * Resolve an affinity spec into one CPU per worker, written to @p plan.
+ * @p spec is "compact" (fill SMT siblings and shared caches first),
+ * "scatter" (spread across cores and L2 clusters), "physical" (one SMT
+ * thread per core) or an explicit list such as "0-3,6". Faster cores are
+ * preferred by the policies. Workers wrap around when there are more
+ * workers than CPUs. Returns false for "none", an empty or invalid spec, or
+ * when no topology is available.
+ */
+bool cpu_affinity_plan(const char *spec, const cpu_info_t *cpus, int ncpus,
+		       int *plan, int nworkers);
+
+/* Look up @p cpu in @p cpus; returns NULL if it is not listed. */
+const cpu_info_t *cpu_topology_find(const cpu_info_t *cpus, int ncpus,
+				    int cpu);
+
+/* Restrict the calling thread to @p cpu. */
+bool cpu_pin_current_thread(int cpu);
+
+/* Set the calling thread's nice value (-20 highest to 19 lowest). Raising
+ * priority usually needs privileges. */
+bool cpu_set_current_thread_priority(int nice);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPU_TOPOLOGY_H */
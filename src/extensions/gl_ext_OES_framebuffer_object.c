@@ -475,6 +475,17 @@ GLboolean GL_APIENTRY glIsFramebufferOES(GLuint framebuffer)
 	return GL_FALSE;
 }
 
+/* Write the outgoing framebuffer's tiles back before rendering moves on
+ * to @p next. */
+static void resolve_on_switch(const FramebufferOES *next)
+{
+	const FramebufferOES *cur = gl_state.bound_framebuffer;
+	if (!cur || cur == next || !cur->fb)
+		return;
+	framebuffer_wait(cur->fb);
+	framebuffer_resolve(cur->fb);
+}
+
 /* Implementation of glBindFramebufferOES */
 GL_API void GL_APIENTRY glBindFramebufferOES(GLenum target, GLuint framebuffer)
 {
@@ -485,6 +496,7 @@ GL_API void GL_APIENTRY glBindFramebufferOES(GLenum target, GLuint framebuffer)
 	}
 
 	if (framebuffer == 0) {
+		resolve_on_switch(&gl_state.default_framebuffer);
 		gl_state.bound_framebuffer = &gl_state.default_framebuffer;
 		LOG_DEBUG(
 			"glBindFramebufferOES: Bound to default framebuffer.");
@@ -493,6 +505,7 @@ GL_API void GL_APIENTRY glBindFramebufferOES(GLenum target, GLuint framebuffer)
 
 	for (GLint i = 0; i < gl_state.framebuffer_count; ++i) {
 		if (gl_state.framebuffers[i]->id == framebuffer) {
+			resolve_on_switch(gl_state.framebuffers[i]);
 			gl_state.bound_framebuffer = gl_state.framebuffers[i];
 			LOG_DEBUG(
 				"glBindFramebufferOES: Bound framebuffer ID %u.",
@@ -3,6 +3,8 @@
 #include "gl_errors.h"
 #include "gl_utils.h"
 #include <GLES/gl.h>
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
 
 static BufferObject *find_buffer(GLuint id)
@@ -39,10 +41,7 @@ GL_API void GL_APIENTRY glBindBuffer(GLenum target, GLuint buffer)
 			glSetError(GL_OUT_OF_MEMORY);
 			return;
 		}
-		obj->id = buffer;
-		obj->size = 0;
-		obj->usage = GL_STATIC_DRAW;
-		obj->data = NULL;
+		*obj = (BufferObject){ .id = buffer, .usage = GL_STATIC_DRAW };
 		gl_state.buffers[gl_state.buffer_count++] = obj;
 	}
 }
@@ -66,10 +65,8 @@ GL_API void GL_APIENTRY glGenBuffers(GLsizei n, GLuint *buffers)
 			glSetError(GL_OUT_OF_MEMORY);
 			return;
 		}
-		obj->id = gl_state.next_buffer_id++;
-		obj->size = 0;
-		obj->usage = GL_STATIC_DRAW;
-		obj->data = NULL;
+		*obj = (BufferObject){ .id = gl_state.next_buffer_id++,
+				       .usage = GL_STATIC_DRAW };
 		gl_state.buffers[gl_state.buffer_count++] = obj;
 		buffers[i] = obj->id;
 	}
@@ -126,6 +123,7 @@ GL_API void GL_APIENTRY glBufferData(GLenum target, GLsizeiptr size,
 	obj->data = NULL;
 	obj->size = size;
 	obj->usage = usage;
+	obj->version++;
 	if (size > 0) {
 		obj->data = tracked_malloc(size);
 		if (!obj->data) {
@@ -155,8 +153,50 @@ GL_API void GL_APIENTRY glBufferSubData(GLenum target, GLintptr offset,
 		glSetError(GL_INVALID_VALUE);
 		return;
 	}
-	if (size > 0 && data)
+	if (size > 0 && data) {
 		memcpy((char *)obj->data + offset, data, size);
+		obj->version++;
+	}
+}
+
+GLboolean buffer_position_bounds(BufferObject *obj, size_t offset,
+				 GLsizei stride, GLint size, GLfloat min[3],
+				 GLfloat max[3])
+{
+	size_t bytes = (size_t)size * sizeof(GLfloat);
+	if (size < 2 || size > 3 || stride <= 0 || !obj->data ||
+	    offset + bytes > (size_t)obj->size)
+		return GL_FALSE;
+	if (obj->bounds_version != obj->version ||
+	    obj->bounds_offset != offset || obj->bounds_stride != stride ||
+	    obj->bounds_size != size) {
+		size_t count =
+			((size_t)obj->size - offset - bytes) / stride + 1;
+		GLfloat lo[3] = { INFINITY, INFINITY, 0.0f };
+		GLfloat hi[3] = { -INFINITY, -INFINITY, 0.0f };
+		if (size == 3) {
+			lo[2] = INFINITY;
+			hi[2] = -INFINITY;
+		}
+		const uint8_t *p = (const uint8_t *)obj->data + offset;
+		for (size_t i = 0; i < count; ++i, p += stride) {
+			GLfloat v[3];
+			memcpy(v, p, bytes);
+			for (GLint k = 0; k < size; ++k) {
+				lo[k] = fminf(lo[k], v[k]);
+				hi[k] = fmaxf(hi[k], v[k]);
+			}
+		}
+		memcpy(obj->bounds_min, lo, sizeof(lo));
+		memcpy(obj->bounds_max, hi, sizeof(hi));
+		obj->bounds_version = obj->version;
+		obj->bounds_offset = offset;
+		obj->bounds_stride = stride;
+		obj->bounds_size = size;
+	}
+	memcpy(min, obj->bounds_min, sizeof(obj->bounds_min));
+	memcpy(max, obj->bounds_max, sizeof(obj->bounds_max));
+	return GL_TRUE;
 }
 
 GL_API void GL_APIENTRY glGetBufferParameteriv(GLenum target, GLenum pname,
@@ -3,9 +3,11 @@
 #include "gl_memory_tracker.h"
 #include "gl_init.h"
 #include "gl_errors.h"
+#include "gl_logger.h"
 #include "command_buffer.h"
 #include "pool.h"
 #include "pipeline/gl_vertex.h"
+#include "pipeline/gl_primitive.h"
 #include "pipeline/gl_raster.h"
 #include "pipeline/gl_framebuffer.h"
 #include "matrix_utils.h"
@@ -61,8 +63,240 @@ static BufferObject *find_buffer(GLuint id)
 	return NULL;
 }
 
+/* Whether every position @p obj holds for the vertex array, from byte
+ * @p offset at @p stride, lies outside one frustum plane under the current
+ * MVP. The buffer's cached bounds stand in for the vertices, so a draw
+ * this rejects is dropped before any vertex is fetched. */
+static bool draw_outside_frustum(const RenderContext *ctx, BufferObject *obj,
+				 size_t offset, GLsizei stride)
+{
+	GLfloat lo[3], hi[3];
+	if (!buffer_position_bounds(obj, offset, stride, tl_vertex_array.size,
+				    lo, hi))
+		return false;
+	mat4 mvp;
+	mat4_multiply(&mvp, &ctx->projection_matrix, &ctx->modelview_matrix);
+	int32_t outside = CLIP_FRUSTUM_MASK;
+	for (int i = 0; i < 8 && outside; ++i) {
+		const GLfloat corner[4] = { i & 1 ? hi[0] : lo[0],
+					    i & 2 ? hi[1] : lo[1],
+					    i & 4 ? hi[2] : lo[2], 1.0f };
+		GLfloat c[4];
+		mat4_transform_vec4(&mvp, corner, c);
+		outside &= clip_outcode(c[0], c[1], c[2], c[3]);
+	}
+	return outside != 0;
+}
+
 /* Draw commands separated from gl_functions for clarity. */
 
+/* Client or buffer-object attribute pointers resolved for one draw. */
+typedef struct {
+	const uint8_t *vptr, *nptr, *cptr, *tptr;
+	GLsizei vstride, nstride, cstride, tstride;
+} attrib_src_t;
+
+/* Maps an element index to its slot in the batch being recorded: the stamp
+ * in the high bits marks entries written for this batch, the low bits hold
+ * the slot. Allocated per draw up to its largest index and reused by every
+ * batch of the draw. */
+#define SLOT_BITS 12
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+_Static_assert(3 * VERTEX_BATCH_MAX_PRIMITIVES <= SLOT_MASK + 1,
+	       "batch slots must fit in SLOT_BITS");
+typedef struct {
+	uint32_t *slot;
+	size_t size; /* largest index + 1 */
+	uint32_t stamp;
+} index_slots_t;
+static _Thread_local GLuint tl_batch_indices[3 * VERTEX_BATCH_MAX_PRIMITIVES];
+
+/* Copy the attributes of element @p idx into slot @p i of @p b. */
+static void gather_vertex(VertexBatch *b, uint32_t i, GLuint idx,
+			  const attrib_src_t *src, const RenderContext *ctx)
+{
+	const GLfloat *vp =
+		(const GLfloat *)(src->vptr + (size_t)idx * src->vstride);
+	b->x[i] = vp[0];
+	b->y[i] = tl_vertex_array.size > 1 ? vp[1] : 0.0f;
+	b->z[i] = tl_vertex_array.size > 2 ? vp[2] : 0.0f;
+	b->w[i] = tl_vertex_array.size > 3 ? vp[3] : 1.0f;
+	const GLfloat *np = ctx->current_normal;
+	if (tl_normal_array.enabled)
+		np = (const GLfloat *)(src->nptr +
+				       (size_t)idx * src->nstride);
+	b->nx[i] = np[0];
+	b->ny[i] = np[1];
+	b->nz[i] = np[2];
+	if (tl_color_array.enabled) {
+		const uint8_t *cp = src->cptr + (size_t)idx * src->cstride;
+		for (int k = 0; k < tl_color_array.size; ++k)
+			b->color[k][i] = tl_color_array.type == GL_FLOAT ?
+						 ((const GLfloat *)cp)[k] :
+						 cp[k] / 255.0f;
+		if (tl_color_array.size == 3)
+			b->color[3][i] = 1.0f;
+	} else {
+		for (int k = 0; k < 4; ++k)
+			b->color[k][i] = ctx->current_color[k];
+	}
+	if (tl_texcoord_array.enabled) {
+		const GLfloat *tp = (const GLfloat *)(src->tptr +
+						      (size_t)idx *
+							      src->tstride);
+		for (int k = 0; k < 4; ++k)
+			b->texcoord[k][i] = k < tl_texcoord_array.size ? tp[k] :
+					    k == 3			 ? 1.0f :
+									   0.0f;
+	} else {
+		for (int k = 0; k < 4; ++k)
+			b->texcoord[k][i] = ctx->current_texcoord[0][k];
+	}
+}
+
+/* Where a draw's elements come from: an index array, or consecutive
+ * vertices from @p first when both index pointers are NULL. */
+typedef struct {
+	const GLubyte *u8;
+	const GLushort *u16;
+	GLuint first;
+	size_t count;
+} element_src_t;
+
+/* Vertex index of element @p i. GL_LINE_LOOP reads element count, which
+ * wraps to element 0 to close the loop. */
+static GLuint element_index(const element_src_t *e, size_t i)
+{
+	if (i >= e->count)
+		i -= e->count;
+	if (e->u8)
+		return e->u8[i];
+	if (e->u16)
+		return e->u16[i];
+	return e->first + (GLuint)i;
+}
+
+/* Draw element read as element @p k of a batch whose first primitive is
+ * @p p0. A fan batch keeps the hub as its element 0. */
+static size_t batch_element(GLenum mode, uint32_t p0, uint32_t k)
+{
+	switch (mode) {
+	case GL_TRIANGLES:
+		return 3 * (size_t)p0 + k;
+	case GL_LINES:
+		return 2 * (size_t)p0 + k;
+	case GL_TRIANGLE_FAN:
+		return k ? (size_t)p0 + k : 0;
+	default:
+		return (size_t)p0 + k;
+	}
+}
+
+/*
+ * Record @p nprims primitives of @p mode starting at primitive @p p0 as one
+ * vertex batch. Each distinct index is gathered once and the batch's
+ * element list refers to it by slot, so it is transformed and lit only
+ * once however many primitives share it.
+ */
+static void record_vertex_batch(const RenderContext *ctx, Framebuffer *fb,
+				RasterBins *bins, const attrib_src_t *src,
+				const element_src_t *e, index_slots_t *slots,
+				GLenum mode, uint32_t p0, uint32_t nprims)
+{
+	uint32_t nelems = primitive_elements(mode, nprims);
+	uint32_t nverts = 0;
+	if (slots) {
+		uint32_t stamp = ++slots->stamp << SLOT_BITS;
+		if (!stamp) {
+			memset(slots->slot, 0, slots->size * sizeof(uint32_t));
+			slots->stamp = 1;
+			stamp = 1u << SLOT_BITS;
+		}
+		for (uint32_t k = 0; k < nelems; ++k) {
+			GLuint idx = element_index(
+				e, batch_element(mode, p0, k));
+			if ((slots->slot[idx] & ~SLOT_MASK) != stamp) {
+				slots->slot[idx] = stamp | nverts;
+				tl_batch_indices[nverts++] = idx;
+			}
+		}
+	} else {
+		/* Consecutive vertices never repeat within a batch. */
+		for (uint32_t k = 0; k < nelems; ++k)
+			tl_batch_indices[nverts++] =
+				element_index(e, batch_element(mode, p0, k));
+	}
+	VertexBatch *b = vertex_batch_create(nverts, mode, nprims);
+	if (!b) {
+		LOG_ERROR("Dropped %u primitives: out of memory", nprims);
+		return;
+	}
+	for (uint32_t v = 0; v < nverts; ++v)
+		gather_vertex(b, v, tl_batch_indices[v], src, ctx);
+	for (uint32_t k = 0; k < nelems; ++k) {
+		GLuint slot = k;
+		if (slots)
+			slot = slots->slot[element_index(
+				       e, batch_element(mode, p0, k))] &
+			       SLOT_MASK;
+		b->elems[k] = (uint16_t)slot;
+	}
+	memcpy(b->viewport, gl_state.viewport, sizeof(b->viewport));
+	b->position_size = (uint8_t)tl_vertex_array.size;
+	b->cull = cull_windings(ctx->cull_face_enabled, ctx->cull_face_mode,
+				ctx->front_face);
+	b->fb = fb;
+	framebuffer_retain(fb);
+	b->bins = bins;
+	raster_bins_retain(bins);
+	command_buffer_record_task_group(process_vertex_batch_job, b,
+					 STAGE_VERTEX, fb->tasks);
+}
+
+/* Split the triangles or lines of a draw into vertex batches. Strips and
+ * fans carry N + 2 elements for N triangles; a line loop is recorded as a
+ * strip that reads one element past the end. The batches of a triangle
+ * draw share one set of tile bins. */
+static void record_draw(const RenderContext *ctx, Framebuffer *fb,
+			const attrib_src_t *src, const element_src_t *e,
+			GLenum mode)
+{
+	uint32_t nprims = primitive_count(mode, (uint32_t)e->count);
+	if (!nprims)
+		return;
+	index_slots_t slots = { 0 };
+	if (e->u8 || e->u16) {
+		for (size_t i = 0; i < e->count; ++i) {
+			GLuint idx = element_index(e, i);
+			if (idx >= slots.size)
+				slots.size = (size_t)idx + 1;
+		}
+		slots.slot = MT_CALLOC(slots.size, sizeof(uint32_t),
+				       STAGE_VERTEX);
+		if (!slots.slot) {
+			LOG_ERROR("Dropped %u primitives: out of memory",
+				  nprims);
+			return;
+		}
+	}
+	if (mode == GL_LINE_LOOP)
+		mode = GL_LINE_STRIP;
+	RasterBins *bins = NULL;
+	if (!primitive_is_line(mode))
+		bins = raster_bins_create(fb);
+	for (uint32_t p = 0; p < nprims; p += VERTEX_BATCH_MAX_PRIMITIVES) {
+		uint32_t n = nprims - p;
+		if (n > VERTEX_BATCH_MAX_PRIMITIVES)
+			n = VERTEX_BATCH_MAX_PRIMITIVES;
+		record_vertex_batch(ctx, fb, bins, src, e,
+				    slots.slot ? &slots : NULL, mode, p, n);
+	}
+	raster_bins_release(bins);
+	if (slots.slot)
+		MT_FREE(slots.slot, STAGE_VERTEX);
+}
+
+
 GL_API void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
 {
 	PROFILE_START("glDrawArrays");
@@ -116,6 +350,7 @@ GL_API void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
 		PROFILE_END("glDrawArrays");
 		return;
 	}
+	raster_hiz_note_draw(fb);
 
 	GLsizei vstride =
 		tl_vertex_array.stride ?
@@ -146,6 +381,10 @@ GL_API void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
 			glSetError(GL_INVALID_OPERATION);
 			return;
 		}
+		if (draw_outside_frustum(ctx, obj, (size_t)vptr, vstride)) {
+			PROFILE_END("glDrawArrays");
+			return;
+		}
 		vptr = (const uint8_t *)obj->data + (size_t)vptr;
 		nptr = (const uint8_t *)obj->data + (size_t)nptr;
 		cptr = (const uint8_t *)obj->data + (size_t)cptr;
@@ -156,6 +395,8 @@ GL_API void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
 		mat4 mvp;
 		mat4_multiply(&mvp, &ctx->projection_matrix,
 			      &ctx->modelview_matrix);
+		const mat4_class cls = mat4_class_product(
+			ctx->projection_class, ctx->modelview_class);
 		for (GLint i = 0; i < count; ++i) {
 			GLint idx = first + i;
 			const GLfloat *vp =
@@ -183,84 +424,22 @@ GL_API void GL_APIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
 					src.point_size = *(const GLfloat *)pptr;
 			}
 			Vertex dst;
-			pipeline_transform_vertex(&dst, &src, &mvp, NULL,
-						  gl_state.viewport);
+			pipeline_transform_vertex(&dst, &src, &mvp, cls, NULL,
+						  gl_state.viewport, NULL);
 			pipeline_rasterize_point(&dst, src.point_size,
 						 gl_state.viewport, fb);
 		}
 		return;
 	}
 
-	for (GLint i = 0; i + 2 < count; i += 3) {
-		VertexJob *job = vertex_job_acquire();
-		if (!job)
-			return;
-		memcpy(job->viewport, gl_state.viewport, sizeof(job->viewport));
-		for (int j = 0; j < 3; ++j) {
-			GLint idx = first + i + j;
-			const GLfloat *vp =
-				(const GLfloat *)(vptr + (size_t)idx * vstride);
-			Vertex *dst = &job->in[j];
-			dst->x = vp[0];
-			dst->y = tl_vertex_array.size > 1 ? vp[1] : 0.0f;
-			dst->z = tl_vertex_array.size > 2 ? vp[2] : 0.0f;
-			dst->w = tl_vertex_array.size > 3 ? vp[3] : 1.0f;
-			if (tl_normal_array.enabled) {
-				const GLfloat *np =
-					(const GLfloat *)(nptr +
-							  (size_t)idx *
-								  nstride);
-				dst->normal[0] = np[0];
-				dst->normal[1] = np[1];
-				dst->normal[2] = np[2];
-			} else {
-				dst->normal[0] = ctx->current_normal[0];
-				dst->normal[1] = ctx->current_normal[1];
-				dst->normal[2] = ctx->current_normal[2];
-			}
-			if (tl_color_array.enabled) {
-				if (tl_color_array.type == GL_FLOAT) {
-					const GLfloat *cp =
-						(const GLfloat
-							 *)(cptr +
-							    (size_t)idx *
-								    cstride);
-					for (int k = 0; k < tl_color_array.size;
-					     ++k)
-						dst->color[k] = cp[k];
-				} else {
-					const GLubyte *cp =
-						cptr + (size_t)idx * cstride;
-					for (int k = 0; k < tl_color_array.size;
-					     ++k)
-						dst->color[k] = cp[k] / 255.0f;
-				}
-				if (tl_color_array.size == 3)
-					dst->color[3] = 1.0f;
-			} else {
-				for (int k = 0; k < 4; ++k)
-					dst->color[k] = ctx->current_color[k];
-			}
-			if (tl_texcoord_array.enabled) {
-				const GLfloat *tp =
-					(const GLfloat *)(tptr +
-							  (size_t)idx *
-								  tstride);
-				for (int k = 0; k < tl_texcoord_array.size; ++k)
-					dst->texcoord[k] = tp[k];
-				for (int k = tl_texcoord_array.size; k < 4; ++k)
-					dst->texcoord[k] = k == 3 ? 1.0f : 0.0f;
-			} else {
-				for (int k = 0; k < 4; ++k)
-					dst->texcoord[k] =
-						ctx->current_texcoord[0][k];
-			}
-		}
-		job->fb = fb;
-		framebuffer_retain(job->fb);
-		command_buffer_record_task(process_vertex_job, job,
-					   STAGE_VERTEX);
-	}
+	/* Every other mode goes through vertex batches, so vertices are
+	 * transformed once per batch in SoA form. */
+	const attrib_src_t src = { vptr,    nptr,    cptr,    tptr,
+				   vstride, nstride, cstride, tstride };
+	const element_src_t elems = { NULL, NULL, (GLuint)first,
+				      (size_t)count };
+	record_draw(ctx, fb, &src, &elems, mode);
+	PROFILE_END("glDrawArrays");
 }
 
 GL_API void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
@@ -385,6 +564,11 @@ GL_API void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
 			PROFILE_END("glDrawElements");
 			return;
 		}
+		if (draw_outside_frustum(ctx, array_obj, (size_t)vptr,
+					 vstride)) {
+			PROFILE_END("glDrawElements");
+			return;
+		}
 
 		vptr = (const uint8_t *)array_obj->data + (size_t)vptr;
 		nptr = (const uint8_t *)array_obj->data + (size_t)nptr;
@@ -401,11 +585,14 @@ GL_API void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
 		PROFILE_END("glDrawElements");
 		return;
 	}
+	raster_hiz_note_draw(fb);
 
 	if (mode == GL_POINTS) {
 		mat4 mvp;
 		mat4_multiply(&mvp, &ctx->projection_matrix,
 			      &ctx->modelview_matrix);
+		const mat4_class cls = mat4_class_product(
+			ctx->projection_class, ctx->modelview_class);
 		for (GLint i = 0; i < count; ++i) {
 			GLuint idx = type == GL_UNSIGNED_BYTE ?
 					     (GLuint)u8_indices[i] :
@@ -435,8 +622,8 @@ GL_API void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
 					src.point_size = *(const GLfloat *)pptr;
 			}
 			Vertex dst;
-			pipeline_transform_vertex(&dst, &src, &mvp, NULL,
-						  gl_state.viewport);
+			pipeline_transform_vertex(&dst, &src, &mvp, cls, NULL,
+						  gl_state.viewport, NULL);
 			pipeline_rasterize_point(&dst, src.point_size,
 						 gl_state.viewport, fb);
 		}
@@ -444,79 +631,10 @@ GL_API void GL_APIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type,
 		return;
 	}
 
-	for (GLsizei i = 0; i + 2 < count; i += 3) {
-		VertexJob *job = vertex_job_acquire();
-		if (!job) {
-			PROFILE_END("glDrawElements");
-			return;
-		}
-		memcpy(job->viewport, gl_state.viewport, sizeof(job->viewport));
-		for (int j = 0; j < 3; ++j) {
-			GLuint idx = type == GL_UNSIGNED_BYTE ?
-					     (GLuint)u8_indices[i + j] :
-					     (GLuint)u16_indices[i + j];
-			const GLfloat *vp =
-				(const GLfloat *)(vptr + (size_t)idx * vstride);
-			Vertex *dst = &job->in[j];
-			dst->x = vp[0];
-			dst->y = tl_vertex_array.size > 1 ? vp[1] : 0.0f;
-			dst->z = tl_vertex_array.size > 2 ? vp[2] : 0.0f;
-			dst->w = tl_vertex_array.size > 3 ? vp[3] : 1.0f;
-			if (tl_normal_array.enabled) {
-				const GLfloat *np =
-					(const GLfloat *)(nptr +
-							  (size_t)idx *
-								  nstride);
-				dst->normal[0] = np[0];
-				dst->normal[1] = np[1];
-				dst->normal[2] = np[2];
-			} else {
-				dst->normal[0] = ctx->current_normal[0];
-				dst->normal[1] = ctx->current_normal[1];
-				dst->normal[2] = ctx->current_normal[2];
-			}
-			if (tl_color_array.enabled) {
-				if (tl_color_array.type == GL_FLOAT) {
-					const GLfloat *cp =
-						(const GLfloat
-							 *)(cptr +
-							    (size_t)idx *
-								    cstride);
-					for (int k = 0; k < tl_color_array.size;
-					     ++k)
-						dst->color[k] = cp[k];
-				} else {
-					const GLubyte *cp =
-						cptr + (size_t)idx * cstride;
-					for (int k = 0; k < tl_color_array.size;
-					     ++k)
-						dst->color[k] = cp[k] / 255.0f;
-				}
-				if (tl_color_array.size == 3)
-					dst->color[3] = 1.0f;
-			} else {
-				for (int k = 0; k < 4; ++k)
-					dst->color[k] = ctx->current_color[k];
-			}
-			if (tl_texcoord_array.enabled) {
-				const GLfloat *tp =
-					(const GLfloat *)(tptr +
-							  (size_t)idx *
-								  tstride);
-				for (int k = 0; k < tl_texcoord_array.size; ++k)
-					dst->texcoord[k] = tp[k];
-				for (int k = tl_texcoord_array.size; k < 4; ++k)
-					dst->texcoord[k] = k == 3 ? 1.0f : 0.0f;
-			} else {
-				for (int k = 0; k < 4; ++k)
-					dst->texcoord[k] =
-						ctx->current_texcoord[0][k];
-			}
-		}
-		job->fb = fb;
-		framebuffer_retain(job->fb);
-		command_buffer_record_task(process_vertex_job, job,
-					   STAGE_VERTEX);
-	}
+	const attrib_src_t src = { vptr,    nptr,    cptr,   tptr,
+				   vstride, nstride, cstride, tstride };
+	const element_src_t elems = { u8_indices, u16_indices, 0,
+				      (size_t)count };
+	record_draw(ctx, fb, &src, &elems, mode);
 	PROFILE_END("glDrawElements");
 }
@@ -26,14 +26,18 @@ static mat4 *current_matrix_ptr(void)
 	}
 }
 
-static void sync_current_matrix(void)
+/* Publish the current matrix, whose mat4_classify() result is @p cls or
+ * a more general class, to the render context. */
+static void sync_current_matrix(mat4_class cls)
 {
 	switch (gl_state.matrix_mode) {
 	case GL_MODELVIEW:
-		context_update_modelview_matrix(&gl_state.modelview_matrix);
+		context_update_modelview_matrix(&gl_state.modelview_matrix,
+						cls);
 		break;
 	case GL_PROJECTION:
-		context_update_projection_matrix(&gl_state.projection_matrix);
+		context_update_projection_matrix(&gl_state.projection_matrix,
+						 cls);
 		break;
 	case GL_TEXTURE:
 		context_update_texture_matrix(&gl_state.texture_matrix);
@@ -43,6 +47,28 @@ static void sync_current_matrix(void)
 	}
 }
 
+static mat4_class current_class(void)
+{
+	const RenderContext *ctx = context_get();
+	switch (gl_state.matrix_mode) {
+	case GL_MODELVIEW:
+		return ctx->modelview_class;
+	case GL_PROJECTION:
+		return ctx->projection_class;
+	default:
+		return MAT4_PERSPECTIVE;
+	}
+}
+
+/* Post-multiply the current matrix by @p m of class @p cls. */
+static void multiply_current(const mat4 *m, mat4_class cls)
+{
+	mat4 result;
+	mat4_multiply(&result, current_matrix_ptr(), m);
+	mat4_copy(current_matrix_ptr(), &result);
+	sync_current_matrix(mat4_class_product(current_class(), cls));
+}
+
 static mat4 *stack_for_mode(GLenum mode, GLint **depth_out, GLint *max_depth)
 {
 	switch (mode) {
@@ -141,7 +167,7 @@ GL_API void GL_APIENTRY glPopMatrix(void)
 		break;
 	}
 	mat4_copy(current_matrix_ptr(), &stack[*depth - 1]);
-	sync_current_matrix();
+	sync_current_matrix(mat4_classify(current_matrix_ptr()));
 	PROFILE_END("glPopMatrix");
 }
 
@@ -161,7 +187,7 @@ GL_API void GL_APIENTRY glLoadIdentity(void)
 	default:
 		break;
 	}
-	sync_current_matrix();
+	sync_current_matrix(MAT4_IDENTITY);
 	PROFILE_END("glLoadIdentity");
 }
 
@@ -175,7 +201,7 @@ GL_API void GL_APIENTRY glLoadMatrixf(const GLfloat *m)
 	mat4 mat;
 	memcpy(mat.data, m, sizeof(GLfloat) * 16);
 	mat4_copy(current_matrix_ptr(), &mat);
-	sync_current_matrix();
+	sync_current_matrix(mat4_classify(&mat));
 	PROFILE_END("glLoadMatrixf");
 }
 
@@ -197,11 +223,9 @@ GL_API void GL_APIENTRY glMultMatrixf(const GLfloat *m)
 		PROFILE_END("glMultMatrixf");
 		return;
 	}
-	mat4 mat, result;
+	mat4 mat;
 	memcpy(mat.data, m, sizeof(GLfloat) * 16);
-	mat4_multiply(&result, current_matrix_ptr(), &mat);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&mat, mat4_classify(&mat));
 	PROFILE_END("glMultMatrixf");
 }
 
@@ -219,12 +243,10 @@ GL_API void GL_APIENTRY glMultMatrixx(const GLfixed *m)
 GL_API void GL_APIENTRY glTranslatef(GLfloat x, GLfloat y, GLfloat z)
 {
 	PROFILE_START("glTranslatef");
-	mat4 trans, result;
+	mat4 trans;
 	mat4_identity(&trans);
 	mat4_translate(&trans, x, y, z);
-	mat4_multiply(&result, current_matrix_ptr(), &trans);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&trans, MAT4_TRANSLATE);
 	PROFILE_END("glTranslatef");
 }
 
@@ -232,24 +254,20 @@ GL_API void GL_APIENTRY glRotatef(GLfloat angle, GLfloat x, GLfloat y,
 				  GLfloat z)
 {
 	PROFILE_START("glRotatef");
-	mat4 rot, result;
+	mat4 rot;
 	mat4_identity(&rot);
 	mat4_rotate_axis(&rot, angle, x, y, z);
-	mat4_multiply(&result, current_matrix_ptr(), &rot);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&rot, MAT4_AFFINE);
 	PROFILE_END("glRotatef");
 }
 
 GL_API void GL_APIENTRY glScalef(GLfloat x, GLfloat y, GLfloat z)
 {
 	PROFILE_START("glScalef");
-	mat4 scale, result;
+	mat4 scale;
 	mat4_identity(&scale);
 	mat4_scale(&scale, x, y, z);
-	mat4_multiply(&result, current_matrix_ptr(), &scale);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&scale, MAT4_ORTHO);
 	PROFILE_END("glScalef");
 }
 
@@ -260,11 +278,9 @@ GL_API void GL_APIENTRY glFrustumf(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
 		glSetError(GL_INVALID_VALUE);
 		return;
 	}
-	mat4 frust, result;
+	mat4 frust;
 	mat4_frustum(&frust, l, r, b, t, n, f);
-	mat4_multiply(&result, current_matrix_ptr(), &frust);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&frust, MAT4_PERSPECTIVE);
 }
 
 GL_API void GL_APIENTRY glOrthof(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
@@ -274,9 +290,7 @@ GL_API void GL_APIENTRY glOrthof(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
 		glSetError(GL_INVALID_VALUE);
 		return;
 	}
-	mat4 ortho, result;
+	mat4 ortho;
 	mat4_orthographic(&ortho, l, r, b, t, n, f);
-	mat4_multiply(&result, current_matrix_ptr(), &ortho);
-	mat4_copy(current_matrix_ptr(), &result);
-	sync_current_matrix();
+	multiply_current(&ortho, MAT4_ORTHO);
 }
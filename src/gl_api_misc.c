@@ -4,8 +4,10 @@
 #include <GLES/gl.h>
 #include <string.h>
 #include "gl_utils.h"
+#include "gl_init.h"
 #include "gl_thread.h"
 #include "command_buffer.h"
+#include "pipeline/gl_framebuffer.h"
 #include "extensions/gl_ext_common.h"
 
 GL_API void GL_APIENTRY glClipPlanef(GLenum plane, const GLfloat *equation)
@@ -447,8 +449,21 @@ GL_API void GL_APIENTRY glTranslatex(GLfixed x, GLfixed y, GLfixed z)
 
 GL_API void GL_APIENTRY glFinish(void)
 {
+	Framebuffer *fb = NULL;
+	if (gl_state.bound_framebuffer)
+		fb = gl_state.bound_framebuffer->fb;
 	command_buffer_flush();
-	thread_pool_wait_timeout(1000);
+	/* Only work targeting the current framebuffer needs to retire; other
+	 * framebuffers are waited on when they are read or destroyed. */
+	if (fb) {
+		framebuffer_wait(fb);
+		return;
+	}
+	if (GetCurrentContext()->thread_pool)
+		thread_pool_drain(GetCurrentContext()->thread_pool);
+	else
+		thread_pool_wait();
+	framebuffer_wait(GL_get_default_framebuffer());
 }
 
 GL_API void GL_APIENTRY glFlush(void)
@@ -18,6 +18,8 @@ GL_API void GL_APIENTRY glClear(GLbitfield mask)
 		PROFILE_END("glClear");
 		return;
 	}
+	if (mask & GL_COLOR_BUFFER_BIT)
+		thread_trace_next_frame();
 	Framebuffer *fb = NULL;
 	if (gl_state.bound_framebuffer)
 		fb = gl_state.bound_framebuffer->fb;
@@ -27,8 +29,13 @@ GL_API void GL_APIENTRY glClear(GLbitfield mask)
 			((uint32_t)(gl_state.clear_color[0] * 255.0f) << 16) |
 			((uint32_t)(gl_state.clear_color[1] * 255.0f) << 8) |
 			((uint32_t)(gl_state.clear_color[2] * 255.0f));
-		framebuffer_clear_async(fb, color, gl_state.clear_depth,
-					(uint8_t)gl_state.clear_stencil);
+		/* Recording the clear values is cheap, but it has to land
+		 * between the draws before and after it: later draws reject
+		 * triangles against the tiles' depth bounds as they bin, and
+		 * a clear still queued would leave them the old bounds. */
+		framebuffer_wait(fb);
+		framebuffer_clear(fb, color, gl_state.clear_depth,
+				  (uint8_t)gl_state.clear_stencil);
 	}
 	PROFILE_END("glClear");
 }
@@ -54,6 +61,8 @@ GL_API void GL_APIENTRY glReadPixels(GLint x, GLint y, GLsizei width,
 		memset(pixels, 0, (size_t)width * height * 4);
 		return;
 	}
+	framebuffer_wait(fb);
+	framebuffer_resolve(fb);
 	for (GLsizei j = 0; j < height; ++j) {
 		for (GLsizei i = 0; i < width; ++i) {
 			uint32_t c = framebuffer_get_pixel(
@@ -14,6 +14,8 @@ static void init_defaults(RenderContext *ctx)
 	mat4_identity(&ctx->modelview_matrix);
 	mat4_identity(&ctx->projection_matrix);
 	mat4_identity(&ctx->texture_matrix);
+	ctx->modelview_class = MAT4_IDENTITY;
+	ctx->projection_class = MAT4_IDENTITY;
 	ctx->modelview_stack_depth = 1;
 	ctx->projection_stack_depth = 1;
 	ctx->texture_stack_depth = 1;
@@ -222,17 +224,24 @@ RenderContext *GetCurrentContext(void)
 	return g_current_context;
 }
 
-void context_update_modelview_matrix(const mat4 *mat)
+void context_set_thread_pool(ThreadPool *pool)
+{
+	g_current_context->thread_pool = pool;
+}
+
+void context_update_modelview_matrix(const mat4 *mat, mat4_class cls)
 {
 	mat4_copy(&g_render_context.modelview_matrix, mat);
+	g_render_context.modelview_class = cls;
 	atomic_fetch_add_explicit(&g_render_context.version_modelview, 1,
 				  memory_order_relaxed);
 	log_state_change("modelview updated");
 }
 
-void context_update_projection_matrix(const mat4 *mat)
+void context_update_projection_matrix(const mat4 *mat, mat4_class cls)
 {
 	mat4_copy(&g_render_context.projection_matrix, mat);
+	g_render_context.projection_class = cls;
 	atomic_fetch_add_explicit(&g_render_context.version_projection, 1,
 				  memory_order_relaxed);
 	log_state_change("projection updated");
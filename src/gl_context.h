@@ -10,6 +10,7 @@
 #include <stdatomic.h>
 #include "portable/c11threads.h"
 #include "gl_types.h"
+#include "gl_thread.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -80,6 +81,10 @@ typedef struct {
 	mat4 modelview_matrix;
 	mat4 projection_matrix;
 	mat4 texture_matrix;
+	/* mat4_classify() of the two matrices above, kept by the matrix
+	 * entry points so the vertex stage can pick cheaper kernels. */
+	mat4_class modelview_class;
+	mat4_class projection_class;
 	GLint modelview_stack_depth;
 	GLint projection_stack_depth;
 	GLint texture_stack_depth;
@@ -164,14 +169,19 @@ typedef struct {
 	unsigned validated_depth_version;
 	unsigned validated_fog_version;
 	unsigned validated_cull_version;
+
+	/* Pool for framebuffers created while this context is current; NULL
+	 * selects the default pool. */
+	ThreadPool *thread_pool;
 } RenderContext;
 
 void context_init(void);
 void context_cleanup(void);
 RenderContext *context_get(void);
 RenderContext *GetCurrentContext(void);
-void context_update_modelview_matrix(const mat4 *mat);
-void context_update_projection_matrix(const mat4 *mat);
+void context_set_thread_pool(ThreadPool *pool);
+void context_update_modelview_matrix(const mat4 *mat, mat4_class cls);
+void context_update_projection_matrix(const mat4 *mat, mat4_class cls);
 void context_update_texture_matrix(const mat4 *mat);
 void context_set_clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
 void context_set_texture_env(GLenum unit, GLenum pname, const GLfloat *params);
@@ -39,6 +39,16 @@ typedef struct BufferObject {
 	GLsizeiptr size;
 	GLenum usage;
 	void *data;
+	unsigned version; /* bumped by glBufferData and glBufferSubData */
+	/* Position bounds from buffer_position_bounds(), current while
+	 * bounds_version equals version (0: never computed) and the draw
+	 * reads positions with the same layout. */
+	unsigned bounds_version;
+	size_t bounds_offset;
+	GLsizei bounds_stride;
+	GLint bounds_size;
+	GLfloat bounds_min[3];
+	GLfloat bounds_max[3];
 } BufferObject;
 
 typedef struct VertexArrayObject {
@@ -257,6 +267,12 @@ extern GLState gl_state;
 /* Function prototypes */
 void InitGLState(GLState *state);
 void CleanupGLState(GLState *state);
+/* Axis-aligned bounds of every @p size component float position in @p obj
+ * from byte @p offset on, @p stride bytes apart, cached until the buffer
+ * changes. Returns GL_FALSE when the positions carry w or do not fit. */
+GLboolean buffer_position_bounds(BufferObject *obj, size_t offset,
+				 GLsizei stride, GLint size, GLfloat min[3],
+				 GLfloat max[3]);
 
 #ifdef __cplusplus
 }
@@ -2,9 +2,12 @@
 #include "gl_logger.h"
 #include "pool.h"
 #include "function_profile.h"
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -14,6 +17,7 @@
 #include <unistd.h>
 #endif
 #include "texture_cache.h"
+#include "cpu_topology.h"
 
 #ifdef THREAD_POOL_WAIT_DEBUG
 #ifndef THREAD_POOL_WAIT_DEBUG_MS
@@ -21,15 +25,20 @@
 #endif
 #endif
 
-#define MAX_TASKS 256
+/* Initial capacity of each worker deque; rings double when full. */
 #define LOCAL_QUEUE_SIZE 128
-
-typedef struct {
-	task_function_t function;
-	void *task_data;
-	uint64_t token;
-	stage_tag_t stage;
-} task_t;
+/* Capacity of each lane's injection queue fed by non-worker threads. Must
+ * be a power of two. */
+#define INJECT_QUEUE_SIZE 2048
+/* Extra tls_tid slots for non-worker threads that run tasks while waiting.
+ * They follow the worker slots in pool->texture_caches. */
+#define HELPER_SLOTS 4
+/* Idle workers spin for at most this long by default before yielding. */
+#define SPIN_MAX_US 50
+/* Yields between the spin phase and parking on pool->wakeup. */
+#define IDLE_YIELDS 16
+/* Trace events kept per thread slot; a full ring overwrites its oldest. */
+#define TRACE_RING_EVENTS 32768
 
 typedef struct {
 	uint64_t task_count;
@@ -46,32 +55,194 @@ typedef struct {
 	uint64_t max_task_cycles;
 } stage_profile_t;
 
+/* How idle periods ended. Latencies are in nanoseconds. */
+typedef struct {
+	uint64_t spin_wakes;
+	uint64_t yield_wakes;
+	uint64_t parks;
+	uint64_t wakeups;
+	uint64_t wake_latency_ns;
+	uint64_t max_wake_latency_ns;
+} idle_profile_t;
+
 typedef struct {
 	stage_profile_t stages[STAGE_COUNT];
+	idle_profile_t idle;
 } thread_profile_t;
 
+/* Live counters for microgles_metrics_snapshot(), one cache line per slot.
+ * Only the thread owning the slot writes them, so a relaxed load and store
+ * is enough and readers never see a count go backwards. */
+typedef struct {
+	_Alignas(64) atomic_uint_fast64_t tasks[STAGE_COUNT];
+	atomic_uint_fast64_t steals;
+	atomic_uint_fast64_t parks;
+} slot_metrics_t;
+
+/* One task run, as exported by the Chrome trace writer. */
+typedef struct {
+	uint64_t begin_ns;
+	uint64_t end_ns;
+	task_function_t function;
+	void *task_data;
+	uint32_t frame;
+	uint8_t stage;
+	bool stolen;
+} trace_event_t;
+
+/* Only the thread owning the slot writes its ring; events are allocated on
+ * the first record so unused helper slots cost nothing. */
+typedef struct {
+	trace_event_t *events;
+	uint64_t count; /* events ever recorded */
+} trace_ring_t;
+
+/* Slots keep each task field in its own atomic so a thief reading an entry
+ * the owner is about to recycle is a benign race; the CAS on top decides
+ * whether the value read is used. */
 typedef struct {
-	task_t entries[LOCAL_QUEUE_SIZE];
-	_Alignas(64) atomic_uint_fast64_t head;
-	_Alignas(64) atomic_uint_fast64_t tail;
+	_Atomic(task_function_t) function;
+	_Atomic(void *) task_data;
+	atomic_int stage;
+	_Atomic(task_group_t *) group;
+} task_slot_t;
+
+struct task_group {
+	_Alignas(64) atomic_uint_fast64_t pending;
+	atomic_int refs;
+	atomic_int waiters;
+	ThreadPool *pool; /* NULL: the default pool */
+	mtx_t lock;
+	cnd_t done;
+};
+
+typedef struct deque_ring {
+	int64_t mask;
+	struct deque_ring *retired; /* previous ring, freed at shutdown */
+	task_slot_t slots[];
+} deque_ring_t;
+
+/*
+ * Priority lanes. Downstream stages get lower lane numbers and are always
+ * looked for first, so tile jobs drain before more geometry is expanded.
+ */
+enum {
+	LANE_FRAGMENT, /* fragment tiles and framebuffer clears */
+	LANE_RASTER,
+	LANE_PRIMITIVE,
+	LANE_VERTEX,
+	LANE_COUNT
+};
+
+static const int g_stage_lane[STAGE_COUNT] = {
+	[STAGE_VERTEX] = LANE_VERTEX,	    [STAGE_PRIMITIVE] = LANE_PRIMITIVE,
+	[STAGE_RASTER] = LANE_RASTER,	    [STAGE_FRAGMENT] = LANE_FRAGMENT,
+	[STAGE_FRAMEBUFFER] = LANE_FRAGMENT, [STAGE_STEAL] = LANE_VERTEX,
+};
+
+static const char *lane_names[LANE_COUNT] = { "fragment", "raster",
+					      "primitive", "vertex" };
+
+/* High-water marks in queued tasks, 0 for unlimited. Tile and raster jobs
+ * come from pools of 512, so producers start helping before they run dry. */
+static atomic_uint g_lane_hwm[LANE_COUNT] = { 256, 256, 512, 1024 };
+
+/* Chase-Lev work-stealing deque. The owning worker pushes and takes at
+ * bottom; other workers steal from top. */
+typedef struct {
+	_Alignas(64) atomic_int_fast64_t top;
+	_Alignas(64) atomic_int_fast64_t bottom;
+	_Atomic(deque_ring_t *) ring;
+} task_deque_t;
+
+typedef struct {
+	task_deque_t lanes[LANE_COUNT];
 	thread_profile_t profile_data;
 } task_queue_t;
 
-static task_queue_t *g_local_queues;
-static task_t g_global_queue[MAX_TASKS];
-static _Alignas(64) atomic_uint_fast64_t g_global_head;
-static _Alignas(64) atomic_uint_fast64_t g_global_tail;
-static thrd_t *g_worker_threads;
-static int g_num_threads;
-static _Thread_local int tls_tid = -1;
-static atomic_bool g_shutdown_flag = false;
+/* Bounded MPMC queue cell (Vyukov). seq tells producers and consumers which
+ * lap the cell belongs to. */
+typedef struct {
+	atomic_size_t seq;
+	task_slot_t slot;
+} inject_cell_t;
+
+typedef struct {
+	inject_cell_t cells[INJECT_QUEUE_SIZE];
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+} inject_queue_t;
+
+/* Queued (not yet started) tasks per lane, padded to avoid false sharing. */
+typedef struct {
+	_Alignas(64) atomic_uint_fast64_t queued;
+} lane_state_t;
+
+struct ThreadPool {
+	inject_queue_t inject[LANE_COUNT];
+	lane_state_t lanes[LANE_COUNT];
+	task_queue_t *local_queues;
+	thrd_t *workers;
+	int num_threads;
+	int priority;
+	atomic_bool shutdown;
+	/* Counts every task in flight; thread_pool_drain() blocks on it. */
+	task_group_t root;
+	texture_cache_t *texture_caches;
+	/* CPU each worker is pinned to, or NULL when placement is left to the
+	 * OS. */
+	int *worker_cpus;
+	/* Row i lists the other workers in the order worker i tries to steal
+	 * from them: shared L2 first, then same package, then the rest. */
+	int *steal_order;
+	atomic_bool helper_busy[HELPER_SLOTS];
+	thread_profile_t helper_profiles[HELPER_SLOTS];
+	cnd_t wakeup;
+	mtx_t wakeup_mutex;
+	/* Workers blocked in cnd_wait; lets submitters skip the mutex when all
+	 * workers are busy. */
+	_Alignas(64) atomic_int sleeping_workers;
+	/* Submission timestamps feed a moving average of the gap between task
+	 * arrivals, which sizes the spin phase. */
+	_Alignas(64) atomic_uint_fast64_t last_arrival_ns;
+	atomic_uint_fast64_t arrival_gap_ns;
+	/* Time of the last wake signal, for wake-up latency. */
+	atomic_uint_fast64_t wake_ns;
+	slot_metrics_t *metrics; /* workers, then helper slots */
+	/* One ring per slot while tracing, else NULL. */
+	_Atomic(trace_ring_t *) trace;
+	int id; /* process id in trace output */
+	ThreadPool *next; /* g_pools list */
+};
+
+/* Pool used by the thread_pool_* wrappers and by groups without a pool. */
+static ThreadPool *g_default_pool;
+/* Every live pool, for profiling and for the shared job pools' lifetime. */
+static ThreadPool *g_pools;
+static mtx_t g_pools_lock;
+static once_flag g_pools_once = ONCE_FLAG_INIT;
 static atomic_bool g_profiling_enabled = false;
-static _Alignas(64) atomic_uint_fast64_t g_pending_tasks;
+static atomic_bool g_trace_enabled = false;
+/* Frame number stamped on trace events, see thread_trace_next_frame(). */
+static atomic_uint g_trace_frame;
+/* Output of thread_trace_start(); pools append their events on shutdown. */
+static mtx_t g_trace_lock;
+static FILE *g_trace_file;
+static bool g_trace_empty;
+static uint64_t g_trace_t0;
+static int g_next_pool_id;
+/* Pool, slot and group of the task currently running on this thread. A
+ * slot is a worker index or, past num_threads, a helper slot. */
+static _Thread_local ThreadPool *tls_pool;
+static _Thread_local int tls_tid = -1;
+/* Set when the next task to run was stolen from another worker. */
+static _Thread_local bool tls_stolen;
+static _Thread_local task_group_t *tls_group;
 static _Thread_local thread_profile_t g_thread_profile;
-static texture_cache_t *g_texture_caches;
 static _Thread_local texture_cache_t *tls_cache;
-static cnd_t g_wakeup;
-static mtx_t g_wakeup_mutex;
+/* Spin budget ceiling in ns, 0 to park straight after yielding. */
+static atomic_uint g_spin_max_ns = SPIN_MAX_US * 1000u;
+static bool g_spin_set;
 
 /* Use builtin cycle counter where available, otherwise fall back to
  * clock_gettime for a monotonic timestamp. */
@@ -92,52 +263,433 @@ static uint64_t get_cycles(void)
 #endif
 }
 
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Single-writer increment: no locked instruction on the task path. */
+static inline void metric_inc(atomic_uint_fast64_t *c)
+{
+	atomic_store_explicit(
+		c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#elif defined(_MSC_VER)
+	YieldProcessor();
+#endif
+}
+
 static const char *stage_names[STAGE_COUNT] = { "Vertex",      "Primitive",
 						"Raster",      "Fragment",
 						"Framebuffer", "Steal" };
 
-static bool steal_task(int thread_id, task_t *out, bool profiling)
+/* Tasks without a group are stored with @p inherit. */
+static inline void slot_store(task_slot_t *s, const task_t *task,
+			      task_group_t *inherit)
 {
-	uint64_t start = profiling ? get_cycles() : 0;
-	for (int i = 0; i < g_num_threads; ++i) {
-		if (i == thread_id)
-			continue;
-		task_queue_t *victim = &g_local_queues[i];
-		uint64_t head = atomic_load_explicit(&victim->head,
-						     memory_order_relaxed);
-		uint64_t tail = atomic_load_explicit(&victim->tail,
-						     memory_order_acquire);
-		if (head >= tail)
-			continue;
-		uint64_t steal_count = (tail - head) / 4;
-		if (steal_count == 0)
-			steal_count = 1;
-		for (uint64_t j = 0; j < steal_count; ++j) {
-			uint64_t slot = head % LOCAL_QUEUE_SIZE;
-			task_t task = victim->entries[slot];
-			if (task.token != head)
-				break;
-			if (atomic_compare_exchange_strong_explicit(
-				    &victim->head, &head, head + 1,
-				    memory_order_release,
+	atomic_store_explicit(&s->function, task->function,
+			      memory_order_relaxed);
+	atomic_store_explicit(&s->task_data, task->task_data,
+			      memory_order_relaxed);
+	atomic_store_explicit(&s->stage, (int)task->stage,
+			      memory_order_relaxed);
+	atomic_store_explicit(&s->group, task->group ? task->group : inherit,
+			      memory_order_relaxed);
+}
+
+static inline task_t slot_load(task_slot_t *s)
+{
+	task_t task;
+	task.function =
+		atomic_load_explicit(&s->function, memory_order_relaxed);
+	task.task_data =
+		atomic_load_explicit(&s->task_data, memory_order_relaxed);
+	task.stage = (stage_tag_t)atomic_load_explicit(&s->stage,
+						       memory_order_relaxed);
+	task.group = atomic_load_explicit(&s->group, memory_order_relaxed);
+	return task;
+}
+
+static deque_ring_t *deque_ring_new(int64_t size)
+{
+	deque_ring_t *ring =
+		calloc(1, sizeof(deque_ring_t) + sizeof(task_slot_t) * size);
+	if (ring)
+		ring->mask = size - 1;
+	return ring;
+}
+
+static int64_t deque_size(task_deque_t *q)
+{
+	int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+	return b > t ? b - t : 0;
+}
+
+/* Owner only: move live entries [t, b) into a ring of at least @p need
+ * slots. Thieves may still be reading the old ring, so it is chained on
+ * ->retired rather than freed. */
+static deque_ring_t *deque_grow(task_deque_t *q, deque_ring_t *old, int64_t t,
+				int64_t b, int64_t need)
+{
+	int64_t size = old->mask + 1;
+	do
+		size *= 2;
+	while (size < need);
+	deque_ring_t *ring = deque_ring_new(size);
+	if (!ring) {
+		LOG_ERROR("Failed to grow task deque to %lld entries",
+			  (long long)size);
+		return NULL;
+	}
+	for (int64_t i = t; i < b; ++i) {
+		task_t task = slot_load(&old->slots[i & old->mask]);
+		slot_store(&ring->slots[i & ring->mask], &task, NULL);
+	}
+	ring->retired = old;
+	atomic_store_explicit(&q->ring, ring, memory_order_release);
+	return ring;
+}
+
+/* Owner only: push up to @p count tasks with a single bottom update.
+ * Returns how many were pushed, which is short only if growing failed. */
+static size_t deque_push(task_deque_t *q, const task_t *tasks, size_t count,
+			 task_group_t *inherit)
+{
+	int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+	deque_ring_t *ring = atomic_load_explicit(&q->ring,
+						  memory_order_relaxed);
+	if (b - t + (int64_t)count > ring->mask + 1) {
+		deque_ring_t *grown =
+			deque_grow(q, ring, t, b, b - t + (int64_t)count);
+		if (grown) {
+			ring = grown;
+		} else {
+			int64_t room = ring->mask + 1 - (b - t);
+			count = room > 0 ? (size_t)room : 0;
+		}
+	}
+	for (size_t i = 0; i < count; ++i)
+		slot_store(&ring->slots[(b + (int64_t)i) & ring->mask],
+			   &tasks[i], inherit);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&q->bottom, b + (int64_t)count,
+			      memory_order_relaxed);
+	return count;
+}
+
+/* Owner only: pop the most recently pushed task. */
+static bool deque_take(task_deque_t *q, task_t *out)
+{
+	/* top only grows, so a stale value can only overstate the size; skip
+	 * the fence when the lane is plainly empty. */
+	if (atomic_load_explicit(&q->bottom, memory_order_relaxed) <=
+	    atomic_load_explicit(&q->top, memory_order_relaxed))
+		return false;
+	int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+	deque_ring_t *ring = atomic_load_explicit(&q->ring,
+						  memory_order_relaxed);
+	atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+	if (t > b) {
+		atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+		return false;
+	}
+	*out = slot_load(&ring->slots[b & ring->mask]);
+	if (t == b) {
+		/* Last entry: race thieves for it. */
+		bool won = atomic_compare_exchange_strong_explicit(
+			&q->top, &t, t + 1, memory_order_seq_cst,
+			memory_order_relaxed);
+		atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+/* Any thread: take the oldest task. Returns 1 on success, 0 when the deque
+ * is empty and -1 when another thread won the race. */
+static int deque_steal(task_deque_t *q, task_t *out)
+{
+	int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+	if (t >= b)
+		return 0;
+	deque_ring_t *ring = atomic_load_explicit(&q->ring,
+						  memory_order_acquire);
+	task_t task = slot_load(&ring->slots[t & ring->mask]);
+	if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed))
+		return -1;
+	*out = task;
+	return 1;
+}
+
+static bool inject_push(inject_queue_t *q, const task_t *task,
+			task_group_t *inherit)
+{
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	for (;;) {
+		inject_cell_t *cell = &q->cells[pos & (INJECT_QUEUE_SIZE - 1)];
+		size_t seq =
+			atomic_load_explicit(&cell->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &q->tail, &pos, pos + 1,
+				    memory_order_relaxed,
 				    memory_order_relaxed)) {
-				*out = task;
-				if (profiling) {
-					g_thread_profile.stages[task.stage]
-						.steal_successes++;
-					g_thread_profile.stages[task.stage]
-						.steal_cycles +=
-						get_cycles() - start;
-				}
+				slot_store(&cell->slot, task, inherit);
+				atomic_store_explicit(&cell->seq, pos + 1,
+						      memory_order_release);
 				return true;
 			}
+		} else if (diff < 0) {
+			return false; /* full */
+		} else {
+			pos = atomic_load_explicit(&q->tail,
+						   memory_order_relaxed);
+		}
+	}
+}
+
+static bool inject_pop(inject_queue_t *q, task_t *out)
+{
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	for (;;) {
+		inject_cell_t *cell = &q->cells[pos & (INJECT_QUEUE_SIZE - 1)];
+		size_t seq =
+			atomic_load_explicit(&cell->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &q->head, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed)) {
+				*out = slot_load(&cell->slot);
+				atomic_store_explicit(
+					&cell->seq, pos + INJECT_QUEUE_SIZE,
+					memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false; /* empty */
+		} else {
+			pos = atomic_load_explicit(&q->head,
+						   memory_order_relaxed);
+		}
+	}
+}
+
+static uint64_t inject_size(inject_queue_t *q)
+{
+	size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+	return t > h ? (uint64_t)(t - h) : 0;
+}
+
+static uint64_t queue_size(task_queue_t *q)
+{
+	uint64_t n = 0;
+	for (int l = 0; l < LANE_COUNT; ++l)
+		n += (uint64_t)deque_size(&q->lanes[l]);
+	return n;
+}
+
+static bool pool_has_work(ThreadPool *pool)
+{
+	for (int l = 0; l < LANE_COUNT; ++l)
+		if (atomic_load_explicit(&pool->lanes[l].queued,
+					 memory_order_relaxed))
+			return true;
+	return false;
+}
+
+static void group_init(task_group_t *group, ThreadPool *pool, int refs)
+{
+	atomic_init(&group->pending, 0);
+	atomic_init(&group->refs, refs);
+	atomic_init(&group->waiters, 0);
+	group->pool = pool;
+	mtx_init(&group->lock, mtx_plain);
+	cnd_init(&group->done);
+}
+
+/* Retire one task. Waiters are woken under the lock so one that checked
+ * pending just before our decrement cannot miss the signal. */
+static void group_complete(task_group_t *group)
+{
+	if (atomic_fetch_sub_explicit(&group->pending, 1,
+				      memory_order_seq_cst) != 1)
+		return;
+	if (atomic_load_explicit(&group->waiters, memory_order_seq_cst) == 0)
+		return;
+	mtx_lock(&group->lock);
+	cnd_broadcast(&group->done);
+	mtx_unlock(&group->lock);
+}
+
+task_group_t *task_group_create_on(ThreadPool *pool)
+{
+	task_group_t *group =
+		aligned_alloc(_Alignof(task_group_t), sizeof(task_group_t));
+	if (!group) {
+		LOG_ERROR("Failed to allocate task group");
+		return NULL;
+	}
+	group_init(group, pool, 1);
+	return group;
+}
+
+task_group_t *task_group_create(void)
+{
+	return task_group_create_on(NULL);
+}
+
+ThreadPool *task_group_pool(const task_group_t *group)
+{
+	if (group && group->pool)
+		return group->pool;
+	return g_default_pool;
+}
+
+void task_group_retain(task_group_t *group)
+{
+	if (group)
+		atomic_fetch_add_explicit(&group->refs, 1,
+					  memory_order_relaxed);
+}
+
+void task_group_release(task_group_t *group)
+{
+	/* A pool's root group lives and dies with the pool. */
+	if (!group || (group->pool && group == &group->pool->root))
+		return;
+	if (atomic_fetch_sub_explicit(&group->refs, 1,
+				      memory_order_acq_rel) == 1) {
+		cnd_destroy(&group->done);
+		mtx_destroy(&group->lock);
+		free(group);
+	}
+}
+
+uint64_t task_group_pending(const task_group_t *group)
+{
+	if (!group)
+		return 0;
+	return atomic_load_explicit(&group->pending, memory_order_acquire);
+}
+
+static void trace_record(ThreadPool *pool, const task_t *task, uint64_t begin,
+			 bool stolen)
+{
+	trace_ring_t *rings =
+		atomic_load_explicit(&pool->trace, memory_order_acquire);
+	if (!rings || tls_pool != pool || tls_tid < 0)
+		return;
+	trace_ring_t *ring = &rings[tls_tid];
+	if (!ring->events) {
+		ring->events =
+			malloc(sizeof(trace_event_t) * TRACE_RING_EVENTS);
+		if (!ring->events)
+			return;
+	}
+	trace_event_t *e = &ring->events[ring->count++ % TRACE_RING_EVENTS];
+	e->begin_ns = begin;
+	e->end_ns = now_ns();
+	e->function = task->function;
+	e->task_data = task->task_data;
+	e->frame = atomic_load_explicit(&g_trace_frame, memory_order_relaxed);
+	e->stage = (uint8_t)task->stage;
+	e->stolen = stolen;
+}
+
+static void run_task(ThreadPool *pool, const task_t *task, bool profiling)
+{
+	lane_state_t *lane = &pool->lanes[g_stage_lane[task->stage]];
+	atomic_fetch_sub_explicit(&lane->queued, 1, memory_order_relaxed);
+	if (profiling) {
+		g_thread_profile.stages[task->stage].task_count++;
+		if (task->stage == STAGE_FRAGMENT)
+			g_thread_profile.stages[STAGE_FRAGMENT].tile_jobs++;
+	}
+	uint64_t ts = profiling ? get_cycles() : 0;
+	bool tracing =
+		atomic_load_explicit(&g_trace_enabled, memory_order_relaxed);
+	uint64_t begin = tracing ? now_ns() : 0;
+	bool stolen = tls_stolen;
+	tls_stolen = false;
+	task_group_t *outer = tls_group;
+	tls_group = task->group;
+	task->function(task->task_data);
+	tls_group = outer;
+	/* Recorded before the task retires so a drain orders it before the
+	 * trace is written. */
+	if (tracing)
+		trace_record(pool, task, begin, stolen);
+	if (tls_pool == pool && tls_tid >= 0)
+		metric_inc(&pool->metrics[tls_tid].tasks[task->stage]);
+	if (task->group) {
+		group_complete(task->group);
+		task_group_release(task->group);
+	}
+	group_complete(&pool->root);
+	if (profiling) {
+		uint64_t c = get_cycles() - ts;
+		stage_profile_t *sp = &g_thread_profile.stages[task->stage];
+		sp->task_cycles += c;
+		if (c > sp->max_task_cycles)
+			sp->max_task_cycles = c;
+	}
+}
+
+static bool steal_task(ThreadPool *pool, int thread_id, int lane,
+		       task_t *out, bool profiling)
+{
+	uint64_t start = profiling ? get_cycles() : 0;
+	/* Helpers have no locality and simply sweep every worker. */
+	int n_threads = pool->num_threads;
+	bool worker = thread_id < n_threads;
+	int victims = worker ? n_threads - 1 : n_threads;
+	for (int n = 0; n < victims; ++n) {
+		int v = worker ? pool->steal_order[thread_id * n_threads + n] :
+				 (thread_id + n) % n_threads;
+		task_deque_t *victim = &pool->local_queues[v].lanes[lane];
+		int r;
+		while ((r = deque_steal(victim, out)) < 0) {
 			if (profiling) {
-				g_thread_profile.stages[task.stage]
-					.contention_events++;
-				g_thread_profile.stages[task.stage]
+				g_thread_profile.stages[STAGE_STEAL]
 					.steal_attempts++;
+				g_thread_profile.stages[STAGE_STEAL]
+					.contention_events++;
 			}
 		}
+		if (r > 0) {
+			tls_stolen = true;
+			metric_inc(&pool->metrics[thread_id].steals);
+			if (profiling) {
+				stage_profile_t *sp =
+					&g_thread_profile.stages[out->stage];
+				sp->steal_attempts++;
+				sp->steal_successes++;
+				sp->steal_cycles += get_cycles() - start;
+			}
+			return true;
+		}
 	}
 	if (profiling)
 		g_thread_profile.stages[STAGE_STEAL].steal_cycles +=
@@ -145,229 +697,679 @@ static bool steal_task(int thread_id, task_t *out, bool profiling)
 	return false;
 }
 
-static int worker_thread_main(void *arg)
+/* Fetch the most downstream task available in lanes 0..@p max_lane: our own
+ * deque first, then the injection queue, then other workers. */
+static bool find_task(ThreadPool *pool, int thread_id, int max_lane,
+		      task_t *out, bool profiling)
 {
-	int thread_id = *(int *)arg;
-	free(arg);
-	tls_tid = thread_id;
-	tls_cache = &g_texture_caches[thread_id];
-	task_queue_t *local_queue = &g_local_queues[thread_id];
-	int idle_loops = 0;
-	while (!atomic_load_explicit(&g_shutdown_flag, memory_order_acquire)) {
+	bool worker = thread_id >= 0 && thread_id < pool->num_threads;
+	for (int l = 0; l <= max_lane; ++l) {
+		if (!atomic_load_explicit(&pool->lanes[l].queued,
+					  memory_order_relaxed))
+			continue;
+		if (worker &&
+		    deque_take(&pool->local_queues[thread_id].lanes[l], out))
+			return true;
+		if (inject_pop(&pool->inject[l], out) ||
+		    steal_task(pool, thread_id, l, out, profiling))
+			return true;
+	}
+	return false;
+}
+
+/* Claim a helper slot so a waiting non-worker thread can run tasks with its
+ * own tls_tid, texture cache and profile. */
+static bool helper_enter(ThreadPool *pool)
+{
+	if (tls_tid >= 0 || !pool || !pool->local_queues)
+		return false;
+	for (int i = 0; i < HELPER_SLOTS; ++i) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong_explicit(
+			    &pool->helper_busy[i], &expected, true,
+			    memory_order_acquire, memory_order_relaxed)) {
+			tls_pool = pool;
+			tls_tid = pool->num_threads + i;
+			tls_cache = &pool->texture_caches[tls_tid];
+			return true;
+		}
+	}
+	return false;
+}
+
+static void helper_leave(ThreadPool *pool, const thread_profile_t *before)
+{
+	int slot = tls_tid - pool->num_threads;
+	thread_profile_t *dst = &pool->helper_profiles[slot];
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		const stage_profile_t *b = &before->stages[s];
+		const stage_profile_t *a = &g_thread_profile.stages[s];
+		stage_profile_t *d = &dst->stages[s];
+		d->task_count += a->task_count - b->task_count;
+		d->steal_attempts += a->steal_attempts - b->steal_attempts;
+		d->steal_successes += a->steal_successes - b->steal_successes;
+		d->contention_events +=
+			a->contention_events - b->contention_events;
+		d->task_cycles += a->task_cycles - b->task_cycles;
+		d->steal_cycles += a->steal_cycles - b->steal_cycles;
+		d->tile_jobs += a->tile_jobs - b->tile_jobs;
+		d->cache_hits += a->cache_hits - b->cache_hits;
+		d->cache_misses += a->cache_misses - b->cache_misses;
+		if (a->max_task_cycles > d->max_task_cycles)
+			d->max_task_cycles = a->max_task_cycles;
+	}
+	tls_pool = NULL;
+	tls_tid = -1;
+	tls_cache = NULL;
+	atomic_store_explicit(&pool->helper_busy[slot], false,
+			      memory_order_release);
+}
+
+static bool deadline_passed(const struct timespec *deadline)
+{
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return now.tv_sec > deadline->tv_sec ||
+	       (now.tv_sec == deadline->tv_sec &&
+		now.tv_nsec >= deadline->tv_nsec);
+}
+
+/* Run queued tasks on the calling thread until @p group drains, the queues
+ * run dry or @p deadline (if any) passes. Workers keep the rest. */
+static void help_while_pending(task_group_t *group,
+			       const struct timespec *deadline)
+{
+	ThreadPool *pool = task_group_pool(group);
+	if (!helper_enter(pool))
+		return;
+	thread_profile_t before = g_thread_profile;
+	while (atomic_load_explicit(&group->pending, memory_order_acquire)) {
 		bool profiling = atomic_load_explicit(&g_profiling_enabled,
-						      memory_order_acquire);
-		uint64_t start_cycles = profiling ? get_cycles() : 0;
-		uint64_t head = atomic_load_explicit(&local_queue->head,
-						     memory_order_relaxed);
-		uint64_t tail = atomic_load_explicit(&local_queue->tail,
-						     memory_order_acquire);
-		if (head < tail) {
-			uint64_t new_tail = tail - 1;
-			uint64_t slot = new_tail % LOCAL_QUEUE_SIZE;
-			task_t task = local_queue->entries[slot];
-			if (task.token == new_tail) {
-				if (atomic_compare_exchange_strong_explicit(
-					    &local_queue->tail, &tail, new_tail,
-					    memory_order_release,
-					    memory_order_relaxed)) {
-					if (profiling) {
-						g_thread_profile
-							.stages[task.stage]
-							.task_count++;
-						if (task.stage ==
-						    STAGE_FRAGMENT)
-							g_thread_profile
-								.stages[STAGE_FRAGMENT]
-								.tile_jobs++;
-					}
-					uint64_t ts = profiling ? get_cycles() :
-								  0;
-					task.function(task.task_data);
-					atomic_fetch_sub_explicit(
-						&g_pending_tasks, 1,
-						memory_order_acq_rel);
-					if (profiling) {
-						uint64_t c = get_cycles() - ts;
-						stage_profile_t *sp =
-							&g_thread_profile.stages
-								 [task.stage];
-						sp->task_cycles += c;
-						if (c > sp->max_task_cycles)
-							sp->max_task_cycles = c;
-					}
-					idle_loops = 0;
-					continue;
-				}
-				if (profiling)
-					g_thread_profile.stages[task.stage]
-						.contention_events++;
-			}
+						      memory_order_relaxed);
+		task_t task;
+		if (!find_task(pool, tls_tid, LANE_COUNT - 1, &task,
+			       profiling))
+			break;
+		run_task(pool, &task, profiling);
+		if (deadline && deadline_passed(deadline))
+			break;
+	}
+	helper_leave(pool, &before);
+}
+
+int task_group_wait_timeout(task_group_t *group, uint32_t ms)
+{
+	if (!group)
+		return 1;
+	if (atomic_load_explicit(&group->pending, memory_order_acquire) == 0)
+		return 1;
+	struct timespec deadline;
+	timespec_get(&deadline, TIME_UTC);
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	help_while_pending(group, &deadline);
+	int idle = 1;
+	mtx_lock(&group->lock);
+	atomic_fetch_add_explicit(&group->waiters, 1, memory_order_seq_cst);
+	while (atomic_load_explicit(&group->pending, memory_order_seq_cst)) {
+		if (cnd_timedwait(&group->done, &group->lock, &deadline) ==
+			    thrd_timedout &&
+		    atomic_load_explicit(&group->pending,
+					 memory_order_seq_cst)) {
+			idle = 0;
+			break;
 		}
-		head = atomic_load_explicit(&g_global_head,
+	}
+	atomic_fetch_sub_explicit(&group->waiters, 1, memory_order_relaxed);
+	mtx_unlock(&group->lock);
+	return idle;
+}
+
+void task_group_wait(task_group_t *group)
+{
+	if (!group)
+		return;
+	if (atomic_load_explicit(&group->pending, memory_order_acquire) == 0)
+		return;
+	help_while_pending(group, NULL);
+	mtx_lock(&group->lock);
+	atomic_fetch_add_explicit(&group->waiters, 1, memory_order_seq_cst);
+	while (atomic_load_explicit(&group->pending, memory_order_seq_cst))
+		cnd_wait(&group->done, &group->lock);
+	atomic_fetch_sub_explicit(&group->waiters, 1, memory_order_relaxed);
+	mtx_unlock(&group->lock);
+}
+
+static bool idle_should_wake(ThreadPool *pool)
+{
+	return pool_has_work(pool) ||
+	       atomic_load_explicit(&pool->shutdown, memory_order_relaxed);
+}
+
+/* Spin only when the next task is likely to arrive within the window: twice
+ * the recent arrival gap, capped by g_spin_max_ns. */
+static uint64_t spin_budget_ns(ThreadPool *pool)
+{
+	uint64_t max = atomic_load_explicit(&g_spin_max_ns,
+					    memory_order_relaxed);
+	uint64_t gap = atomic_load_explicit(&pool->arrival_gap_ns,
 					    memory_order_relaxed);
-		tail = atomic_load_explicit(&g_global_tail,
-					    memory_order_acquire);
-		if (head < tail) {
-			uint64_t slot = head % MAX_TASKS;
-			task_t task = g_global_queue[slot];
-			if (task.token == head) {
-				if (atomic_compare_exchange_strong_explicit(
-					    &g_global_head, &head, head + 1,
-					    memory_order_release,
-					    memory_order_relaxed)) {
-					if (profiling) {
-						g_thread_profile
-							.stages[task.stage]
-							.task_count++;
-						if (task.stage ==
-						    STAGE_FRAGMENT)
-							g_thread_profile
-								.stages[STAGE_FRAGMENT]
-								.tile_jobs++;
-					}
-					uint64_t ts = profiling ? get_cycles() :
-								  0;
-					task.function(task.task_data);
-					if (profiling) {
-						uint64_t c = get_cycles() - ts;
-						stage_profile_t *sp =
-							&g_thread_profile.stages
-								 [task.stage];
-						sp->task_cycles += c;
-						if (c > sp->max_task_cycles)
-							sp->max_task_cycles = c;
-					}
-					idle_loops = 0;
-					continue;
-				}
+	if (!max || gap > max)
+		return 0;
+	return gap * 2 < max ? gap * 2 : max;
+}
+
+/* Spin with a pause instruction, then yield. Returns true if work showed up
+ * before the worker has to park. */
+static bool idle_spin(ThreadPool *pool, bool profiling)
+{
+	uint64_t budget = spin_budget_ns(pool);
+	if (budget) {
+		uint64_t end = now_ns() + budget;
+		do {
+			for (int i = 0; i < 32; ++i)
+				cpu_relax();
+			if (idle_should_wake(pool)) {
 				if (profiling)
-					g_thread_profile.stages[task.stage]
-						.contention_events++;
+					g_thread_profile.idle.spin_wakes++;
+				return true;
 			}
+		} while (now_ns() < end);
+	}
+	for (int i = 0; i < IDLE_YIELDS; ++i) {
+		thrd_yield();
+		if (idle_should_wake(pool)) {
+			if (profiling)
+				g_thread_profile.idle.yield_wakes++;
+			return true;
 		}
-		task_t stolen;
-		if (steal_task(thread_id, &stolen, profiling)) {
-			if (profiling) {
-				g_thread_profile.stages[stolen.stage]
-					.task_count++;
-				if (stolen.stage == STAGE_FRAGMENT)
-					g_thread_profile.stages[STAGE_FRAGMENT]
-						.tile_jobs++;
-			}
-			uint64_t ts = profiling ? get_cycles() : 0;
-			stolen.function(stolen.task_data);
-			atomic_fetch_sub_explicit(&g_pending_tasks, 1,
-						  memory_order_acq_rel);
-			if (profiling) {
-				uint64_t c = get_cycles() - ts;
-				stage_profile_t *sp =
-					&g_thread_profile.stages[stolen.stage];
-				sp->task_cycles += c;
-				if (c > sp->max_task_cycles)
-					sp->max_task_cycles = c;
+	}
+	return false;
+}
+
+static void park(ThreadPool *pool, bool profiling)
+{
+	mtx_lock(&pool->wakeup_mutex);
+	atomic_fetch_add_explicit(&pool->sleeping_workers, 1,
+				  memory_order_seq_cst);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!idle_should_wake(pool)) {
+		metric_inc(&pool->metrics[tls_tid].parks);
+		uint64_t parked = now_ns();
+		cnd_wait(&pool->wakeup, &pool->wakeup_mutex);
+		if (profiling) {
+			idle_profile_t *ip = &g_thread_profile.idle;
+			ip->parks++;
+			uint64_t woke = atomic_load_explicit(
+				&pool->wake_ns, memory_order_relaxed);
+			uint64_t now = now_ns();
+			if (woke >= parked && now >= woke) {
+				uint64_t lat = now - woke;
+				ip->wakeups++;
+				ip->wake_latency_ns += lat;
+				if (lat > ip->max_wake_latency_ns)
+					ip->max_wake_latency_ns = lat;
 			}
-			idle_loops = 0;
+		}
+	}
+	atomic_fetch_sub_explicit(&pool->sleeping_workers, 1,
+				  memory_order_relaxed);
+	mtx_unlock(&pool->wakeup_mutex);
+}
+
+typedef struct {
+	ThreadPool *pool;
+	int thread_id;
+} worker_arg_t;
+
+static int worker_thread_main(void *arg)
+{
+	ThreadPool *pool = ((worker_arg_t *)arg)->pool;
+	int thread_id = ((worker_arg_t *)arg)->thread_id;
+	free(arg);
+	tls_pool = pool;
+	tls_tid = thread_id;
+	tls_cache = &pool->texture_caches[thread_id];
+	if (pool->worker_cpus &&
+	    !cpu_pin_current_thread(pool->worker_cpus[thread_id]))
+		LOG_WARN("Failed to pin worker %d to CPU %d", thread_id,
+			 pool->worker_cpus[thread_id]);
+	if (pool->priority &&
+	    !cpu_set_current_thread_priority(pool->priority))
+		LOG_WARN("Failed to set worker %d priority to %d", thread_id,
+			 pool->priority);
+	while (!atomic_load_explicit(&pool->shutdown, memory_order_acquire)) {
+		bool profiling = atomic_load_explicit(&g_profiling_enabled,
+						      memory_order_acquire);
+		uint64_t start_cycles = profiling ? get_cycles() : 0;
+		task_t task;
+		if (find_task(pool, thread_id, LANE_COUNT - 1, &task,
+			      profiling)) {
+			run_task(pool, &task, profiling);
 			continue;
 		}
+		if (!idle_spin(pool, profiling))
+			park(pool, profiling);
 		if (profiling)
 			g_thread_profile.stages[STAGE_VERTEX].idle_cycles +=
 				get_cycles() - start_cycles;
-		idle_loops++;
-		mtx_lock(&g_wakeup_mutex);
-		uint64_t lh = atomic_load_explicit(&local_queue->head,
-						   memory_order_relaxed);
-		uint64_t lt = atomic_load_explicit(&local_queue->tail,
-						   memory_order_acquire);
-		uint64_t gh = atomic_load_explicit(&g_global_head,
-						   memory_order_relaxed);
-		uint64_t gt = atomic_load_explicit(&g_global_tail,
-						   memory_order_acquire);
-		if (lh >= lt && gh >= gt &&
-		    !atomic_load_explicit(&g_shutdown_flag,
-					  memory_order_relaxed))
-			cnd_wait(&g_wakeup, &g_wakeup_mutex);
-		mtx_unlock(&g_wakeup_mutex);
-		idle_loops = 0;
 	}
-	for (int s = 0; s < STAGE_COUNT; ++s)
-		g_local_queues[thread_id].profile_data.stages[s] =
-			g_thread_profile.stages[s];
+	pool->local_queues[thread_id].profile_data = g_thread_profile;
 	return 0;
 }
 
-int thread_pool_init(int num_threads)
+static void free_local_queues(ThreadPool *pool)
 {
-	g_num_threads = num_threads > 0 ? num_threads : 1;
+	for (int i = 0; i < pool->num_threads; ++i) {
+		for (int l = 0; l < LANE_COUNT; ++l) {
+			deque_ring_t *ring = atomic_load_explicit(
+				&pool->local_queues[i].lanes[l].ring,
+				memory_order_relaxed);
+			while (ring) {
+				deque_ring_t *next = ring->retired;
+				free(ring);
+				ring = next;
+			}
+		}
+	}
+	free(pool->local_queues);
+}
 
-	g_worker_threads = malloc(sizeof(thrd_t) * g_num_threads);
-	if (!g_worker_threads) {
-		LOG_ERROR("Failed to allocate worker thread handles");
+static int steal_distance(const cpu_info_t *a, const cpu_info_t *b)
+{
+	if (!a || !b)
+		return 0;
+	if (a->l2 == b->l2)
 		return 0;
+	return a->package == b->package ? 1 : 2;
+}
+
+/* Resolve @p affinity into pool->worker_cpus and build every worker's steal
+ * order. Without a placement all victims are equally near and are tried
+ * round-robin starting after the thief. */
+static bool placement_init(ThreadPool *pool, const char *affinity)
+{
+	int n = pool->num_threads;
+	pool->steal_order = malloc(sizeof(int) * n * n);
+	if (!pool->steal_order)
+		return false;
+	cpu_info_t *cpus = NULL;
+	int ncpus = 0;
+	if (affinity && *affinity)
+		cpus = malloc(sizeof(cpu_info_t) * CPU_TOPOLOGY_MAX);
+	if (cpus) {
+		ncpus = cpu_topology_read(cpus, CPU_TOPOLOGY_MAX);
+		pool->worker_cpus = malloc(sizeof(int) * n);
+		if (pool->worker_cpus &&
+		    !cpu_affinity_plan(affinity, cpus, ncpus, pool->worker_cpus,
+				       n)) {
+			LOG_WARN("Ignoring affinity '%s'", affinity);
+			free(pool->worker_cpus);
+			pool->worker_cpus = NULL;
+		}
 	}
+	for (int i = 0; i < n; ++i) {
+		const cpu_info_t *self =
+			pool->worker_cpus ?
+				cpu_topology_find(cpus, ncpus,
+						  pool->worker_cpus[i]) :
+				NULL;
+		if (pool->worker_cpus)
+			LOG_INFO("Worker %d -> CPU %d", i,
+				 pool->worker_cpus[i]);
+		int *row = &pool->steal_order[i * n];
+		int count = 0;
+		for (int d = 0; d <= 2; ++d) {
+			for (int k = 1; k < n; ++k) {
+				int v = (i + k) % n;
+				const cpu_info_t *other =
+					pool->worker_cpus ?
+						cpu_topology_find(
+							cpus, ncpus,
+							pool->worker_cpus[v]) :
+						NULL;
+				if (steal_distance(self, other) == d)
+					row[count++] = v;
+			}
+		}
+	}
+	free(cpus);
+	return true;
+}
 
-	g_local_queues = calloc(g_num_threads, sizeof(task_queue_t));
-	if (!g_local_queues) {
-		LOG_ERROR("Failed to allocate local queues");
-		free(g_worker_threads);
-		return 0;
+static void placement_free(ThreadPool *pool)
+{
+	free(pool->worker_cpus);
+	free(pool->steal_order);
+	pool->worker_cpus = NULL;
+	pool->steal_order = NULL;
+}
+
+static long online_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	return sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	return -1;
+#endif
+}
+
+static void pools_lock_init(void)
+{
+	mtx_init(&g_pools_lock, mtx_plain);
+	mtx_init(&g_trace_lock, mtx_plain);
+}
+
+static bool trace_alloc(ThreadPool *pool)
+{
+	trace_ring_t *rings =
+		calloc(pool->num_threads + HELPER_SLOTS, sizeof(trace_ring_t));
+	atomic_store_explicit(&pool->trace, rings, memory_order_release);
+	return rings != NULL;
+}
+
+static void trace_free(ThreadPool *pool)
+{
+	trace_ring_t *rings =
+		atomic_load_explicit(&pool->trace, memory_order_relaxed);
+	if (!rings)
+		return;
+	for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i)
+		free(rings[i].events);
+	free(rings);
+	atomic_store_explicit(&pool->trace, NULL, memory_order_relaxed);
+}
+
+/* Caller holds g_trace_lock. */
+static void trace_write_event(const char *fmt, ...)
+{
+	va_list ap;
+	fputs(g_trace_empty ? "\n" : ",\n", g_trace_file);
+	g_trace_empty = false;
+	va_start(ap, fmt);
+	vfprintf(g_trace_file, fmt, ap);
+	va_end(ap);
+}
+
+/* Append @p pool's recorded tasks to the trace file. The pool must be idle:
+ * drained or stopped. */
+static void trace_write_pool(ThreadPool *pool)
+{
+	trace_ring_t *rings =
+		atomic_load_explicit(&pool->trace, memory_order_acquire);
+	if (!rings)
+		return;
+	mtx_lock(&g_trace_lock);
+	if (!g_trace_file) {
+		mtx_unlock(&g_trace_lock);
+		return;
 	}
+	trace_write_event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+			  "\"args\":{\"name\":\"%s pool %d\"}}",
+			  pool->id,
+			  pool == g_default_pool ? "default" : "thread",
+			  pool->id);
+	for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i) {
+		trace_ring_t *ring = &rings[i];
+		if (!ring->count)
+			continue;
+		bool worker = i < pool->num_threads;
+		trace_write_event("{\"name\":\"thread_name\",\"ph\":\"M\","
+				  "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":"
+				  "\"%s %d\"}}",
+				  pool->id, i, worker ? "worker" : "helper",
+				  worker ? i : i - pool->num_threads);
+		uint64_t first = 0;
+		if (ring->count > TRACE_RING_EVENTS) {
+			first = ring->count - TRACE_RING_EVENTS;
+			LOG_INFO("Trace: pool %d slot %d kept the last %d of "
+				 "%llu tasks",
+				 pool->id, i, TRACE_RING_EVENTS,
+				 (unsigned long long)ring->count);
+		}
+		for (uint64_t n = first; n < ring->count; ++n) {
+			const trace_event_t *e =
+				&ring->events[n % TRACE_RING_EVENTS];
+			trace_write_event(
+				"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+				"\"ts\":%.3f,\"dur\":%.3f,"
+				"\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"task\":\"0x%" PRIxPTR "\","
+				"\"data\":\"0x%" PRIxPTR "\",\"frame\":%u}}",
+				stage_names[e->stage],
+				e->stolen ? "task,stolen" : "task",
+				((double)e->begin_ns - (double)g_trace_t0) /
+					1000.0,
+				(double)(e->end_ns - e->begin_ns) / 1000.0,
+				pool->id, i, (uintptr_t)e->function,
+				(uintptr_t)e->task_data, (unsigned)e->frame);
+		}
+	}
+	mtx_unlock(&g_trace_lock);
+}
 
-	g_texture_caches = calloc(g_num_threads, sizeof(texture_cache_t));
-	if (!g_texture_caches) {
-		LOG_ERROR("Failed to allocate texture caches");
-		free(g_local_queues);
-		free(g_worker_threads);
-		return 0;
+static void trace_close(void)
+{
+	atomic_store_explicit(&g_trace_enabled, false, memory_order_relaxed);
+	mtx_lock(&g_trace_lock);
+	if (g_trace_file) {
+		fputs("\n],\"displayTimeUnit\":\"ns\"}\n", g_trace_file);
+		fclose(g_trace_file);
+		g_trace_file = NULL;
 	}
+	mtx_unlock(&g_trace_lock);
+}
 
-	mtx_init(&g_wakeup_mutex, mtx_plain);
-	cnd_init(&g_wakeup);
-	job_pools_init();
-	for (int i = 0; i < g_num_threads; ++i)
-		texture_cache_init(&g_texture_caches[i]);
-	atomic_init(&g_global_head, 0);
-	atomic_init(&g_global_tail, 0);
-	atomic_init(&g_pending_tasks, 0);
-	atomic_store(&g_shutdown_flag, false);
-	atomic_store(&g_profiling_enabled, false);
+/* Job pools are shared by every thread pool: set up with the first, torn
+ * down with the last. */
+static void pool_register(ThreadPool *pool)
+{
+	call_once(&g_pools_once, pools_lock_init);
+	mtx_lock(&g_pools_lock);
+	if (!g_pools)
+		job_pools_init();
+	pool->id = g_next_pool_id++;
+	if (atomic_load_explicit(&g_trace_enabled, memory_order_relaxed) &&
+	    !trace_alloc(pool))
+		LOG_WARN("Failed to allocate trace rings for pool %d",
+			 pool->id);
+	pool->next = g_pools;
+	g_pools = pool;
+	mtx_unlock(&g_pools_lock);
+}
+
+static void pool_unregister(ThreadPool *pool)
+{
+	mtx_lock(&g_pools_lock);
+	for (ThreadPool **it = &g_pools; *it; it = &(*it)->next) {
+		if (*it == pool) {
+			*it = pool->next;
+			break;
+		}
+	}
+	if (!g_pools) {
+		job_pools_destroy();
+		trace_close();
+	}
+	mtx_unlock(&g_pools_lock);
+}
+
+/* Stop and join the first @p started workers. */
+static void pool_stop(ThreadPool *pool, int started)
+{
+	atomic_store_explicit(&pool->shutdown, true, memory_order_release);
+	mtx_lock(&pool->wakeup_mutex);
+	cnd_broadcast(&pool->wakeup);
+	mtx_unlock(&pool->wakeup_mutex);
+	for (int j = 0; j < started; ++j)
+		thrd_join(pool->workers[j], NULL);
+}
+
+static void pool_free(ThreadPool *pool)
+{
+	cnd_destroy(&pool->wakeup);
+	mtx_destroy(&pool->wakeup_mutex);
+	cnd_destroy(&pool->root.done);
+	mtx_destroy(&pool->root.lock);
+	free_local_queues(pool);
+	free(pool->texture_caches);
+	free(pool->workers);
+	placement_free(pool);
+	trace_free(pool);
+	free(pool->metrics);
+	free(pool);
+}
+
+ThreadPool *thread_pool_create(const thread_pool_config_t *config)
+{
+	thread_pool_config_t cfg = { 0 };
+	if (config)
+		cfg = *config;
+	if (cfg.num_threads <= 0)
+		cfg.num_threads = (int)online_cpus();
+	/* sizeof is a multiple of the 64-byte member alignment. */
+	ThreadPool *pool =
+		aligned_alloc(_Alignof(ThreadPool), sizeof(ThreadPool));
+	if (!pool) {
+		LOG_ERROR("Failed to allocate thread pool");
+		return NULL;
+	}
+	memset(pool, 0, sizeof(*pool));
+	pool->num_threads = cfg.num_threads > 0 ? cfg.num_threads : 1;
+	pool->priority = cfg.priority;
+
+	pool->workers = malloc(sizeof(thrd_t) * pool->num_threads);
+	/* The deques hold 64-byte aligned members, which wide vector stores
+	 * rely on when profile_data is copied. */
+	size_t queues_size = sizeof(task_queue_t) * pool->num_threads;
+	pool->local_queues = aligned_alloc(_Alignof(task_queue_t), queues_size);
+	if (pool->local_queues)
+		memset(pool->local_queues, 0, queues_size);
+	pool->texture_caches = calloc(pool->num_threads + HELPER_SLOTS,
+				      sizeof(texture_cache_t));
+	/* sizeof(slot_metrics_t) is a multiple of its 64-byte alignment. */
+	size_t metrics_size =
+		sizeof(slot_metrics_t) * (pool->num_threads + HELPER_SLOTS);
+	pool->metrics = aligned_alloc(_Alignof(slot_metrics_t), metrics_size);
+	if (!pool->workers || !pool->local_queues || !pool->texture_caches ||
+	    !pool->metrics || !placement_init(pool, cfg.affinity)) {
+		LOG_ERROR("Failed to allocate thread pool state");
+		free(pool->metrics);
+		free(pool->texture_caches);
+		free(pool->local_queues);
+		free(pool->workers);
+		placement_free(pool);
+		free(pool);
+		return NULL;
+	}
+
+	mtx_init(&pool->wakeup_mutex, mtx_plain);
+	cnd_init(&pool->wakeup);
+	for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i)
+		texture_cache_init(&pool->texture_caches[i]);
+	for (int i = 0; i < HELPER_SLOTS; ++i)
+		atomic_init(&pool->helper_busy[i], false);
+	for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i) {
+		slot_metrics_t *m = &pool->metrics[i];
+		for (int s = 0; s < STAGE_COUNT; ++s)
+			atomic_init(&m->tasks[s], 0);
+		atomic_init(&m->steals, 0);
+		atomic_init(&m->parks, 0);
+	}
+	for (int l = 0; l < LANE_COUNT; ++l) {
+		for (size_t i = 0; i < INJECT_QUEUE_SIZE; ++i)
+			atomic_init(&pool->inject[l].cells[i].seq, i);
+		atomic_init(&pool->inject[l].head, 0);
+		atomic_init(&pool->inject[l].tail, 0);
+		atomic_init(&pool->lanes[l].queued, 0);
+	}
+	group_init(&pool->root, pool, 1);
+	atomic_init(&pool->sleeping_workers, 0);
+	atomic_init(&pool->last_arrival_ns, 0);
+	atomic_init(&pool->arrival_gap_ns, 0);
+	atomic_init(&pool->wake_ns, 0);
+	atomic_init(&pool->shutdown, false);
+	/* A spinning worker on a single CPU only delays the producer. */
+	if (!g_spin_set && online_cpus() == 1)
+		atomic_store_explicit(&g_spin_max_ns, 0, memory_order_relaxed);
+	pool_register(pool);
 
 	int started = 0;
-	for (int i = 0; i < g_num_threads; i++) {
-		atomic_init(&g_local_queues[i].head, 0);
-		atomic_init(&g_local_queues[i].tail, 0);
-		int *tid = malloc(sizeof(int));
-		if (!tid) {
+	for (int i = 0; i < pool->num_threads; i++) {
+		for (int l = 0; l < LANE_COUNT; ++l) {
+			task_deque_t *q = &pool->local_queues[i].lanes[l];
+			deque_ring_t *ring = deque_ring_new(LOCAL_QUEUE_SIZE);
+			if (!ring) {
+				LOG_ERROR("Failed to allocate task deque %d",
+					  i);
+				goto fail;
+			}
+			atomic_init(&q->top, 0);
+			atomic_init(&q->bottom, 0);
+			atomic_init(&q->ring, ring);
+		}
+		worker_arg_t *arg = malloc(sizeof(worker_arg_t));
+		if (!arg) {
 			LOG_ERROR("Failed to allocate thread arg %d", i);
 			goto fail;
 		}
-		*tid = i;
-		if (thrd_create(&g_worker_threads[i], worker_thread_main,
-				tid) != thrd_success) {
+		arg->pool = pool;
+		arg->thread_id = i;
+		if (thrd_create(&pool->workers[i], worker_thread_main, arg) !=
+		    thrd_success) {
 			LOG_ERROR("Failed to create worker thread %d", i);
-			free(tid);
+			free(arg);
 			goto fail;
 		}
 		started++;
 	}
-	return g_num_threads;
+	return pool;
 
 fail:
-	atomic_store(&g_shutdown_flag, true);
-	mtx_lock(&g_wakeup_mutex);
-	cnd_broadcast(&g_wakeup);
-	mtx_unlock(&g_wakeup_mutex);
-	for (int j = 0; j < started; ++j)
-		thrd_join(g_worker_threads[j], NULL);
-	cnd_destroy(&g_wakeup);
-	mtx_destroy(&g_wakeup_mutex);
-	free(g_texture_caches);
-	free(g_local_queues);
-	free(g_worker_threads);
-	g_worker_threads = NULL;
-	g_local_queues = NULL;
-	g_texture_caches = NULL;
-	g_num_threads = 0;
-	return 0;
+	pool_stop(pool, started);
+	pool_unregister(pool);
+	pool_free(pool);
+	return NULL;
+}
+
+void thread_pool_destroy(ThreadPool *pool)
+{
+	if (!pool)
+		return;
+	thread_pool_drain(pool);
+	pool_stop(pool, pool->num_threads);
+	trace_write_pool(pool);
+	if (pool == g_default_pool)
+		g_default_pool = NULL;
+	pool_unregister(pool);
+	pool_free(pool);
+}
+
+ThreadPool *thread_pool_default(void)
+{
+	return g_default_pool;
+}
+
+int thread_pool_init(int num_threads)
+{
+	return thread_pool_init_affinity(num_threads, NULL);
+}
+
+int thread_pool_init_affinity(int num_threads, const char *affinity)
+{
+	atomic_store(&g_profiling_enabled, false);
+	g_default_pool = thread_pool_create(&(thread_pool_config_t){
+		.num_threads = num_threads > 0 ? num_threads : 1,
+		.affinity = affinity });
+	return g_default_pool ? g_default_pool->num_threads : 0;
 }
 
 int thread_pool_init_from_env(void)
@@ -380,148 +1382,374 @@ int thread_pool_init_from_env(void)
 		if (*end == '\0' && tmp > 0 && tmp <= 64)
 			val = tmp;
 	}
-	if (val <= 0) {
-#ifdef _WIN32
-		SYSTEM_INFO info;
-		GetSystemInfo(&info);
-		val = info.dwNumberOfProcessors;
-#elif defined(_SC_NPROCESSORS_ONLN)
-		val = sysconf(_SC_NPROCESSORS_ONLN);
-#endif
+	if (val <= 0)
+		val = online_cpus();
+	var = getenv("MICROGLES_SPIN_US");
+	if (var && *var) {
+		char *end;
+		unsigned long us = strtoul(var, &end, 10);
+		if (*end == '\0' && us <= 1000000)
+			thread_pool_set_spin_us((unsigned)us);
 	}
 	if (val <= 1)
 		val = 2;
 	if (val > 64)
 		val = 64;
-	return thread_pool_init((int)val);
+	var = getenv("MICROGLES_LANE_HWM");
+	if (var && *var) {
+		/* fragment,raster,primitive,vertex; empty fields keep the
+		 * default. */
+		static const stage_tag_t lane_stage[LANE_COUNT] = {
+			STAGE_FRAGMENT, STAGE_RASTER, STAGE_PRIMITIVE,
+			STAGE_VERTEX
+		};
+		const char *p = var;
+		for (int l = 0; l < LANE_COUNT && *p; ++l) {
+			char *end;
+			unsigned long hwm = strtoul(p, &end, 10);
+			if (end != p)
+				thread_pool_set_lane_hwm(lane_stage[l],
+							 (unsigned)hwm);
+			if (*end != ',')
+				break;
+			p = end + 1;
+		}
+	}
+	return thread_pool_init_affinity((int)val,
+					 getenv("MICROGLES_AFFINITY"));
 }
 
-void thread_pool_submit(task_function_t func, void *task_data,
-			stage_tag_t stage)
+/* Wake up to @p count sleeping workers. The seq_cst fence pairs with the one
+ * in worker_thread_main so that either the worker sees the new tasks before
+ * parking or we see it in pool->sleeping_workers. */
+static void wake_workers(ThreadPool *pool, size_t count)
 {
-	int thread_id = (tls_tid >= 0) ? tls_tid : 0;
-	task_queue_t *local_queue = &g_local_queues[thread_id];
-	bool profiling = atomic_load_explicit(&g_profiling_enabled,
-					      memory_order_relaxed);
-	uint64_t tail =
-		atomic_load_explicit(&local_queue->tail, memory_order_relaxed);
-	uint64_t head =
-		atomic_load_explicit(&local_queue->head, memory_order_acquire);
-	uint64_t depth;
-	if (tail - head < LOCAL_QUEUE_SIZE) {
-		depth = tail - head;
-		uint64_t slot = tail % LOCAL_QUEUE_SIZE;
-		local_queue->entries[slot] = (task_t){ .function = func,
-						       .task_data = task_data,
-						       .token = tail,
-						       .stage = stage };
-		atomic_store_explicit(&local_queue->tail, tail + 1,
-				      memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&pool->sleeping_workers,
+				 memory_order_relaxed) <= 0)
+		return;
+	mtx_lock(&pool->wakeup_mutex);
+	atomic_store_explicit(&pool->wake_ns, now_ns(), memory_order_relaxed);
+	int sleeping = atomic_load_explicit(&pool->sleeping_workers,
+					    memory_order_relaxed);
+	if (count >= (size_t)sleeping) {
+		cnd_broadcast(&pool->wakeup);
 	} else {
-		uint64_t gh = atomic_load_explicit(&g_global_head,
-						   memory_order_acquire);
-		tail = atomic_load_explicit(&g_global_tail,
+		for (size_t i = 0; i < count; ++i)
+			cnd_signal(&pool->wakeup);
+	}
+	mtx_unlock(&pool->wakeup_mutex);
+}
+
+void thread_pool_set_spin_us(unsigned us)
+{
+	atomic_store_explicit(&g_spin_max_ns, us * 1000u,
+			      memory_order_relaxed);
+	g_spin_set = true;
+}
+
+/* Fold the gap since the previous submission into a 1/8 moving average.
+ * Concurrent updates may lose a sample, which is fine for a heuristic. */
+static void note_arrival(ThreadPool *pool)
+{
+	uint64_t now = now_ns();
+	uint64_t prev = atomic_exchange_explicit(&pool->last_arrival_ns, now,
+						 memory_order_relaxed);
+	if (!prev || now <= prev)
+		return;
+	uint64_t gap = now - prev;
+	uint64_t avg = atomic_load_explicit(&pool->arrival_gap_ns,
 					    memory_order_relaxed);
-		depth = tail - gh;
-		uint64_t slot = tail % MAX_TASKS;
-		g_global_queue[slot] = (task_t){ .function = func,
-						 .task_data = task_data,
-						 .token = tail,
-						 .stage = stage };
-		atomic_store_explicit(&g_global_tail, tail + 1,
-				      memory_order_release);
+	atomic_store_explicit(&pool->arrival_gap_ns,
+			      avg ? avg - avg / 8 + gap / 8 : gap,
+			      memory_order_relaxed);
+}
+
+void thread_pool_set_lane_hwm(stage_tag_t stage, unsigned hwm)
+{
+	if ((unsigned)stage >= STAGE_COUNT)
+		return;
+	atomic_store_explicit(&g_lane_hwm[g_stage_lane[stage]], hwm,
+			      memory_order_relaxed);
+}
+
+/* Lowest lane above @p lane whose backlog exceeds its high-water mark, or
+ * -1 when every downstream lane is within bounds. */
+static int lane_over_hwm(ThreadPool *pool, int lane)
+{
+	for (int d = 0; d < lane; ++d) {
+		unsigned hwm = atomic_load_explicit(&g_lane_hwm[d],
+						    memory_order_relaxed);
+		if (hwm && atomic_load_explicit(&pool->lanes[d].queued,
+						memory_order_relaxed) > hwm)
+			return d;
 	}
-	if (profiling && depth > g_thread_profile.stages[stage].max_queue_depth)
-		g_thread_profile.stages[stage].max_queue_depth = depth;
-	atomic_fetch_add_explicit(&g_pending_tasks, 1, memory_order_release);
-	mtx_lock(&g_wakeup_mutex);
-	cnd_signal(&g_wakeup);
-	mtx_unlock(&g_wakeup_mutex);
+	return -1;
 }
 
-void thread_pool_wait(void)
+/* Before queuing more work in @p lane, run downstream tasks on the calling
+ * thread until those lanes are back under their high-water marks. Producers
+ * that cannot get a helper slot are let through. */
+static void throttle(ThreadPool *pool, int lane)
 {
-	while (atomic_load_explicit(&g_pending_tasks, memory_order_acquire) > 0)
+	if (lane_over_hwm(pool, lane) < 0)
+		return;
+	bool helper = helper_enter(pool);
+	if (tls_pool != pool)
+		return;
+	thread_profile_t before;
+	if (helper)
+		before = g_thread_profile;
+	while (lane_over_hwm(pool, lane) >= 0) {
+		bool profiling = atomic_load_explicit(&g_profiling_enabled,
+						      memory_order_relaxed);
+		task_t task;
+		if (!find_task(pool, tls_tid, lane - 1, &task, profiling))
+			break;
+		run_task(pool, &task, profiling);
+	}
+	if (helper)
+		helper_leave(pool, &before);
+}
+
+bool thread_pool_run_pending(stage_tag_t stage)
+{
+	ThreadPool *pool = tls_pool ? tls_pool : g_default_pool;
+	bool helper = helper_enter(pool);
+	bool ran = false;
+	if (pool && tls_pool == pool) {
+		thread_profile_t before;
+		if (helper)
+			before = g_thread_profile;
+		bool profiling = atomic_load_explicit(&g_profiling_enabled,
+						      memory_order_relaxed);
+		task_t task;
+		if (find_task(pool, tls_tid, g_stage_lane[stage], &task,
+			      profiling)) {
+			run_task(pool, &task, profiling);
+			ran = true;
+		}
+		if (helper)
+			helper_leave(pool, &before);
+	}
+	if (!ran)
 		thrd_yield();
+	return ran;
+}
+
+static void pool_submit(ThreadPool *pool, const task_t *tasks, size_t count)
+{
+	int max_lane = 0;
+	for (size_t i = 0; i < count; ++i)
+		if (g_stage_lane[tasks[i].stage] > max_lane)
+			max_lane = g_stage_lane[tasks[i].stage];
+	throttle(pool, max_lane);
+	note_arrival(pool);
+	bool profiling = atomic_load_explicit(&g_profiling_enabled,
+					      memory_order_relaxed);
+	/* Count the tasks before publishing them so a fast worker cannot
+	 * drive a pending counter below zero. Each task also holds a
+	 * reference on its group until it has been retired. */
+	atomic_fetch_add_explicit(&pool->root.pending, count,
+				  memory_order_seq_cst);
+	for (size_t i = 0; i < count;) {
+		task_group_t *group = tasks[i].group ? tasks[i].group :
+						       tls_group;
+		size_t run = 1;
+		while (i + run < count &&
+		       (tasks[i + run].group ? tasks[i + run].group :
+					       tls_group) == group)
+			run++;
+		if (group) {
+			atomic_fetch_add_explicit(&group->pending, run,
+						  memory_order_seq_cst);
+			atomic_fetch_add_explicit(&group->refs, (int)run,
+						  memory_order_relaxed);
+		}
+		i += run;
+	}
+	bool worker = tls_pool == pool && tls_tid < pool->num_threads;
+	for (size_t i = 0; i < count;) {
+		int lane = g_stage_lane[tasks[i].stage];
+		size_t run = 1;
+		while (i + run < count &&
+		       g_stage_lane[tasks[i + run].stage] == lane)
+			run++;
+		atomic_fetch_add_explicit(&pool->lanes[lane].queued, run,
+					  memory_order_seq_cst);
+		size_t done = 0;
+		if (worker)
+			done = deque_push(
+				&pool->local_queues[tls_tid].lanes[lane],
+				&tasks[i], run, tls_group);
+		/* Non-worker producers (including waiting threads that are
+		 * helping), and workers whose deque could not grow, go
+		 * through the lane's shared injection queue. */
+		while (done < run) {
+			if (inject_push(&pool->inject[lane], &tasks[i + done],
+					tls_group)) {
+				done++;
+				continue;
+			}
+			wake_workers(pool, count);
+			thrd_yield();
+		}
+		i += run;
+	}
+	if (profiling) {
+		for (size_t i = 0; i < count; ++i) {
+			stage_profile_t *sp =
+				&g_thread_profile.stages[tasks[i].stage];
+			int lane = g_stage_lane[tasks[i].stage];
+			uint64_t depth = atomic_load_explicit(
+				&pool->lanes[lane].queued,
+				memory_order_relaxed);
+			if (depth > sp->max_queue_depth)
+				sp->max_queue_depth = depth;
+		}
+	}
+	wake_workers(pool, count);
+}
+
+static ThreadPool *task_pool(const task_t *task)
+{
+	task_group_t *group = task->group ? task->group : tls_group;
+	if (group)
+		return task_group_pool(group);
+	return tls_pool ? tls_pool : g_default_pool;
+}
+
+void thread_pool_submit_batch(const task_t *tasks, size_t count)
+{
+	if (!tasks)
+		return;
+	/* Runs of tasks bound for the same pool go in one submission. */
+	for (size_t i = 0; i < count;) {
+		ThreadPool *pool = task_pool(&tasks[i]);
+		size_t run = 1;
+		while (i + run < count && task_pool(&tasks[i + run]) == pool)
+			run++;
+		if (pool) {
+			pool_submit(pool, &tasks[i], run);
+		} else {
+			/* No pool to run them: execute on the caller. */
+			for (size_t j = i; j < i + run; ++j)
+				tasks[j].function(tasks[j].task_data);
+		}
+		i += run;
+	}
+}
+
+void thread_pool_submit(task_function_t func, void *task_data,
+			stage_tag_t stage)
+{
+	task_t task = { .function = func,
+			.task_data = task_data,
+			.stage = stage,
+			.group = NULL };
+	thread_pool_submit_batch(&task, 1);
+}
+
+void thread_pool_drain(ThreadPool *pool)
+{
+	if (pool)
+		task_group_wait(&pool->root);
+}
+
+void thread_pool_wait(void)
+{
+	thread_pool_drain(g_default_pool);
 }
 
 int thread_pool_wait_timeout(uint32_t ms)
 {
-	struct timespec start;
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	ThreadPool *pool = g_default_pool;
+	if (!pool)
+		return 1;
 #ifdef THREAD_POOL_WAIT_DEBUG
-	bool dumped = false;
-#endif
-	for (;;) {
-		if (atomic_load_explicit(&g_pending_tasks,
-					 memory_order_acquire) == 0)
+	if (ms > THREAD_POOL_WAIT_DEBUG_MS) {
+		if (task_group_wait_timeout(&pool->root,
+					    THREAD_POOL_WAIT_DEBUG_MS))
 			return 1;
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		uint64_t elapsed =
-			(uint64_t)(now.tv_sec - start.tv_sec) * 1000 +
-			(uint64_t)(now.tv_nsec - start.tv_nsec) / 1000000;
-#ifdef THREAD_POOL_WAIT_DEBUG
-		if (!dumped && elapsed >= THREAD_POOL_WAIT_DEBUG_MS) {
-			thread_pool_dump_queues();
-			dumped = true;
-		}
-#endif
-		if (elapsed >= ms)
-			return 0;
-		thrd_yield();
+		thread_pool_dump_queues();
+		ms -= THREAD_POOL_WAIT_DEBUG_MS;
 	}
+#endif
+	return task_group_wait_timeout(&pool->root, ms);
 }
 
 void thread_pool_shutdown(void)
 {
-	thread_pool_wait();
+	ThreadPool *pool = g_default_pool;
+	if (!pool)
+		return;
+	thread_pool_drain(pool);
 	thread_profile_stop();
-	atomic_store_explicit(&g_shutdown_flag, true, memory_order_release);
-	mtx_lock(&g_wakeup_mutex);
-	cnd_broadcast(&g_wakeup);
-	mtx_unlock(&g_wakeup_mutex);
-	for (int i = 0; i < g_num_threads; ++i)
-		thrd_join(g_worker_threads[i], NULL);
+	/* Workers publish their profiles on exit, so report before freeing. */
+	pool_stop(pool, pool->num_threads);
 	thread_profile_report();
-	job_pools_destroy();
-	free(g_worker_threads);
-	free(g_local_queues);
-	free(g_texture_caches);
-	cnd_destroy(&g_wakeup);
-	mtx_destroy(&g_wakeup_mutex);
+	trace_write_pool(pool);
+	g_default_pool = NULL;
+	pool_unregister(pool);
+	pool_free(pool);
+}
+
+bool thread_pool_is_running(const ThreadPool *pool)
+{
+	return pool && pool->num_threads > 0 &&
+	       !atomic_load_explicit(&pool->shutdown, memory_order_acquire);
 }
 
 bool thread_pool_active(void)
 {
-	return g_worker_threads && g_local_queues && g_num_threads > 0 &&
-	       !atomic_load_explicit(&g_shutdown_flag, memory_order_acquire);
+	return thread_pool_is_running(g_default_pool);
 }
 
 void thread_pool_dump_queues(void)
 {
-	uint64_t gh =
-		atomic_load_explicit(&g_global_head, memory_order_relaxed);
-	uint64_t gt =
-		atomic_load_explicit(&g_global_tail, memory_order_relaxed);
-	LOG_DEBUG("Global queue length: %llu", (unsigned long long)(gt - gh));
-	for (int i = 0; i < g_num_threads; ++i) {
-		uint64_t lh = atomic_load_explicit(&g_local_queues[i].head,
-						   memory_order_relaxed);
-		uint64_t lt = atomic_load_explicit(&g_local_queues[i].tail,
-						   memory_order_relaxed);
-		LOG_DEBUG("Thread %d queue length: %llu", i,
-			  (unsigned long long)(lt - lh));
+	ThreadPool *pool = g_default_pool;
+	if (!pool)
+		return;
+	for (int l = 0; l < LANE_COUNT; ++l)
+		LOG_DEBUG("Lane %s: %llu queued, %llu injected (hwm %u)",
+			  lane_names[l],
+			  (unsigned long long)atomic_load_explicit(
+				  &pool->lanes[l].queued, memory_order_relaxed),
+			  (unsigned long long)inject_size(&pool->inject[l]),
+			  atomic_load_explicit(&g_lane_hwm[l],
+					       memory_order_relaxed));
+	for (int i = 0; i < pool->num_threads; ++i) {
+		for (int l = 0; l < LANE_COUNT; ++l) {
+			task_deque_t *q = &pool->local_queues[i].lanes[l];
+			deque_ring_t *ring = atomic_load_explicit(
+				&q->ring, memory_order_relaxed);
+			LOG_DEBUG(
+				"Thread %d %s queue length: %lld (capacity %lld)",
+				i, lane_names[l], (long long)deque_size(q),
+				(long long)ring->mask + 1);
+		}
 	}
 }
 
+/* Profiles of workers followed by those of helper slots. */
+static thread_profile_t *slot_profile(ThreadPool *pool, int i)
+{
+	if (i < pool->num_threads)
+		return &pool->local_queues[i].profile_data;
+	return &pool->helper_profiles[i - pool->num_threads];
+}
+
 void thread_profile_start(void)
 {
 	atomic_store_explicit(&g_profiling_enabled, true, memory_order_release);
 	g_thread_profile = (thread_profile_t){ 0 };
-	for (int i = 0; i < g_num_threads; ++i)
-		memset(&g_local_queues[i].profile_data, 0,
-		       sizeof(thread_profile_t));
+	call_once(&g_pools_once, pools_lock_init);
+	mtx_lock(&g_pools_lock);
+	for (ThreadPool *pool = g_pools; pool; pool = pool->next)
+		for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i)
+			memset(slot_profile(pool, i), 0,
+			       sizeof(thread_profile_t));
+	mtx_unlock(&g_pools_lock);
 	function_profile_reset();
 }
 
@@ -531,17 +1759,21 @@ void thread_profile_stop(void)
 			      memory_order_release);
 }
 
+/* Covers the default pool, which thread_pool_shutdown() reports on. */
 void thread_profile_report(void)
 {
+	ThreadPool *pool = g_default_pool;
+	if (!pool)
+		return;
 	LOG_INFO("Thread Pool Profiling Results:");
 	for (int stage = 0; stage < STAGE_COUNT; stage++) {
 		uint64_t t_tasks = 0, t_steals = 0, t_attempts = 0,
 			 t_contention = 0, t_tiles = 0, t_hits = 0, t_miss = 0;
 		uint64_t t_task_cycles = 0, t_idle_cycles = 0,
 			 t_steal_cycles = 0, t_max_depth = 0, t_max_cycles = 0;
-		for (int i = 0; i < g_num_threads; i++) {
+		for (int i = 0; i < pool->num_threads + HELPER_SLOTS; i++) {
 			stage_profile_t *pd =
-				&g_local_queues[i].profile_data.stages[stage];
+				&slot_profile(pool, i)->stages[stage];
 			t_tasks += pd->task_count;
 			t_steals += pd->steal_successes;
 			t_attempts += pd->steal_attempts;
@@ -584,9 +1816,9 @@ void thread_profile_report(void)
 		 g_tiles = 0, g_hits = 0, g_miss = 0, g_max_depth = 0,
 		 g_max_cycles = 0;
 	for (int stage = 0; stage < STAGE_COUNT; stage++)
-		for (int i = 0; i < g_num_threads; i++) {
+		for (int i = 0; i < pool->num_threads + HELPER_SLOTS; i++) {
 			stage_profile_t *pd =
-				&g_local_queues[i].profile_data.stages[stage];
+				&slot_profile(pool, i)->stages[stage];
 			g_tasks += pd->task_count;
 			g_steals += pd->steal_successes;
 			g_attempts += pd->steal_attempts;
@@ -618,30 +1850,102 @@ void thread_profile_report(void)
 	LOG_INFO("  Total Tile Jobs: %llu", g_tiles);
 	LOG_INFO("  Total Cache Hits: %llu", g_hits);
 	LOG_INFO("  Total Cache Misses: %llu", g_miss);
+	idle_profile_t idle = { 0 };
+	for (int i = 0; i < pool->num_threads; i++) {
+		const idle_profile_t *ip = &slot_profile(pool, i)->idle;
+		idle.spin_wakes += ip->spin_wakes;
+		idle.yield_wakes += ip->yield_wakes;
+		idle.parks += ip->parks;
+		idle.wakeups += ip->wakeups;
+		idle.wake_latency_ns += ip->wake_latency_ns;
+		if (ip->max_wake_latency_ns > idle.max_wake_latency_ns)
+			idle.max_wake_latency_ns = ip->max_wake_latency_ns;
+	}
+	LOG_INFO("Idle Policy:");
+	LOG_INFO("  Spin Budget: %llu ns (max %u ns)",
+		 (unsigned long long)spin_budget_ns(pool),
+		 atomic_load_explicit(&g_spin_max_ns, memory_order_relaxed));
+	LOG_INFO("  Avg Arrival Gap: %llu ns",
+		 (unsigned long long)atomic_load_explicit(
+			 &pool->arrival_gap_ns, memory_order_relaxed));
+	LOG_INFO("  Woken While Spinning: %llu", idle.spin_wakes);
+	LOG_INFO("  Woken While Yielding: %llu", idle.yield_wakes);
+	LOG_INFO("  Parks: %llu", idle.parks);
+	LOG_INFO("  Avg Wake Latency: %llu ns",
+		 idle.wake_latency_ns / (idle.wakeups ? idle.wakeups : 1));
+	LOG_INFO("  Max Wake Latency: %llu ns", idle.max_wake_latency_ns);
 	function_profile_report();
 }
 
+bool thread_pool_metrics_snapshot(const ThreadPool *pool,
+				  struct microgles_metrics *out)
+{
+	if (!out)
+		return false;
+	memset(out, 0, sizeof(*out));
+	if (!pool)
+		return false;
+	out->timestamp_ns = now_ns();
+	out->num_workers = pool->num_threads;
+	out->sleeping_workers = atomic_load_explicit(&pool->sleeping_workers,
+						     memory_order_relaxed);
+	for (int l = 0; l < LANE_COUNT; ++l) {
+		out->lane_queued[l] = atomic_load_explicit(
+			&pool->lanes[l].queued, memory_order_relaxed);
+		out->queued += out->lane_queued[l];
+	}
+	for (int i = 0; i < pool->num_threads + HELPER_SLOTS; ++i) {
+		const slot_metrics_t *m = &pool->metrics[i];
+		uint64_t tasks = 0;
+		for (int s = 0; s < STAGE_COUNT; ++s) {
+			uint64_t n = atomic_load_explicit(&m->tasks[s],
+							  memory_order_relaxed);
+			out->tasks_by_stage[s] += n;
+			tasks += n;
+		}
+		uint64_t steals =
+			atomic_load_explicit(&m->steals, memory_order_relaxed);
+		uint64_t parks =
+			atomic_load_explicit(&m->parks, memory_order_relaxed);
+		out->tasks += tasks;
+		out->steals += steals;
+		out->parks += parks;
+		if (i >= pool->num_threads ||
+		    i >= MICROGLES_METRICS_MAX_WORKERS)
+			continue;
+		out->workers[i].tasks = tasks;
+		out->workers[i].steals = steals;
+		out->workers[i].parks = parks;
+		out->workers[i].queued = queue_size(&pool->local_queues[i]);
+	}
+	return true;
+}
+
+bool microgles_metrics_snapshot(struct microgles_metrics *out)
+{
+	return thread_pool_metrics_snapshot(g_default_pool, out);
+}
+
 void thread_realtime_report(void)
 {
 	static bool header_printed = false;
-	uint64_t gq =
-		atomic_load_explicit(&g_global_tail, memory_order_relaxed) -
-		atomic_load_explicit(&g_global_head, memory_order_relaxed);
+	struct microgles_metrics m;
+	if (!microgles_metrics_snapshot(&m))
+		return;
+	int shown = m.num_workers < MICROGLES_METRICS_MAX_WORKERS ?
+			    m.num_workers :
+			    MICROGLES_METRICS_MAX_WORKERS;
 	if (!header_printed) {
-		printf("%-8s", "GQueue");
-		for (int i = 0; i < g_num_threads; ++i)
-			printf(" LQ%d ", i);
+		printf("%-8s %10s %8s", "Queued", "Tasks", "Steals");
+		for (int i = 0; i < shown; ++i)
+			printf(" LQ%-2d", i);
 		printf("\n");
 		header_printed = true;
 	}
-	printf("%8llu", (unsigned long long)gq);
-	for (int i = 0; i < g_num_threads; ++i) {
-		uint64_t depth = atomic_load_explicit(&g_local_queues[i].tail,
-						      memory_order_relaxed) -
-				 atomic_load_explicit(&g_local_queues[i].head,
-						      memory_order_relaxed);
-		printf(" %4llu", (unsigned long long)depth);
-	}
+	printf("%8llu %10llu %8llu", (unsigned long long)m.queued,
+	       (unsigned long long)m.tasks, (unsigned long long)m.steals);
+	for (int i = 0; i < shown; ++i)
+		printf(" %4llu", (unsigned long long)m.workers[i].queued);
 	printf("\n");
 }
 
@@ -665,9 +1969,10 @@ void thread_profile_cache_miss(void)
 void thread_profile_get_cache_stats(uint64_t *hits, uint64_t *misses)
 {
 	uint64_t h = 0, m = 0;
-	for (int i = 0; i < g_num_threads; ++i) {
+	ThreadPool *pool = g_default_pool;
+	for (int i = 0; pool && i < pool->num_threads + HELPER_SLOTS; ++i) {
 		stage_profile_t *pd =
-			&g_local_queues[i].profile_data.stages[STAGE_FRAGMENT];
+			&slot_profile(pool, i)->stages[STAGE_FRAGMENT];
 		h += pd->cache_hits;
 		m += pd->cache_misses;
 	}
@@ -682,6 +1987,63 @@ bool thread_profile_is_enabled(void)
 	return atomic_load_explicit(&g_profiling_enabled, memory_order_relaxed);
 }
 
+bool thread_trace_start(const char *path)
+{
+	call_once(&g_pools_once, pools_lock_init);
+	mtx_lock(&g_pools_lock);
+	mtx_lock(&g_trace_lock);
+	bool ok = !g_trace_file && path && *path;
+	if (ok)
+		g_trace_file = fopen(path, "w");
+	if (ok && !g_trace_file) {
+		LOG_ERROR("Failed to open trace file %s", path);
+		ok = false;
+	}
+	if (ok) {
+		fputs("{\"traceEvents\":[", g_trace_file);
+		g_trace_empty = true;
+		g_trace_t0 = now_ns();
+	}
+	mtx_unlock(&g_trace_lock);
+	if (ok) {
+		for (ThreadPool *pool = g_pools; pool; pool = pool->next)
+			if (!atomic_load_explicit(&pool->trace,
+						  memory_order_relaxed) &&
+			    !trace_alloc(pool))
+				LOG_WARN("Failed to allocate trace rings for "
+					 "pool %d",
+					 pool->id);
+		atomic_store_explicit(&g_trace_enabled, true,
+				      memory_order_release);
+	}
+	mtx_unlock(&g_pools_lock);
+	return ok;
+}
+
+void thread_trace_stop(void)
+{
+	call_once(&g_pools_once, pools_lock_init);
+	mtx_lock(&g_pools_lock);
+	/* Finish the queued work with tracing still on, then again for tasks
+	 * that started before it was switched off. Tasks record before they
+	 * retire, so once drained no thread writes the rings. */
+	for (ThreadPool *pool = g_pools; pool; pool = pool->next)
+		thread_pool_drain(pool);
+	atomic_store_explicit(&g_trace_enabled, false, memory_order_relaxed);
+	for (ThreadPool *pool = g_pools; pool; pool = pool->next) {
+		thread_pool_drain(pool);
+		trace_write_pool(pool);
+		trace_free(pool);
+	}
+	trace_close();
+	mtx_unlock(&g_pools_lock);
+}
+
+void thread_trace_next_frame(void)
+{
+	atomic_fetch_add_explicit(&g_trace_frame, 1, memory_order_relaxed);
+}
+
 uint64_t thread_get_cycles(void)
 {
 	return get_cycles();
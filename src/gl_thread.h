@@ -6,6 +6,7 @@
  */
 
 #include "portable/c11threads.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "texture_cache.h"
@@ -26,23 +27,168 @@ typedef enum {
 
 typedef void (*task_function_t)(void *task_data);
 
+/*
+ * Completion counter for a set of tasks, typically all work for one
+ * framebuffer. Tasks submitted without a group inherit the group of the task
+ * that submits them, so a draw's vertex, primitive, raster and fragment work
+ * is all counted against the group of the command that started it.
+ */
+typedef struct task_group task_group_t;
+
+/*
+ * A set of worker threads with its own queues and completion counter. The
+ * thread_pool_* functions below that take no pool act on the default pool
+ * set up by thread_pool_init(); extra pools let several renderers share a
+ * process without waiting on each other's work.
+ */
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+	int num_threads; /* <= 0: one per online CPU */
+	const char *affinity; /* see thread_pool_init_affinity() */
+	int priority; /* nice value for the workers, 0 to inherit */
+} thread_pool_config_t;
+
+typedef struct {
+	task_function_t function;
+	void *task_data;
+	stage_tag_t stage;
+	task_group_t *group; /* NULL: inherit from the submitting task */
+} task_t;
+
 int thread_pool_init(int num_threads);
+/*
+ * As thread_pool_init() but pins workers according to @p affinity: a CPU
+ * list such as "0-3,6" or one of "compact", "scatter" and "physical" (see
+ * cpu_affinity_plan()). NULL or "none" leaves placement to the OS.
+ */
+int thread_pool_init_affinity(int num_threads, const char *affinity);
+/* Reads MICROGLES_THREADS, MICROGLES_AFFINITY, MICROGLES_LANE_HWM and
+ * MICROGLES_SPIN_US. */
 int thread_pool_init_from_env(void);
+ThreadPool *thread_pool_create(const thread_pool_config_t *config);
+/* Drains @p pool, then stops and frees it. */
+void thread_pool_destroy(ThreadPool *pool);
+/* The pool behind thread_pool_init(), or NULL before it. */
+ThreadPool *thread_pool_default(void);
+/* Block until every task submitted to @p pool has run. */
+void thread_pool_drain(ThreadPool *pool);
+/* Returns true if @p pool has workers processing tasks. */
+bool thread_pool_is_running(const ThreadPool *pool);
+/*
+ * Tasks go to the pool of their group (or of the group they inherit), else
+ * to the pool of the submitting worker, else to the default pool.
+ */
 void thread_pool_submit(task_function_t func, void *task_data,
 			stage_tag_t stage);
+/*
+ * Publish @p count tasks with a single queue update and wake at most as many
+ * sleeping workers as there are tasks. Preferred over repeated
+ * thread_pool_submit() calls when a producer has several tasks ready.
+ */
+void thread_pool_submit_batch(const task_t *tasks, size_t count);
+/*
+ * Tasks are queued in priority lanes: fragment and framebuffer work first,
+ * then raster, primitive and vertex work, so downstream stages drain before
+ * upstream stages add more. Once a downstream lane holds more than @p hwm
+ * queued tasks, producers of upstream work run downstream tasks themselves
+ * before queuing more. 0 disables the limit. MICROGLES_LANE_HWM sets the
+ * marks as "fragment,raster,primitive,vertex".
+ */
+void thread_pool_set_lane_hwm(stage_tag_t stage, unsigned hwm);
+/*
+ * Run one queued task from @p stage's lane or a downstream lane on the
+ * calling thread. For producers whose job pool is exhausted; yields and
+ * returns false when there was nothing to run.
+ */
+bool thread_pool_run_pending(stage_tag_t stage);
+/*
+ * Idle workers spin with a pause instruction, then yield, then park. The
+ * spin phase lasts twice the recent gap between submissions, capped at
+ * @p us microseconds; 0 parks straight after yielding, trading wake-up
+ * latency for power. Defaults to 50, or 0 on single-CPU systems.
+ */
+void thread_pool_set_spin_us(unsigned us);
+/* Block until every submitted task has run. */
 void thread_pool_wait(void);
 int thread_pool_wait_timeout(uint32_t ms);
+
+/* Creates a group whose tasks run on the default pool. */
+task_group_t *task_group_create(void);
+/* Creates a group whose tasks run on @p pool (NULL: the default pool). */
+task_group_t *task_group_create_on(ThreadPool *pool);
+/* Pool that runs @p group's tasks; NULL if it has none yet. */
+ThreadPool *task_group_pool(const task_group_t *group);
+void task_group_retain(task_group_t *group);
+void task_group_release(task_group_t *group);
+/* Block until all tasks counted against @p group have run. Must not be called
+ * from a pool task. */
+void task_group_wait(task_group_t *group);
+/* As task_group_wait() but gives up after @p ms; returns 1 when idle. */
+int task_group_wait_timeout(task_group_t *group, uint32_t ms);
+/* Number of tasks in @p group that have not finished yet. */
+uint64_t task_group_pending(const task_group_t *group);
 void thread_pool_dump_queues(void);
 void thread_pool_shutdown(void);
 
-/* Returns true if worker threads are processing tasks. */
+/* Returns true if worker threads of the default pool are processing tasks. */
 bool thread_pool_active(void);
 
+/* Workers reported individually by microgles_metrics_snapshot(). */
+#define MICROGLES_METRICS_MAX_WORKERS 64
+
+/*
+ * Live scheduler counters. Counts only grow, so per-second rates come from
+ * the difference between two snapshots; queue depths are instantaneous.
+ */
+struct microgles_metrics {
+	uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+	int num_workers;
+	int sleeping_workers;
+	/* Tasks waiting, indexed fragment, raster, primitive, vertex. */
+	uint64_t lane_queued[4];
+	uint64_t queued;
+	/* Tasks finished by workers and by threads helping while waiting. */
+	uint64_t tasks;
+	uint64_t tasks_by_stage[STAGE_COUNT];
+	uint64_t steals;
+	uint64_t parks;
+	struct {
+		uint64_t tasks;
+		uint64_t steals;
+		uint64_t parks;
+		uint64_t queued; /* in this worker's deques */
+	} workers[MICROGLES_METRICS_MAX_WORKERS];
+};
+
+/*
+ * Fill @p out from the default pool without pausing it. Works whether or
+ * not profiling is enabled; returns false if there is no pool.
+ */
+bool microgles_metrics_snapshot(struct microgles_metrics *out);
+/* As microgles_metrics_snapshot() for @p pool. */
+bool thread_pool_metrics_snapshot(const ThreadPool *pool,
+				  struct microgles_metrics *out);
+
 void thread_profile_start(void);
 void thread_profile_stop(void);
 void thread_profile_report(void);
+/* Print one line of queue depths and task counts from a metrics snapshot. */
 void thread_realtime_report(void);
 bool thread_profile_is_enabled(void);
+/*
+ * Record when and where every task runs and write the timeline to @p path
+ * as Chrome trace-event JSON (chrome://tracing or ui.perfetto.dev) when the
+ * pools shut down or thread_trace_stop() is called. Each worker and helper
+ * slot keeps only its most recent 32768 tasks, so long runs stay cheap.
+ * Returns false if a trace is already open or @p path cannot be created.
+ */
+bool thread_trace_start(const char *path);
+/* Drain every pool, write the recorded tasks and close the trace file. */
+void thread_trace_stop(void);
+/* Advance the frame number stamped on traced tasks. glClear() calls this
+ * for every colour clear. */
+void thread_trace_next_frame(void);
 uint64_t thread_get_cycles(void);
 uint64_t thread_cycles_to_us(uint64_t cycles);
 
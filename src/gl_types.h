@@ -8,6 +8,7 @@
 #include <GLES/gl.h>
 #include <stdatomic.h>
 #include <stdalign.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,12 +25,22 @@ typedef struct {
 _Static_assert(sizeof(Vertex) == 64, "Vertex size must be 64 bytes");
 _Static_assert(alignof(Vertex) >= 16, "Vertex must be 16-byte aligned");
 
+/* Post-transform vertex passed from geometry to rasterization: window
+ * x/y, NDC depth, 1/w for perspective correction, color packed like the
+ * framebuffer (AARRGGBB) and texture unit 0's s/t. Half a Vertex. */
 typedef struct {
-	alignas(16) Vertex v0, v1, v2;
-} Triangle;
-_Static_assert(sizeof(Triangle) == sizeof(Vertex) * 3,
-	       "Triangle size mismatch");
-_Static_assert(alignof(Triangle) >= 16, "Triangle must be 16-byte aligned");
+	alignas(16) GLfloat x;
+	GLfloat y, z, inv_w;
+	GLfloat s, t;
+	uint32_t color;
+	uint32_t pad;
+} RasterVertex;
+_Static_assert(sizeof(RasterVertex) == 32, "RasterVertex must be 32 bytes");
+
+typedef struct {
+	RasterVertex v0, v1, v2;
+} RasterTriangle;
+_Static_assert(sizeof(RasterTriangle) == 96, "RasterTriangle size mismatch");
 
 typedef struct {
 	alignas(16) uint32_t x;
@@ -727,6 +727,24 @@ void mat4_transform_vec4(const mat4 *restrict mat, const GLfloat in[restrict 4],
 		 mat->data[11] * in[2] + mat->data[15] * in[3];
 }
 
+/**
+ * @brief Classifies a matrix by the cheapest transform that reproduces it.
+ */
+mat4_class mat4_classify(const mat4 *restrict mat)
+{
+	const GLfloat *m = mat->data;
+	if (m[3] != 0.0f || m[7] != 0.0f || m[11] != 0.0f || m[15] != 1.0f)
+		return MAT4_PERSPECTIVE;
+	if (m[1] != 0.0f || m[2] != 0.0f || m[4] != 0.0f || m[6] != 0.0f ||
+	    m[8] != 0.0f || m[9] != 0.0f)
+		return MAT4_AFFINE;
+	if (m[0] != 1.0f || m[5] != 1.0f || m[10] != 1.0f)
+		return MAT4_ORTHO;
+	if (m[12] != 0.0f || m[13] != 0.0f || m[14] != 0.0f)
+		return MAT4_TRANSLATE;
+	return MAT4_IDENTITY;
+}
+
 /* ---------------------- */
 /* Unit Testing (Optional) */
 /* ---------------------- */
@@ -37,6 +37,17 @@ typedef struct {
 	GLfloat z;
 } Quaternion;
 
+/* How much of a general 4x4 transform a matrix needs, cheapest first. Each
+ * class contains the ones before it, so the class of a product is the
+ * larger of its factors' classes. */
+typedef enum {
+	MAT4_IDENTITY,
+	MAT4_TRANSLATE, /* identity upper 3x3 */
+	MAT4_ORTHO, /* axis-aligned scale and translation */
+	MAT4_AFFINE, /* bottom row 0 0 0 1 */
+	MAT4_PERSPECTIVE, /* anything else */
+} mat4_class;
+
 /* Compile-time checks */
 static_assert(sizeof(mat4) == sizeof(GLfloat) * 16, "mat4 must be 16 floats");
 static_assert(alignof(mat4) >= 16, "mat4 must be 16-byte aligned");
@@ -94,6 +105,13 @@ void mat4_orthographic(mat4 *restrict mat, GLfloat left, GLfloat right,
 void mat4_perspective_divide(mat4 *restrict mat);
 void mat4_transform_vec4(const mat4 *restrict mat, const GLfloat in[restrict 4],
 			 GLfloat out[restrict 4]);
+/* Smallest class that describes @p mat exactly. */
+mat4_class mat4_classify(const mat4 *restrict mat);
+
+static inline mat4_class mat4_class_product(mat4_class a, mat4_class b)
+{
+	return a > b ? a : b;
+}
 
 /* Quaternion Utility Functions */
 void quat_normalize(Quaternion *restrict q);
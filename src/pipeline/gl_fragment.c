@@ -112,6 +112,15 @@ static void update_state(void)
 void pipeline_shade_fragment(Fragment *frag, Framebuffer *fb)
 {
 	update_state();
+	RenderContext *ctx = GetCurrentContext();
+	/* Without an alpha test nothing after texturing can discard the
+	 * fragment, so depth and stencil run first and hidden fragments skip
+	 * texturing, fog and blending. Alpha-tested fragments keep the late
+	 * test: a discarded fragment must not touch depth or stencil. */
+	const bool early_z = !ctx->alpha_test.enabled;
+	if (early_z &&
+	    !framebuffer_depth_stencil_test(fb, frag->x, frag->y, frag->depth))
+		return;
 	TextureOES *tex = context_find_texture(local_tex[0].bound_texture);
 	texture_cache_t *cache = thread_get_texture_cache();
 	if (tex && tex->levels[0]) {
@@ -219,8 +228,7 @@ void pipeline_shade_fragment(Fragment *frag, Framebuffer *fb)
 		frag->color = (frag->color & 0xFF000000u) |
 			      ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
 	}
-	RenderContext *ctx = GetCurrentContext();
-	if (ctx->alpha_test.enabled) {
+	if (!early_z) {
 		float alpha = ((frag->color >> 24) & 0xFF) / 255.0f;
 		float ref = local_alpha.ref;
 		bool pass = false;
@@ -283,7 +291,11 @@ void pipeline_shade_fragment(Fragment *frag, Framebuffer *fb)
 			      ((uint32_t)(out[1] * 255.0f) << 8) |
 			      (uint32_t)(out[2] * 255.0f);
 	}
-	framebuffer_set_pixel(fb, frag->x, frag->y, frag->color, frag->depth);
+	if (early_z)
+		framebuffer_write_color(fb, frag->x, frag->y, frag->color);
+	else
+		framebuffer_set_pixel(fb, frag->x, frag->y, frag->color,
+				      frag->depth);
 }
 
 void process_fragment_job(void *task_data)
@@ -294,34 +306,124 @@ void process_fragment_job(void *task_data)
 	MT_FREE(job, STAGE_FRAGMENT);
 }
 
+static void shade_rect(const FragmentTileJob *job, Framebuffer *fb,
+		       uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	for (uint32_t y = y0; y <= y1; ++y) {
+		for (uint32_t x = x0; x <= x1; ++x) {
+			Fragment frag = {
+				.x = x,
+				.y = y,
+				.color = job->color,
+				.depth = job->depth,
+			};
+			pipeline_shade_fragment(&frag, fb);
+		}
+	}
+}
+
+/* Shade the pixels of [x0, x1] x [y0, y1] inside the job's edges, stepping
+ * the edge functions incrementally along each row. */
+static void shade_rect_edges(const FragmentTileJob *job, Framebuffer *fb,
+			     uint32_t x0, uint32_t y0, uint32_t x1,
+			     uint32_t y1)
+{
+	const RasterEdges *e = &job->edges;
+	int64_t row[3];
+	for (int k = 0; k < 3; ++k)
+		row[k] = e->c[k] + e->a[k] * x0 + e->b[k] * y0;
+	for (uint32_t y = y0; y <= y1; ++y) {
+		int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+		for (uint32_t x = x0; x <= x1; ++x) {
+			if ((e0 | e1 | e2) >= 0) {
+				Fragment frag = {
+					.x = x,
+					.y = y,
+					.color = job->color,
+					.depth = job->depth,
+				};
+				pipeline_shade_fragment(&frag, fb);
+			}
+			e0 += e->a[0];
+			e1 += e->a[1];
+			e2 += e->a[2];
+		}
+		for (int k = 0; k < 3; ++k)
+			row[k] += e->b[k];
+	}
+}
+
+/* Walk a job in RASTER_BLOCK_SIZE blocks aligned to its tile: blocks
+ * outside an edge or whose depth bounds fail @p zfunc are skipped, blocks
+ * inside all three edges are shaded without edge tests, and only the rest
+ * test each pixel. */
+static void shade_blocks(const FragmentTileJob *job, Framebuffer *fb,
+			 const FramebufferTile *tile, GLenum zfunc)
+{
+	const uint32_t bs = RASTER_BLOCK_SIZE;
+	for (uint32_t by = job->y0 - (job->y0 - tile->y0) % bs; by <= job->y1;
+	     by += bs) {
+		uint32_t y0 = by > job->y0 ? by : job->y0;
+		uint32_t y1 = by + bs - 1 < job->y1 ? by + bs - 1 : job->y1;
+		for (uint32_t bx = job->x0 - (job->x0 - tile->x0) % bs;
+		     bx <= job->x1; bx += bs) {
+			uint32_t x0 = bx > job->x0 ? bx : job->x0;
+			uint32_t x1 = bx + bs - 1 < job->x1 ? bx + bs - 1 :
+							      job->x1;
+			const float *z = framebuffer_block_depth(fb, tile, bx,
+								 by);
+			if (zfunc != GL_ALWAYS &&
+			    raster_depth_rejects(zfunc, job->depth, job->depth,
+						 z[0], z[1]))
+				continue;
+			int coverage = job->coverage;
+			if (coverage == RASTER_PARTIAL)
+				coverage = raster_classify_rect(
+					&job->edges, x0, y0, x1, y1);
+			switch (coverage) {
+			case RASTER_INSIDE:
+				shade_rect(job, fb, x0, y0, x1, y1);
+				break;
+			case RASTER_PARTIAL:
+				shade_rect_edges(job, fb, x0, y0, x1, y1);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* Shade @p job in @p tile; covered jobs only go block by block when the
+ * depth bounds may reject some of their blocks. */
+static void shade_job(const FragmentTileJob *job, Framebuffer *fb,
+		      const FramebufferTile *tile, GLenum zfunc)
+{
+	if (job->coverage == RASTER_PARTIAL || zfunc != GL_ALWAYS)
+		shade_blocks(job, fb, tile, zfunc);
+	else
+		shade_rect(job, fb, job->x0, job->y0, job->x1, job->y1);
+}
+
+/* Keep the tile's depth bounds current after shading [x0, x1] x [y0, y1];
+ * depths only change under the depth test. */
+static void update_depth_bounds(Framebuffer *fb, FramebufferTile *tile,
+				uint32_t x0, uint32_t y0, uint32_t x1,
+				uint32_t y1)
+{
+	const RenderContext *ctx = GetCurrentContext();
+	if (ctx && ctx->depth_test_enabled)
+		framebuffer_update_hiz(fb, tile, x0, y0, x1, y1);
+}
+
 void process_fragment_tile_job(void *task_data)
 {
+	/* Fragment plugins take a FragmentJob, so tile jobs skip them. */
 	FragmentTileJob *job = (FragmentTileJob *)task_data;
-	plugin_invoke(STAGE_FRAGMENT, job);
 	LOG_DEBUG("Fragment tile (%u,%u)-(%u,%u) mode=%s", job->x0, job->y0,
 		  job->x1, job->y1, job->sprite_mode ? "sprite" : "triangle");
-	uint32_t w = job->x1 - job->x0 + 1;
-	uint32_t h = job->y1 - job->y0 + 1;
-
 	Framebuffer *fb = job->fb;
-	uint32_t tile_x = job->x0 / fb->tile_size;
-	uint32_t tile_y = job->y0 / fb->tile_size;
-	FramebufferTile *tile = &fb->tiles[tile_y * fb->tiles_x + tile_x];
-	while (atomic_flag_test_and_set(&tile->lock))
-		thrd_yield();
-	tile->x0 = job->x0;
-	tile->y0 = job->y0;
-
-	for (uint32_t row = 0; row < h; ++row) {
-		size_t idx = (size_t)(job->y0 + row) * fb->width + job->x0;
-		memcpy(&tile->color[row * fb->tile_size],
-		       &fb->color_buffer[idx], w * sizeof(uint32_t));
-		memcpy(&tile->depth[row * fb->tile_size],
-		       &fb->depth_buffer[idx], w * sizeof(float));
-		memcpy(&tile->stencil[row * fb->tile_size],
-		       &fb->stencil_buffer[idx], w * sizeof(uint8_t));
-	}
-
+	FramebufferTile *tile = framebuffer_lock_tile(fb, job->x0, job->y0);
 	framebuffer_enter_tile(tile);
 
 	GLboolean prev_mode = tl_sprite_mode;
@@ -335,17 +437,7 @@ void process_fragment_tile_job(void *task_data)
 		tl_sprite_size = job->sprite_size;
 	}
 
-	for (uint32_t row = 0; row < h; ++row) {
-		for (uint32_t col = 0; col < w; ++col) {
-			Fragment frag = {
-				.x = job->x0 + col,
-				.y = job->y0 + row,
-				.color = job->color,
-				.depth = job->depth,
-			};
-			pipeline_shade_fragment(&frag, fb);
-		}
-	}
+	shade_job(job, fb, tile, raster_hiz_func());
 
 	if (job->sprite_mode) {
 		tl_sprite_mode = prev_mode;
@@ -355,17 +447,57 @@ void process_fragment_tile_job(void *task_data)
 	}
 
 	framebuffer_leave_tile();
-	for (uint32_t row = 0; row < h; ++row) {
-		size_t idx = (size_t)(job->y0 + row) * fb->width + job->x0;
-		memcpy(&fb->color_buffer[idx],
-		       &tile->color[row * fb->tile_size], w * sizeof(uint32_t));
-		memcpy(&fb->depth_buffer[idx],
-		       &tile->depth[row * fb->tile_size], w * sizeof(float));
-		memcpy(&fb->stencil_buffer[idx],
-		       &tile->stencil[row * fb->tile_size],
-		       w * sizeof(uint8_t));
-	}
-	atomic_flag_clear(&tile->lock);
+	update_depth_bounds(fb, tile, job->x0, job->y0, job->x1, job->y1);
+	framebuffer_unlock_tile(tile);
 	framebuffer_release(job->fb);
 	tile_job_release(job);
 }
+
+/* Shade a whole tile's binned triangles in one pass under a single lock of
+ * the tile, however many triangles touch it. */
+void process_fragment_bin_job(void *task_data)
+{
+	RasterBin *bin = (RasterBin *)task_data;
+	const RasterBins *bins = bin->bins;
+	Framebuffer *fb = bins->fb;
+	uint32_t x0 = bin->tile % fb->tiles_x * fb->tile_size;
+	uint32_t y0 = bin->tile / fb->tiles_x * fb->tile_size;
+	uint32_t x1 = x0 + fb->tile_size - 1 < fb->width - 1 ?
+			      x0 + fb->tile_size - 1 :
+			      fb->width - 1;
+	uint32_t y1 = y0 + fb->tile_size - 1 < fb->height - 1 ?
+			      y0 + fb->tile_size - 1 :
+			      fb->height - 1;
+	LOG_DEBUG("Fragment bin (%u,%u)-(%u,%u) %u triangles", x0, y0, x1, y1,
+		  bin->count);
+	FramebufferTile *tile = framebuffer_lock_tile(fb, x0, y0);
+	framebuffer_enter_tile(tile);
+	const GLenum zfunc = raster_hiz_func();
+	const RasterBinChunk *chunk = NULL;
+	uint32_t next = bin->head;
+	for (uint32_t i = 0; i < bin->count; ++i) {
+		uint32_t slot = i % RASTER_BIN_CHUNK_REFS;
+		if (!slot) {
+			chunk = &bins->chunks[next - 1];
+			next = chunk->next;
+		}
+		uint32_t ref = chunk->refs[slot];
+		const BinnedTriangle *t = &bins->tris[RASTER_BIN_TRIANGLE(ref)];
+		FragmentTileJob job = {
+			.x0 = t->x0 > x0 ? t->x0 : x0,
+			.y0 = t->y0 > y0 ? t->y0 : y0,
+			.x1 = t->x1 < x1 ? t->x1 : x1,
+			.y1 = t->y1 < y1 ? t->y1 : y1,
+			.color = t->color,
+			.depth = t->depth,
+			.fb = fb,
+			.coverage = (uint8_t)RASTER_BIN_COVERAGE(ref),
+			.edges = t->edges,
+		};
+		shade_job(&job, fb, tile, zfunc);
+	}
+	framebuffer_leave_tile();
+	update_depth_bounds(fb, tile, x0, y0, x1, y1);
+	framebuffer_unlock_tile(tile);
+	raster_bin_done(bin);
+}
@@ -7,6 +7,7 @@
 #include "gl_context.h"
 #include <GLES/gl.h>
 #include <GLES/glext.h>
+#include <math.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -113,6 +114,123 @@ static inline void refresh_depth_stencil(void)
 	}
 }
 
+// Whether (x, y) lies in the tile the calling thread is rendering, whose
+// copy then holds the pixel's current values.
+static inline bool in_current_tile(const Framebuffer *fb, uint32_t x,
+				   uint32_t y)
+{
+	return tls_tile && x >= tls_tile->x0 &&
+	       x < tls_tile->x0 + fb->tile_size && y >= tls_tile->y0 &&
+	       y < tls_tile->y0 + fb->tile_size;
+}
+
+static inline FramebufferTile *tile_at(const Framebuffer *fb, uint32_t x,
+				       uint32_t y)
+{
+	return &fb->tiles[(y / fb->tile_size) * fb->tiles_x +
+			  x / fb->tile_size];
+}
+
+// Width and height of the part of @p tile inside the framebuffer.
+static inline void tile_extent(const Framebuffer *fb,
+			       const FramebufferTile *tile, uint32_t *w,
+			       uint32_t *h)
+{
+	*w = fb->width - tile->x0 < fb->tile_size ? fb->width - tile->x0 :
+						     fb->tile_size;
+	*h = fb->height - tile->y0 < fb->tile_size ? fb->height - tile->y0 :
+						      fb->tile_size;
+}
+
+static inline void tile_lock(FramebufferTile *tile)
+{
+	while (atomic_flag_test_and_set_explicit(&tile->lock,
+						 memory_order_acquire))
+		thrd_yield();
+}
+
+static inline void tile_unlock(FramebufferTile *tile)
+{
+	atomic_flag_clear_explicit(&tile->lock, memory_order_release);
+}
+
+static inline size_t hiz_size(const Framebuffer *fb)
+{
+	return (size_t)fb->tiles_x * fb->tiles_y * fb->hiz_blocks *
+	       fb->hiz_blocks * 2 * sizeof(float);
+}
+
+// Sets the depth bounds of @p tile and of all its blocks.
+static void hiz_fill(const Framebuffer *fb, FramebufferTile *tile, float lo,
+		     float hi)
+{
+	size_t blocks = (size_t)fb->hiz_blocks * fb->hiz_blocks;
+	for (size_t i = 0; i < blocks; ++i) {
+		tile->block_z[2 * i] = lo;
+		tile->block_z[2 * i + 1] = hi;
+	}
+	atomic_store_explicit(&tile->zmin, lo, memory_order_relaxed);
+	atomic_store_explicit(&tile->zmax, hi, memory_order_relaxed);
+}
+
+// Fills @p w x @p h pixels of the given buffers, @p stride apart per row.
+static void fill_values(_Atomic uint32_t *color, _Atomic float *depth,
+			_Atomic uint8_t *stencil, size_t stride, uint32_t w,
+			uint32_t h, uint32_t c, float d, uint8_t st)
+{
+	for (uint32_t row = 0; row < h; ++row) {
+		uint32_t *cr = (uint32_t *)color + row * stride;
+		float *dr = (float *)depth + row * stride;
+		for (uint32_t x = 0; x < w; ++x) {
+			cr[x] = c;
+			dr[x] = d;
+		}
+		memset((uint8_t *)stencil + row * stride, st, w);
+	}
+}
+
+// Writes a locked tile's pixels to the linear buffers and leaves it there.
+static void tile_write_back(const Framebuffer *fb, FramebufferTile *tile)
+{
+	FramebufferTileState state = atomic_load(&tile->state);
+	if (state == FB_TILE_LINEAR)
+		return;
+	uint32_t w, h;
+	tile_extent(fb, tile, &w, &h);
+	size_t idx = (size_t)tile->y0 * fb->width + tile->x0;
+	if (state == FB_TILE_CLEARED) {
+		fill_values(&fb->color_buffer[idx], &fb->depth_buffer[idx],
+			    &fb->stencil_buffer[idx], fb->width, w, h,
+			    tile->clear_color, tile->clear_depth,
+			    tile->clear_stencil);
+	} else {
+		for (uint32_t row = 0; row < h; ++row) {
+			size_t src = (size_t)row * fb->tile_size;
+			size_t dst = idx + (size_t)row * fb->width;
+			memcpy((void *)&fb->color_buffer[dst],
+			       (void *)&tile->color[src], w * sizeof(uint32_t));
+			memcpy((void *)&fb->depth_buffer[dst],
+			       (void *)&tile->depth[src], w * sizeof(float));
+			memcpy((void *)&fb->stencil_buffer[dst],
+			       (void *)&tile->stencil[src], w);
+		}
+	}
+	/* Direct writes to the linear buffers would not update the bounds. */
+	hiz_fill(fb, tile, -INFINITY, INFINITY);
+	atomic_store(&tile->state, FB_TILE_LINEAR);
+}
+
+// Makes the linear buffers current for @p tile's pixels.
+static void tile_resolve(const Framebuffer *fb, FramebufferTile *tile)
+{
+	if (atomic_load_explicit(&tile->state, memory_order_acquire) ==
+	    FB_TILE_LINEAR)
+		return;
+	tile_lock(tile);
+	tile_write_back(fb, tile);
+	tile_unlock(tile);
+}
+
 // Creates a framebuffer with the specified dimensions.
 Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 {
@@ -136,6 +254,15 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 	fb->height = height;
 	fb->color_spec = g_env_color_spec;
 	atomic_init(&fb->ref_count, 1);
+	atomic_init(&fb->depth_raised, false);
+	RenderContext *ctx = GetCurrentContext();
+	fb->tasks = task_group_create_on(ctx ? ctx->thread_pool : NULL);
+	if (!fb->tasks) {
+		LOG_ERROR("framebuffer_create: Failed to allocate task group");
+		tracked_free(fb, sizeof(Framebuffer));
+		pthread_mutex_unlock(&fb_mutex);
+		return NULL;
+	}
 	size_t pixels = (size_t)width * height;
 
 	fb->color_buffer = (_Atomic uint32_t *)tracked_aligned_alloc(
@@ -159,6 +286,7 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 			tracked_free(fb->stencil_buffer,
 				     pixels * sizeof(_Atomic uint8_t));
 		}
+		task_group_release(fb->tasks);
 		tracked_free(fb, sizeof(Framebuffer));
 		pthread_mutex_unlock(&fb_mutex);
 		return NULL;
@@ -172,13 +300,22 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 	size_t tile_count = (size_t)fb->tiles_x * fb->tiles_y;
 	fb->tiles = (FramebufferTile *)tracked_malloc(tile_count *
 						      sizeof(FramebufferTile));
-	if (!fb->tiles) {
+	fb->hiz_blocks =
+		(fb->tile_size + FB_HIZ_BLOCK_SIZE - 1) / FB_HIZ_BLOCK_SIZE;
+	fb->hiz = (float *)tracked_malloc(hiz_size(fb));
+	if (!fb->tiles || !fb->hiz) {
 		LOG_ERROR("framebuffer_create: Failed to allocate tiles");
+		if (fb->tiles)
+			tracked_free(fb->tiles,
+				     tile_count * sizeof(FramebufferTile));
+		if (fb->hiz)
+			tracked_free(fb->hiz, hiz_size(fb));
 		tracked_free(fb->color_buffer,
 			     pixels * sizeof(_Atomic uint32_t));
 		tracked_free(fb->depth_buffer, pixels * sizeof(_Atomic float));
 		tracked_free(fb->stencil_buffer,
 			     pixels * sizeof(_Atomic uint8_t));
+		task_group_release(fb->tasks);
 		tracked_free(fb, sizeof(Framebuffer));
 		pthread_mutex_unlock(&fb_mutex);
 		return NULL;
@@ -219,17 +356,23 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 			}
 			tracked_free(fb->tiles,
 				     tile_count * sizeof(FramebufferTile));
+			tracked_free(fb->hiz, hiz_size(fb));
 			tracked_free(fb->color_buffer,
 				     pixels * sizeof(_Atomic uint32_t));
 			tracked_free(fb->depth_buffer,
 				     pixels * sizeof(_Atomic float));
 			tracked_free(fb->stencil_buffer,
 				     pixels * sizeof(_Atomic uint8_t));
+			task_group_release(fb->tasks);
 			tracked_free(fb, sizeof(Framebuffer));
 			pthread_mutex_unlock(&fb_mutex);
 			return NULL;
 		}
 		atomic_flag_clear(&fb->tiles[i].lock);
+		atomic_init(&fb->tiles[i].state, FB_TILE_LINEAR);
+		fb->tiles[i].block_z = fb->hiz + i * fb->hiz_blocks *
+							 fb->hiz_blocks * 2;
+		hiz_fill(fb, &fb->tiles[i], -INFINITY, INFINITY);
 		memset(fb->tiles[i].color, 0,
 		       fb->tile_size * fb->tile_size * sizeof(uint32_t));
 		memset(fb->tiles[i].depth, 0,
@@ -238,7 +381,9 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height)
 		       fb->tile_size * fb->tile_size * sizeof(uint8_t));
 	}
 
-	framebuffer_clear(fb, 0, 1.0f, 0);
+	/* Start out linear so callers may write the buffers directly. */
+	fill_values(fb->color_buffer, fb->depth_buffer, fb->stencil_buffer,
+		    width, width, height, encode_color(fb, 0), 1.0f, 0);
 	LOG_INFO("Created framebuffer %ux%u with %zu tiles", width, height,
 		 tile_count);
 	pthread_mutex_unlock(&fb_mutex);
@@ -291,6 +436,10 @@ static void framebuffer_free(Framebuffer *fb)
 		}
 		tracked_free(fb->tiles, tile_count * sizeof(FramebufferTile));
 	}
+	if (fb->hiz) {
+		tracked_free(fb->hiz, hiz_size(fb));
+	}
+	task_group_release(fb->tasks);
 	tracked_free(fb, sizeof(Framebuffer));
 }
 
@@ -308,20 +457,47 @@ void framebuffer_release(Framebuffer *fb)
 	}
 }
 
-// Destroys the framebuffer, ensuring thread pool tasks are completed.
-void framebuffer_destroy(Framebuffer *fb)
+// Flushes recorded work and waits for this framebuffer's tasks only.
+void framebuffer_wait(Framebuffer *fb)
 {
 	if (!fb) {
 		return;
 	}
-	if (thread_pool_active()) {
+	if (thread_pool_is_running(task_group_pool(fb->tasks))) {
 		command_buffer_flush();
-		thread_pool_wait();
+		task_group_wait(fb->tasks);
+	}
+	/* Nothing is queued any more: the tile depth bounds are exact. */
+	atomic_store_explicit(&fb->depth_raised, false, memory_order_relaxed);
+}
+
+// Moves the framebuffer's future work to another thread pool.
+bool framebuffer_set_thread_pool(Framebuffer *fb, ThreadPool *pool)
+{
+	if (!fb) {
+		return false;
 	}
+	framebuffer_wait(fb);
+	task_group_t *tasks = task_group_create_on(pool);
+	if (!tasks) {
+		return false;
+	}
+	task_group_release(fb->tasks);
+	fb->tasks = tasks;
+	return true;
+}
+
+// Destroys the framebuffer, ensuring its thread pool tasks are completed.
+void framebuffer_destroy(Framebuffer *fb)
+{
+	if (!fb) {
+		return;
+	}
+	framebuffer_wait(fb);
 	framebuffer_release(fb);
 }
 
-// Clears the framebuffer with specified color, depth, and stencil values.
+// Records the clear values on every tile; the pixels are filled lazily.
 void framebuffer_clear(Framebuffer *restrict fb, uint32_t clear_color,
 		       float clear_depth, uint8_t clear_stencil)
 {
@@ -330,29 +506,17 @@ void framebuffer_clear(Framebuffer *restrict fb, uint32_t clear_color,
 		return;
 	}
 
-	size_t pixels = (size_t)fb->width * fb->height;
 	uint32_t enc = encode_color(fb, clear_color);
-	// Use memset for faster clearing where possible
-	if (enc == 0) {
-		memset(fb->color_buffer, 0, pixels * sizeof(_Atomic uint32_t));
-	} else {
-		for (size_t i = 0; i < pixels; ++i) {
-			atomic_store(&fb->color_buffer[i], enc);
-		}
-	}
-	if (clear_depth == 0.0f) {
-		memset(fb->depth_buffer, 0, pixels * sizeof(_Atomic float));
-	} else {
-		for (size_t i = 0; i < pixels; ++i) {
-			atomic_store(&fb->depth_buffer[i], clear_depth);
-		}
-	}
-	if (clear_stencil == 0) {
-		memset(fb->stencil_buffer, 0, pixels * sizeof(_Atomic uint8_t));
-	} else {
-		for (size_t i = 0; i < pixels; ++i) {
-			atomic_store(&fb->stencil_buffer[i], clear_stencil);
-		}
+	size_t tile_count = (size_t)fb->tiles_x * fb->tiles_y;
+	for (size_t i = 0; i < tile_count; ++i) {
+		FramebufferTile *tile = &fb->tiles[i];
+		tile_lock(tile);
+		tile->clear_color = enc;
+		tile->clear_depth = clear_depth;
+		tile->clear_stencil = clear_stencil;
+		hiz_fill(fb, tile, clear_depth, clear_depth);
+		atomic_store(&tile->state, FB_TILE_CLEARED);
+		tile_unlock(tile);
 	}
 }
 
@@ -389,7 +553,7 @@ void framebuffer_clear_async(Framebuffer *fb, uint32_t clear_color,
 		LOG_ERROR("framebuffer_clear_async: NULL framebuffer");
 		return;
 	}
-	if (!thread_pool_active()) {
+	if (!thread_pool_is_running(task_group_pool(fb->tasks))) {
 		framebuffer_clear(fb, clear_color, clear_depth, clear_stencil);
 		return;
 	}
@@ -407,36 +571,45 @@ void framebuffer_clear_async(Framebuffer *fb, uint32_t clear_color,
 	task->color = clear_color;
 	task->depth = clear_depth;
 	task->stencil = clear_stencil;
-	command_buffer_record_task(clear_task_func, task, STAGE_FRAMEBUFFER);
+	command_buffer_record_task_group(clear_task_func, task,
+					 STAGE_FRAMEBUFFER, fb->tasks);
 	LOG_DEBUG("Scheduled async clear for framebuffer %p", fb);
 }
 
-// Sets a pixel with color and depth, applying stencil and depth tests.
-void framebuffer_set_pixel(Framebuffer *restrict fb, uint32_t x, uint32_t y,
-			   uint32_t color, float depth)
+// Where the calling thread finds pixel (x, y): the tile it is rendering,
+// or the linear buffers once the pixel's tile is resolved.
+typedef struct {
+	_Atomic uint32_t *color;
+	_Atomic float *depth;
+	_Atomic uint8_t *stencil;
+	size_t idx;
+} PixelSlot;
+
+static inline PixelSlot pixel_slot(Framebuffer *fb, uint32_t x, uint32_t y)
 {
-	if (!fb || x >= fb->width || y >= fb->height) {
-		return;
+	if (in_current_tile(fb, x, y)) {
+		return (PixelSlot){ tls_tile->color, tls_tile->depth,
+				    tls_tile->stencil,
+				    (size_t)(y - tls_tile->y0) * fb->tile_size +
+					    (x - tls_tile->x0) };
 	}
-	LOG_DEBUG("set_pixel (%u,%u) color=0x%08X", x, y, color);
-
-	_Atomic uint32_t *color_buffer = fb->color_buffer;
-	_Atomic float *depth_buffer = fb->depth_buffer;
-	_Atomic uint8_t *stencil_buffer = fb->stencil_buffer;
-	size_t stride = fb->width;
-	uint32_t tile_x = x, tile_y = y;
+	tile_resolve(fb, tile_at(fb, x, y));
+	return (PixelSlot){ fb->color_buffer, fb->depth_buffer,
+			    fb->stencil_buffer, (size_t)y * fb->width + x };
+}
 
-	if (tls_tile && x >= tls_tile->x0 && x < tls_tile->x0 + fb->tile_size &&
-	    y >= tls_tile->y0 && y < tls_tile->y0 + fb->tile_size) {
-		color_buffer = (_Atomic uint32_t *)tls_tile->color;
-		depth_buffer = (_Atomic float *)tls_tile->depth;
-		stencil_buffer = (_Atomic uint8_t *)tls_tile->stencil;
-		stride = fb->tile_size;
-		tile_x = x - tls_tile->x0;
-		tile_y = y - tls_tile->y0;
+// Runs the stencil and depth tests and their buffer updates.
+bool framebuffer_depth_stencil_test(Framebuffer *restrict fb, uint32_t x,
+				    uint32_t y, float depth)
+{
+	if (!fb || x >= fb->width || y >= fb->height) {
+		return false;
 	}
 
-	size_t idx = (size_t)tile_y * stride + tile_x;
+	PixelSlot slot = pixel_slot(fb, x, y);
+	_Atomic float *depth_buffer = slot.depth;
+	_Atomic uint8_t *stencil_buffer = slot.stencil;
+	size_t idx = slot.idx;
 	refresh_depth_stencil();
 	GLboolean stencil_on = tl_stencil_on;
 	StencilState *ss = &tl_stencil;
@@ -503,7 +676,7 @@ void framebuffer_set_pixel(Framebuffer *restrict fb, uint32_t x, uint32_t y,
 			new = (new & ss->writemask) |
 			      (stencil & ~ss->writemask);
 			atomic_store(&stencil_buffer[idx], new);
-			return;
+			return false;
 		}
 	}
 
@@ -587,9 +760,27 @@ void framebuffer_set_pixel(Framebuffer *restrict fb, uint32_t x, uint32_t y,
 		atomic_store(&stencil_buffer[idx], new);
 	}
 
-	if (depth_pass) {
-		atomic_store(&color_buffer[idx], encode_color(fb, color));
+	return depth_pass;
+}
+
+// Writes a fragment's color, with no tests.
+void framebuffer_write_color(Framebuffer *restrict fb, uint32_t x, uint32_t y,
+			     uint32_t color)
+{
+	if (!fb || x >= fb->width || y >= fb->height) {
+		return;
 	}
+	PixelSlot slot = pixel_slot(fb, x, y);
+	atomic_store(&slot.color[slot.idx], encode_color(fb, color));
+}
+
+// Sets a pixel with color and depth, applying stencil and depth tests.
+void framebuffer_set_pixel(Framebuffer *restrict fb, uint32_t x, uint32_t y,
+			   uint32_t color, float depth)
+{
+	LOG_DEBUG("set_pixel (%u,%u) color=0x%08X", x, y, color);
+	if (framebuffer_depth_stencil_test(fb, x, y, depth))
+		framebuffer_write_color(fb, x, y, color);
 }
 
 // Fills a rectangle with the specified color and depth.
@@ -616,6 +807,12 @@ uint32_t framebuffer_get_pixel(const Framebuffer *fb, uint32_t x, uint32_t y)
 	if (!fb || x >= fb->width || y >= fb->height) {
 		return 0;
 	}
+	if (in_current_tile(fb, x, y)) {
+		size_t idx = (size_t)(y - tls_tile->y0) * fb->tile_size +
+			     (x - tls_tile->x0);
+		return decode_color(fb, atomic_load(&tls_tile->color[idx]));
+	}
+	tile_resolve(fb, tile_at(fb, x, y));
 	uint32_t v = atomic_load(&fb->color_buffer[(size_t)y * fb->width + x]);
 	return decode_color(fb, v);
 }
@@ -626,6 +823,12 @@ float framebuffer_get_depth(const Framebuffer *fb, uint32_t x, uint32_t y)
 	if (!fb || x >= fb->width || y >= fb->height) {
 		return 1.0f;
 	}
+	if (in_current_tile(fb, x, y)) {
+		size_t idx = (size_t)(y - tls_tile->y0) * fb->tile_size +
+			     (x - tls_tile->x0);
+		return atomic_load(&tls_tile->depth[idx]);
+	}
+	tile_resolve(fb, tile_at(fb, x, y));
 	return atomic_load(&fb->depth_buffer[(size_t)y * fb->width + x]);
 }
 
@@ -645,6 +848,7 @@ int framebuffer_write_bmp(const Framebuffer *fb, const char *path)
 		return 0;
 	}
 
+	framebuffer_resolve(fb);
 	int width = (int)fb->width;
 	int height = (int)fb->height;
 	int row_bytes = width * 3;
@@ -733,6 +937,7 @@ int framebuffer_write_rgba(const Framebuffer *fb, const char *path)
 		return 0;
 	}
 
+	framebuffer_resolve(fb);
 	int width = (int)fb->width;
 	int height = (int)fb->height;
 	if (fprintf(f, "%d %d\n", width, height) < 0) {
@@ -777,6 +982,7 @@ int framebuffer_stream_rgba(const Framebuffer *fb, FILE *out)
 		return 0;
 	}
 
+	framebuffer_resolve(fb);
 	int width = (int)fb->width;
 	int height = (int)fb->height;
 	for (int y = 0; y < height; ++y) {
@@ -822,3 +1028,96 @@ void framebuffer_leave_tile(void)
 {
 	tls_tile = NULL;
 }
+
+// Locks the tile holding (x, y), loading it unless it is already resident.
+FramebufferTile *framebuffer_lock_tile(Framebuffer *fb, uint32_t x,
+				       uint32_t y)
+{
+	FramebufferTile *tile = tile_at(fb, x, y);
+	tile_lock(tile);
+	FramebufferTileState state = atomic_load(&tile->state);
+	if (state == FB_TILE_RESIDENT)
+		return tile;
+	uint32_t w, h;
+	tile_extent(fb, tile, &w, &h);
+	if (state == FB_TILE_CLEARED) {
+		fill_values(tile->color, tile->depth, tile->stencil,
+			    fb->tile_size, w, h, tile->clear_color,
+			    tile->clear_depth, tile->clear_stencil);
+	} else {
+		size_t idx = (size_t)tile->y0 * fb->width + tile->x0;
+		for (uint32_t row = 0; row < h; ++row) {
+			size_t src = idx + (size_t)row * fb->width;
+			size_t dst = (size_t)row * fb->tile_size;
+			memcpy((void *)&tile->color[dst],
+			       (void *)&fb->color_buffer[src],
+			       w * sizeof(uint32_t));
+			memcpy((void *)&tile->depth[dst],
+			       (void *)&fb->depth_buffer[src],
+			       w * sizeof(float));
+			memcpy((void *)&tile->stencil[dst],
+			       (void *)&fb->stencil_buffer[src], w);
+		}
+		framebuffer_update_hiz(fb, tile, tile->x0, tile->y0,
+				       tile->x0 + w - 1, tile->y0 + h - 1);
+	}
+	atomic_store(&tile->state, FB_TILE_RESIDENT);
+	return tile;
+}
+
+// Unlocks a tile, which stays resident until it is resolved.
+void framebuffer_unlock_tile(FramebufferTile *tile)
+{
+	tile_unlock(tile);
+}
+
+// Recomputes the bounds of the blocks overlapping [x0, x1] x [y0, y1], then
+// of the whole tile from its blocks.
+void framebuffer_update_hiz(const Framebuffer *fb, FramebufferTile *tile,
+			    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	const uint32_t bs = FB_HIZ_BLOCK_SIZE;
+	const uint32_t nb = fb->hiz_blocks;
+	uint32_t w, h;
+	tile_extent(fb, tile, &w, &h);
+	for (uint32_t by = (y0 - tile->y0) / bs; by <= (y1 - tile->y0) / bs;
+	     ++by) {
+		uint32_t ly1 = by * bs + bs < h ? by * bs + bs : h;
+		for (uint32_t bx = (x0 - tile->x0) / bs;
+		     bx <= (x1 - tile->x0) / bs; ++bx) {
+			uint32_t lx1 = bx * bs + bs < w ? bx * bs + bs : w;
+			float lo = INFINITY, hi = -INFINITY;
+			for (uint32_t y = by * bs; y < ly1; ++y) {
+				const float *row = (const float *)tile->depth +
+						   (size_t)y * fb->tile_size;
+				for (uint32_t x = bx * bs; x < lx1; ++x) {
+					lo = row[x] < lo ? row[x] : lo;
+					hi = row[x] > hi ? row[x] : hi;
+				}
+			}
+			tile->block_z[2 * (by * nb + bx)] = lo;
+			tile->block_z[2 * (by * nb + bx) + 1] = hi;
+		}
+	}
+	float lo = INFINITY, hi = -INFINITY;
+	for (uint32_t by = 0; by <= (h - 1) / bs; ++by) {
+		for (uint32_t bx = 0; bx <= (w - 1) / bs; ++bx) {
+			const float *b = &tile->block_z[2 * (by * nb + bx)];
+			lo = b[0] < lo ? b[0] : lo;
+			hi = b[1] > hi ? b[1] : hi;
+		}
+	}
+	atomic_store_explicit(&tile->zmin, lo, memory_order_relaxed);
+	atomic_store_explicit(&tile->zmax, hi, memory_order_relaxed);
+}
+
+// Writes every tile that is not linear back to the linear buffers.
+void framebuffer_resolve(const Framebuffer *fb)
+{
+	if (!fb) {
+		return;
+	}
+	size_t tile_count = (size_t)fb->tiles_x * fb->tiles_y;
+	for (size_t i = 0; i < tile_count; ++i)
+		tile_resolve(fb, &fb->tiles[i]);
+}
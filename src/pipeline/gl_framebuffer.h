@@ -1,6 +1,7 @@
 #ifndef PIPELINE_GL_FRAMEBUFFER_H
 #define PIPELINE_GL_FRAMEBUFFER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdalign.h>
@@ -17,6 +18,12 @@ extern "C" {
  */
 #define DEFAULT_TILE_SIZE 16
 
+/**
+ * @brief Side of the square blocks, aligned to the tile origin, whose depth
+ *        bounds each tile keeps for hierarchical Z.
+ */
+#define FB_HIZ_BLOCK_SIZE 8
+
 /** Framebuffer colour specification selected via `FB_COLOR_SPEC` or
  *  `--color-spec`. */
 typedef enum {
@@ -24,6 +31,13 @@ typedef enum {
 	FB_COLOR_XRGB8888 /**< Alpha ignored, treated as 0xFF. */
 } FramebufferColorSpec;
 
+/** Where the current contents of a framebuffer tile live. */
+typedef enum {
+	FB_TILE_LINEAR, /**< In the framebuffer's linear buffers. */
+	FB_TILE_CLEARED, /**< Every pixel holds the tile's clear values. */
+	FB_TILE_RESIDENT /**< In the tile's own buffers. */
+} FramebufferTileState;
+
 /**
  * @brief Structure representing a tile in a framebuffer. Tile size is
  *        determined at runtime via the TILESIZE environment variable or the
@@ -31,6 +45,16 @@ typedef enum {
  *
  * Contains color, depth, and stencil data for a tile, aligned to 64 bytes for
  * cache efficiency. Includes an atomic lock for thread-safe access.
+ *
+ * Tiles stay resident between fragment jobs: the first job to render a tile
+ * loads it and later jobs find it in place. The linear buffers only catch up
+ * when the tile is resolved, and a clear only records its values, so a tile
+ * nothing renders is never copied.
+ *
+ * The tile also bounds the depths it holds, as a whole and per block, so
+ * the rasterizer can drop triangles that are hidden everywhere they land.
+ * The bounds are exact for a cleared tile and recomputed by the fragment
+ * stage after it writes depths; a linear tile has none (-inf, +inf).
  */
 typedef struct {
 	alignas(64) uint32_t x0, y0; /**< Top-left coordinates of the tile. */
@@ -38,6 +62,13 @@ typedef struct {
 	_Atomic float *depth; /**< Depth data. */
 	_Atomic uint8_t *stencil; /**< Stencil data. */
 	atomic_flag lock; /**< Lock for thread-safe tile access. */
+	_Atomic FramebufferTileState state; /**< Where the pixels live. */
+	uint32_t clear_color; /**< Encoded color of a cleared tile. */
+	float clear_depth; /**< Depth of a cleared tile. */
+	uint8_t clear_stencil; /**< Stencil of a cleared tile. */
+	_Atomic float zmin; /**< Lowest depth in the tile. */
+	_Atomic float zmax; /**< Highest depth in the tile. */
+	float *block_z; /**< Lowest and highest depth of each block. */
 } FramebufferTile;
 
 _Static_assert(alignof(FramebufferTile) >= 64,
@@ -62,6 +93,11 @@ typedef struct Framebuffer {
 	uint32_t tiles_y; /**< Number of tiles along y-axis. */
 	uint32_t tile_size; /**< Size of each tile (pixels). */
 	FramebufferColorSpec color_spec; /**< Colour format. */
+	task_group_t *tasks; /**< Outstanding pool work targeting this buffer. */
+	uint32_t hiz_blocks; /**< Depth bound blocks along a tile side. */
+	float *hiz; /**< Storage for every tile's block_z. */
+	_Atomic bool depth_raised; /**< Set by a draw that may raise depth
+				    until the next framebuffer_wait(). */
 } Framebuffer;
 
 _Static_assert(sizeof(uint32_t) == 4, "Framebuffer requires 32-bit colors");
@@ -79,6 +115,56 @@ void framebuffer_enter_tile(FramebufferTile *tile);
  */
 void framebuffer_leave_tile(void);
 
+/**
+ * @brief Locks the tile holding pixel (@p x, @p y) and makes it resident,
+ *        loading its pixels unless an earlier job left them in place.
+ * @param fb Framebuffer owning the tile (must not be NULL).
+ * @return The locked tile.
+ * @threadsafe
+ */
+FramebufferTile *framebuffer_lock_tile(Framebuffer *fb, uint32_t x,
+				       uint32_t y);
+
+/**
+ * @brief Unlocks a tile from framebuffer_lock_tile(), leaving it resident.
+ * @param tile Tile to unlock (must not be NULL).
+ * @threadsafe
+ */
+void framebuffer_unlock_tile(FramebufferTile *tile);
+
+/**
+ * @brief Depth bounds of the block of @p tile holding pixel (@p x, @p y).
+ * @return The lowest and the highest depth in the block.
+ */
+static inline const float *framebuffer_block_depth(const Framebuffer *fb,
+						   const FramebufferTile *tile,
+						   uint32_t x, uint32_t y)
+{
+	uint32_t bx = (x - tile->x0) / FB_HIZ_BLOCK_SIZE;
+	uint32_t by = (y - tile->y0) / FB_HIZ_BLOCK_SIZE;
+	return &tile->block_z[2 * (by * fb->hiz_blocks + bx)];
+}
+
+/**
+ * @brief Recomputes the depth bounds of a locked tile after depths in
+ *        [x0, x1] x [y0, y1] may have changed.
+ * @param fb Framebuffer owning the tile (must not be NULL).
+ * @param tile Tile from framebuffer_lock_tile() (must not be NULL).
+ */
+void framebuffer_update_hiz(const Framebuffer *fb, FramebufferTile *tile,
+			    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+/**
+ * @brief Writes every resident or cleared tile back to the linear buffers.
+ *
+ * Afterwards color_buffer, depth_buffer and stencil_buffer may be read or
+ * written directly until the next draw. Call framebuffer_wait() first for a
+ * complete image.
+ * @param fb Framebuffer to resolve (may be NULL).
+ * @threadsafe
+ */
+void framebuffer_resolve(const Framebuffer *fb);
+
 /**
  * @brief Creates a framebuffer with the specified dimensions.
  * @param width Width in pixels (must be > 0 and <= 16384).
@@ -90,11 +176,31 @@ Framebuffer *framebuffer_create(uint32_t width, uint32_t height);
 
 /**
  * @brief Destroys a framebuffer, freeing its resources.
+ *
+ * Waits only for work recorded against this framebuffer's task group.
  * @param fb Framebuffer to destroy (may be NULL).
  * @threadsafe
  */
 void framebuffer_destroy(Framebuffer *fb);
 
+/**
+ * @brief Flushes recorded commands and blocks until all pool work targeting
+ *        the framebuffer has completed.
+ * @param fb Framebuffer to wait for (may be NULL).
+ */
+void framebuffer_wait(Framebuffer *fb);
+
+/**
+ * @brief Binds the framebuffer to a thread pool for all later work.
+ *
+ * Waits for outstanding work first. Framebuffers otherwise use the pool of
+ * the context that created them.
+ * @param fb Framebuffer to rebind (may be NULL).
+ * @param pool Pool to use, or NULL for the default pool.
+ * @return false if @p fb is NULL or allocation failed.
+ */
+bool framebuffer_set_thread_pool(Framebuffer *fb, ThreadPool *pool);
+
 /**
  * @brief Increments the framebuffer’s reference count.
  * @param fb Framebuffer to retain (may be NULL).
@@ -111,6 +217,9 @@ void framebuffer_release(Framebuffer *fb);
 
 /**
  * @brief Clears the framebuffer with specified color, depth, and stencil values.
+ *
+ * Only records the values on each tile; tiles are filled when they are next
+ * loaded or resolved.
  * @param fb Framebuffer to clear (must not be NULL).
  * @param clear_color RGBA color value (e.g., 0xFF0000FF for red).
  * @param clear_depth Depth value (typically 0.0 to 1.0).
@@ -132,6 +241,31 @@ void framebuffer_clear(Framebuffer *restrict fb, uint32_t clear_color,
 void framebuffer_set_pixel(Framebuffer *restrict fb, uint32_t x, uint32_t y,
 			   uint32_t color, float depth);
 
+/**
+ * @brief Runs the stencil and depth tests for a fragment at (x, y),
+ * updating the stencil and depth buffers as they would for set_pixel.
+ * @param fb Framebuffer to test against (must not be NULL).
+ * @param x X-coordinate (must be < fb->width).
+ * @param y Y-coordinate (must be < fb->height).
+ * @param depth Fragment depth.
+ * @return true when the fragment's color should be written.
+ * @threadsafe
+ */
+bool framebuffer_depth_stencil_test(Framebuffer *restrict fb, uint32_t x,
+				    uint32_t y, float depth);
+
+/**
+ * @brief Writes a pixel's color without any tests; pairs with
+ * framebuffer_depth_stencil_test() for fragments tested early.
+ * @param fb Framebuffer to modify (must not be NULL).
+ * @param x X-coordinate (must be < fb->width).
+ * @param y Y-coordinate (must be < fb->height).
+ * @param color RGBA color value.
+ * @threadsafe
+ */
+void framebuffer_write_color(Framebuffer *restrict fb, uint32_t x, uint32_t y,
+			     uint32_t color);
+
 /**
  * @brief Fills a rectangle with the specified color and depth.
  * @param fb Framebuffer to modify (must not be NULL).
@@ -1,54 +1,335 @@
 #include "gl_primitive.h"
 #include "gl_raster.h"
+#include "gl_vertex.h"
 #include "../gl_logger.h"
-#include "../gl_thread.h"
-#include "../pool.h"
-#include "../plugin.h"
 #define PIPELINE_USE_GLSTATE 0
 _Static_assert(PIPELINE_USE_GLSTATE == 0, "pipeline must not touch gl_state");
-#include "../gl_memory_tracker.h"
+#include <math.h>
 #include <string.h>
 
-void pipeline_assemble_triangle(Triangle *dst, const Vertex *v0,
-				const Vertex *v1, const Vertex *v2)
+void pipeline_assemble_triangle(RasterTriangle *dst, const RasterVertex *v0,
+				const RasterVertex *v1, const RasterVertex *v2)
 {
-	*dst = (Triangle){ *v0, *v1, *v2 };
+	*dst = (RasterTriangle){ *v0, *v1, *v2 };
 }
 
-static float edge(const Vertex *a, const Vertex *b, const Vertex *c)
+uint32_t primitive_count(GLenum mode, uint32_t nelems)
+{
+	switch (mode) {
+	case GL_TRIANGLES:
+		return nelems / 3;
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+		return nelems >= 3 ? nelems - 2 : 0;
+	case GL_LINES:
+		return nelems / 2;
+	case GL_LINE_STRIP:
+		return nelems >= 2 ? nelems - 1 : 0;
+	case GL_LINE_LOOP:
+		return nelems >= 2 ? nelems : 0;
+	default:
+		return 0;
+	}
+}
+
+uint32_t primitive_elements(GLenum mode, uint32_t nprims)
+{
+	if (!nprims)
+		return 0;
+	switch (mode) {
+	case GL_TRIANGLES:
+		return 3 * nprims;
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+		return nprims + 2;
+	case GL_LINES:
+		return 2 * nprims;
+	case GL_LINE_STRIP:
+		return nprims + 1;
+	case GL_LINE_LOOP:
+		return nprims;
+	default:
+		return 0;
+	}
+}
+
+void primitive_vertices(GLenum mode, uint32_t p, uint32_t e[3])
+{
+	switch (mode) {
+	case GL_TRIANGLE_STRIP:
+		e[0] = p + (p & 1);
+		e[1] = p + 1 - (p & 1);
+		e[2] = p + 2;
+		break;
+	case GL_TRIANGLE_FAN:
+		e[0] = 0;
+		e[1] = p + 1;
+		e[2] = p + 2;
+		break;
+	case GL_LINES:
+		e[0] = 2 * p;
+		e[1] = 2 * p + 1;
+		e[2] = e[1];
+		break;
+	case GL_LINE_STRIP:
+		e[0] = p;
+		e[1] = p + 1;
+		e[2] = e[1];
+		break;
+	default:
+		e[0] = 3 * p;
+		e[1] = 3 * p + 1;
+		e[2] = 3 * p + 2;
+		break;
+	}
+}
+
+static float edge(const RasterVertex *a, const RasterVertex *b,
+		  const RasterVertex *c)
 {
 	return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
 }
 
-void process_primitive_job(void *task_data)
+/* Rasterize @p tri into fragment tile tasks. */
+static void emit_triangle(const RasterTriangle *tri, Framebuffer *fb,
+			  const GLint *viewport)
 {
-	PrimitiveJob *job = (PrimitiveJob *)task_data;
-	plugin_invoke(STAGE_PRIMITIVE, job);
-	Triangle tri;
-	pipeline_assemble_triangle(&tri, &job->verts[0], &job->verts[1],
-				   &job->verts[2]);
 	LOG_DEBUG(
 		"Triangle assembled: v0(%.2f,%.2f,%.2f) v1(%.2f,%.2f,%.2f) v2(%.2f,%.2f,%.2f)",
-		tri.v0.x, tri.v0.y, tri.v0.z, tri.v1.x, tri.v1.y, tri.v1.z,
-		tri.v2.x, tri.v2.y, tri.v2.z);
-	if (edge(&tri.v0, &tri.v1, &tri.v2) <= 0.f) {
-		LOG_DEBUG("Triangle culled due to backface");
-		framebuffer_release(job->fb);
-		MT_FREE(job, STAGE_PRIMITIVE);
-		return; // culled
+		tri->v0.x, tri->v0.y, tri->v0.z, tri->v1.x, tri->v1.y,
+		tri->v1.z, tri->v2.x, tri->v2.y, tri->v2.z);
+	/* Facing was decided in clip space by the vertex stage; clipping can
+	 * still leave a sliver with no area. */
+	if (edge(&tri->v0, &tri->v1, &tri->v2) == 0.f) {
+		LOG_DEBUG("Triangle culled due to zero area");
+		return;
 	}
 	LOG_DEBUG("Triangle accepted for rasterization");
-	RasterJob *rjob = raster_job_acquire();
-	if (!rjob) {
-		framebuffer_release(job->fb);
-		MT_FREE(job, STAGE_PRIMITIVE);
+	pipeline_rasterize_triangle(tri, viewport, fb);
+}
+
+/*
+ * Clip stage. Primitives entirely outside one frustum plane are dropped.
+ * Everything inside the guard band that does not cross the near plane goes
+ * straight to the rasterizer, which bounds its work by the viewport; only
+ * near-plane crossers and primitives reaching past the guard band are
+ * clipped in homogeneous space. The far plane only rejects: depth outside
+ * [-1, 1] is left to the depth range like the rest of the pipeline.
+ */
+
+/* Clip-space position and attributes of one polygon vertex; color is
+ * unpacked so it interpolates without rounding at every plane. */
+typedef struct {
+	GLfloat c[4];
+	GLfloat color[4];
+	RasterVertex v;
+} ClipVertex;
+
+/* Triangle plus one vertex per clipping plane. */
+#define CLIP_MAX_VERTS 8
+
+/* Signed distance to the plane for @p bit; inside is >= 0. */
+static GLfloat clip_distance(const GLfloat *c, int32_t bit)
+{
+	const GLfloat g = CLIP_GUARD_BAND * c[3];
+	switch (bit) {
+	case CLIP_NEAR:
+		return c[2] + c[3];
+	case CLIP_LEFT:
+		return c[0] + g;
+	case CLIP_RIGHT:
+		return g - c[0];
+	case CLIP_BOTTOM:
+		return c[1] + g;
+	default:
+		return g - c[1];
+	}
+}
+
+static GLfloat lerpf(GLfloat a, GLfloat b, GLfloat t)
+{
+	return a + (b - a) * t;
+}
+
+static void clip_vertex_init(ClipVertex *cv, const RasterVertex *v,
+			     const GLfloat *c)
+{
+	memcpy(cv->c, c, sizeof(cv->c));
+	raster_unpack_color(v->color, cv->color);
+	cv->v = *v;
+}
+
+static void clip_lerp(ClipVertex *dst, const ClipVertex *a,
+		      const ClipVertex *b, GLfloat t)
+{
+	for (int i = 0; i < 4; ++i) {
+		dst->c[i] = lerpf(a->c[i], b->c[i], t);
+		dst->color[i] = lerpf(a->color[i], b->color[i], t);
+	}
+	dst->v.s = lerpf(a->v.s, b->v.s, t);
+	dst->v.t = lerpf(a->v.t, b->v.t, t);
+}
+
+/* Fill in window coordinates the same way the vertex stage does. */
+static void clip_project(ClipVertex *cv, const GLint *viewport)
+{
+	GLfloat inv_w = 1.0f / cv->c[3];
+	cv->v.x = viewport[0] + (cv->c[0] * inv_w * 0.5f + 0.5f) * viewport[2];
+	cv->v.y = viewport[1] +
+		  (1.0f - (cv->c[1] * inv_w * 0.5f + 0.5f)) * viewport[3];
+	cv->v.z = cv->c[2] * inv_w;
+	cv->v.inv_w = inv_w;
+	cv->v.color = raster_pack_color(cv->color);
+}
+
+/* The planes a primitive with combined outcode @p or must be clipped to. */
+static int32_t clip_planes(int32_t or)
+{
+	int32_t planes = or & CLIP_NEAR;
+	if (or & CLIP_GUARD)
+		planes |= CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP;
+	return planes;
+}
+
+/* Sutherland-Hodgman against each plane in @p planes, then fan the result
+ * into triangles with the winding of the input. */
+static void clip_triangle(const RasterVertex *const v[3],
+			  const GLfloat *const c[3],
+			  int32_t planes, Framebuffer *fb,
+			  const GLint *viewport)
+{
+	ClipVertex buf[2][CLIP_MAX_VERTS];
+	ClipVertex *in = buf[0], *out = buf[1];
+	int n = 3;
+	for (int i = 0; i < 3; ++i)
+		clip_vertex_init(&in[i], v[i], c[i]);
+	for (int32_t bit = 1; bit <= CLIP_NEAR && n >= 3; bit <<= 1) {
+		if (!(planes & bit))
+			continue;
+		int m = 0;
+		for (int i = 0; i < n; ++i) {
+			const ClipVertex *a = &in[i], *b = &in[(i + 1) % n];
+			GLfloat da = clip_distance(a->c, bit);
+			GLfloat db = clip_distance(b->c, bit);
+			if (da >= 0.0f)
+				out[m++] = *a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				clip_lerp(&out[m++], a, b, da / (da - db));
+		}
+		ClipVertex *t = in;
+		in = out;
+		out = t;
+		n = m;
+	}
+	if (n < 3)
 		return;
+	for (int i = 0; i < n; ++i) {
+		if (in[i].c[3] <= 0.0f)
+			return; /* degenerate projection through the eye */
+		clip_project(&in[i], viewport);
+	}
+	for (int i = 1; i + 1 < n; ++i) {
+		RasterTriangle tri;
+		pipeline_assemble_triangle(&tri, &in[0].v, &in[i].v,
+					   &in[i + 1].v);
+		emit_triangle(&tri, fb, viewport);
+	}
+}
+
+/* Run one triangle through the clip stage and rasterize what is left. */
+static void clip_emit_triangle(const RasterVertex *const v[3],
+			       const GLfloat *const c[3],
+			       const int32_t code[3], Framebuffer *fb,
+			       const GLint *viewport)
+{
+	if (code[0] & code[1] & code[2] & CLIP_FRUSTUM_MASK)
+		return;
+	int32_t planes = clip_planes(code[0] | code[1] | code[2]);
+	if (planes) {
+		clip_triangle(v, c, planes, fb, viewport);
+		return;
+	}
+	RasterTriangle tri;
+	pipeline_assemble_triangle(&tri, v[0], v[1], v[2]);
+	emit_triangle(&tri, fb, viewport);
+}
+
+/* Parametric clip of the segment @p a to @p b. */
+static void clip_emit_line(const RasterVertex *a, const RasterVertex *b,
+			   const GLfloat *ca, const GLfloat *cb,
+			   const int32_t code[2], Framebuffer *fb,
+			   const GLint *viewport)
+{
+	if (code[0] & code[1] & CLIP_FRUSTUM_MASK)
+		return;
+	int32_t planes = clip_planes(code[0] | code[1]);
+	if (!planes) {
+		pipeline_rasterize_line(a, b, viewport, fb);
+		return;
+	}
+	GLfloat t0 = 0.0f, t1 = 1.0f;
+	for (int32_t bit = 1; bit <= CLIP_NEAR; bit <<= 1) {
+		if (!(planes & bit))
+			continue;
+		GLfloat da = clip_distance(ca, bit);
+		GLfloat db = clip_distance(cb, bit);
+		if (da < 0.0f && db < 0.0f)
+			return;
+		if (da < 0.0f)
+			t0 = fmaxf(t0, da / (da - db));
+		else if (db < 0.0f)
+			t1 = fminf(t1, da / (da - db));
+	}
+	if (t0 >= t1)
+		return;
+	ClipVertex ends[2], pa, pb;
+	clip_vertex_init(&pa, a, ca);
+	clip_vertex_init(&pb, b, cb);
+	clip_lerp(&ends[0], &pa, &pb, t0);
+	clip_lerp(&ends[1], &pa, &pb, t1);
+	for (int i = 0; i < 2; ++i) {
+		if (ends[i].c[3] <= 0.0f)
+			return;
+		clip_project(&ends[i], viewport);
+	}
+	pipeline_rasterize_line(&ends[0].v, &ends[1].v, viewport, fb);
+}
+
+void pipeline_clip_triangle(const RasterVertex *const v[3],
+			    const GLfloat *const c[3], Framebuffer *fb,
+			    const GLint *viewport)
+{
+	int32_t code[3];
+	for (int i = 0; i < 3; ++i)
+		code[i] = clip_outcode(c[i][0], c[i][1], c[i][2], c[i][3]);
+	clip_emit_triangle(v, c, code, fb, viewport);
+}
+
+void pipeline_assemble_batch(const VertexBatch *b)
+{
+	const bool line = primitive_is_line(b->mode);
+	for (uint32_t p = 0; p < b->nprims; ++p) {
+		if (b->culled[p >> 6] & ((uint64_t)1 << (p & 63)))
+			continue;
+		uint32_t e[3];
+		primitive_vertices(b->mode, p, e);
+		const RasterVertex *v[3];
+		GLfloat c[3][4];
+		const GLfloat *cp[3] = { c[0], c[1], c[2] };
+		int32_t code[3];
+		for (int k = 0; k < 3; ++k) {
+			uint16_t s = b->elems[e[k]];
+			v[k] = &b->out[s];
+			code[k] = b->clip[s];
+			c[k][0] = b->x[s];
+			c[k][1] = b->y[s];
+			c[k][2] = b->z[s];
+			c[k][3] = b->w[s];
+		}
+		if (line)
+			clip_emit_line(v[0], v[1], c[0], c[1], code, b->fb,
+				       b->viewport);
+		else
+			clip_emit_triangle(v, cp, code, b->fb, b->viewport);
 	}
-	rjob->tri = tri;
-	rjob->fb = job->fb;
-	framebuffer_retain(rjob->fb);
-	memcpy(rjob->viewport, job->viewport, sizeof(job->viewport));
-	framebuffer_release(job->fb);
-	MT_FREE(job, STAGE_PRIMITIVE);
-	thread_pool_submit(process_raster_job, rjob, STAGE_RASTER);
 }
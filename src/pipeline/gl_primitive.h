@@ -3,21 +3,44 @@
 
 #include "../gl_types.h"
 #include "gl_framebuffer.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void pipeline_assemble_triangle(Triangle *dst, const Vertex *v0,
-				const Vertex *v1, const Vertex *v2);
+void pipeline_assemble_triangle(RasterTriangle *dst, const RasterVertex *v0,
+				const RasterVertex *v1, const RasterVertex *v2);
 
-typedef struct {
-	Vertex verts[3];
-	Framebuffer *fb;
-	GLint viewport[4];
-} PrimitiveJob;
+/* Primitives drawn by @p nelems elements of @p mode; incomplete trailing
+ * primitives are dropped. GL_LINE_LOOP is assembled as a GL_LINE_STRIP
+ * whose last element repeats the first. */
+uint32_t primitive_count(GLenum mode, uint32_t nelems);
+/* Elements read by the first @p nprims primitives of @p mode. */
+uint32_t primitive_elements(GLenum mode, uint32_t nprims);
+static inline bool primitive_is_line(GLenum mode)
+{
+	return mode == GL_LINES || mode == GL_LINE_STRIP;
+}
+/* Element positions of primitive @p p of @p mode in GL's winding: odd
+ * strip triangles swap their first two vertices and fans share element
+ * 0. Lines only fill e[0] and e[1]. */
+void primitive_vertices(GLenum mode, uint32_t p, uint32_t e[3]);
+
+typedef struct VertexBatch VertexBatch;
+
+/* The primitive stage runs inside the vertex task that transformed its
+ * vertices: it clips, sets up and rasterizes straight into fragment tile
+ * tasks, so only fragment tiles are handed to the pool. */
 
-void process_primitive_job(void *task_data);
+/* Clip and rasterize the lit triangle @p v whose clip-space positions are
+ * @p c; culling has already been applied. */
+void pipeline_clip_triangle(const RasterVertex *const v[3],
+			    const GLfloat *const c[3], Framebuffer *fb,
+			    const GLint *viewport);
+/* Assemble, clip and rasterize every primitive of a transformed batch
+ * that culling kept. */
+void pipeline_assemble_batch(const VertexBatch *b);
 
 #ifdef __cplusplus
 }
@@ -7,29 +7,301 @@ _Static_assert(PIPELINE_USE_GLSTATE == 0, "pipeline must not touch gl_state");
 #include "../gl_memory_tracker.h"
 #include "../gl_thread.h"
 #include "../pool.h"
-#include "../plugin.h"
+#include <math.h>
+#include <stdbool.h>
 
-static uint32_t pack_color(const GLfloat c[4])
+/* Tile jobs are handed to the pool in groups of this many so one wakeup
+ * covers a whole primitive. */
+#define RASTER_TILE_BATCH 64
+
+/* Window coordinates beyond this many pixels are dropped rather than
+ * overflow the fixed-point setup; the guard band keeps clipped triangles
+ * far inside it. */
+#define RASTER_MAX_COORD 1048576.0f
+
+/* Set up @p e for @p tri with vertices snapped to the sub-pixel grid.
+ * Returns false for triangles with no area once snapped. */
+static bool raster_setup_edges(const RasterTriangle *restrict tri,
+			       RasterEdges *e)
+{
+	const RasterVertex *v[3] = { &tri->v0, &tri->v1, &tri->v2 };
+	const float scale = (float)(1 << RASTER_SUBPIXEL_BITS);
+	int64_t x[3], y[3];
+	for (int i = 0; i < 3; ++i) {
+		if (!(fabsf(v[i]->x) < RASTER_MAX_COORD &&
+		      fabsf(v[i]->y) < RASTER_MAX_COORD))
+			return false;
+		x[i] = lrintf(v[i]->x * scale);
+		y[i] = lrintf(v[i]->y * scale);
+	}
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0]) -
+		       (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0)
+		return false;
+	if (area < 0) {
+		/* Either winding rasterizes; order it so inside is positive. */
+		int64_t t = x[1];
+		x[1] = x[2];
+		x[2] = t;
+		t = y[1];
+		y[1] = y[2];
+		y[2] = t;
+	}
+	const int64_t one = 1 << RASTER_SUBPIXEL_BITS;
+	const int64_t half = one / 2;
+	for (int k = 0; k < 3; ++k) {
+		int i = k, j = (k + 1) % 3;
+		int64_t dx = x[j] - x[i];
+		int64_t dy = y[j] - y[i];
+		e->a[k] = -dy * one;
+		e->b[k] = dx * one;
+		e->c[k] = dx * (half - y[i]) - dy * (half - x[i]);
+		/* Top-left rule: a pixel center on an edge belongs to the
+		 * triangle only if that is a top or a left edge, so triangles
+		 * sharing an edge never both cover it. */
+		if (!(dy < 0 || (dy == 0 && dx > 0)))
+			e->c[k] -= 1;
+	}
+	return true;
+}
+
+GLenum raster_hiz_func(void)
+{
+	const RenderContext *ctx = GetCurrentContext();
+	if (!ctx || !ctx->depth_test_enabled || ctx->stencil_test_enabled)
+		return GL_ALWAYS;
+	return ctx->depth_func;
+}
+
+GLenum raster_bin_hiz_func(const Framebuffer *fb)
+{
+	if (atomic_load_explicit(&fb->depth_raised, memory_order_relaxed))
+		return GL_ALWAYS;
+	GLenum func = raster_hiz_func();
+	return func == GL_LESS || func == GL_LEQUAL ? func : GL_ALWAYS;
+}
+
+void raster_hiz_note_draw(Framebuffer *fb)
+{
+	const RenderContext *ctx = GetCurrentContext();
+	/* Tile bounds are read when a draw bins, possibly before the jobs of
+	 * earlier draws have run. Those only lower depth under GL_LESS or
+	 * GL_LEQUAL, so the bounds stay conservative; any other writing
+	 * function can raise it behind the bounds' back. */
+	if (!ctx->depth_test_enabled || !ctx->depth_mask ||
+	    ctx->depth_func == GL_LESS || ctx->depth_func == GL_LEQUAL ||
+	    ctx->depth_func == GL_EQUAL || ctx->depth_func == GL_NEVER)
+		return;
+	atomic_store_explicit(&fb->depth_raised, true, memory_order_relaxed);
+}
+
+/* Whether depth @p z fails @p func everywhere in tile @p index. */
+static inline bool tile_hidden(const Framebuffer *fb, uint32_t index,
+			       GLenum func, float z)
+{
+	if (func == GL_ALWAYS)
+		return false;
+	const FramebufferTile *tile = &fb->tiles[index];
+	float lo = atomic_load_explicit(&tile->zmin, memory_order_relaxed);
+	float hi = atomic_load_explicit(&tile->zmax, memory_order_relaxed);
+	return raster_depth_rejects(func, z, z, lo, hi);
+}
+
+/* Bins the current task's triangles go to; NULL queues tile jobs. */
+static _Thread_local RasterBins *tl_bins;
+
+RasterBins *raster_bins_create(Framebuffer *fb)
+{
+	size_t ntiles = (size_t)fb->tiles_x * fb->tiles_y;
+	RasterBins *bins = MT_ALLOC(sizeof(RasterBins), STAGE_RASTER);
+	if (!bins)
+		return NULL;
+	*bins = (RasterBins){ .fb = fb };
+	bins->bins = MT_CALLOC(ntiles, sizeof(RasterBin), STAGE_RASTER);
+	if (!bins->bins || mtx_init(&bins->lock, mtx_plain) != thrd_success) {
+		if (bins->bins)
+			MT_FREE(bins->bins, STAGE_RASTER);
+		MT_FREE(bins, STAGE_RASTER);
+		return NULL;
+	}
+	for (size_t i = 0; i < ntiles; ++i) {
+		bins->bins[i].bins = bins;
+		bins->bins[i].tile = (uint32_t)i;
+	}
+	atomic_init(&bins->refs, 1);
+	atomic_init(&bins->tiles_left, 0);
+	framebuffer_retain(fb);
+	return bins;
+}
+
+static void raster_bins_free(RasterBins *bins)
+{
+	if (bins->tris)
+		MT_FREE(bins->tris, STAGE_RASTER);
+	if (bins->chunks)
+		MT_FREE(bins->chunks, STAGE_RASTER);
+	MT_FREE(bins->bins, STAGE_RASTER);
+	mtx_destroy(&bins->lock);
+	framebuffer_release(bins->fb);
+	MT_FREE(bins, STAGE_RASTER);
+}
+
+void raster_bins_retain(RasterBins *bins)
+{
+	if (bins)
+		atomic_fetch_add_explicit(&bins->refs, 1,
+					  memory_order_relaxed);
+}
+
+void raster_bins_release(RasterBins *bins)
+{
+	if (!bins || atomic_fetch_sub_explicit(&bins->refs, 1,
+					       memory_order_acq_rel) != 1)
+		return;
+	Framebuffer *fb = bins->fb;
+	size_t ntiles = (size_t)fb->tiles_x * fb->tiles_y;
+	unsigned used = 0;
+	for (size_t i = 0; i < ntiles; ++i)
+		used += bins->bins[i].count != 0;
+	if (!used) {
+		raster_bins_free(bins);
+		return;
+	}
+	/* The bins outlive this loop: the last job to finish frees them, and
+	 * it cannot finish before the last batch is submitted. The jobs count
+	 * against the framebuffer even when the recording thread queues
+	 * them. */
+	atomic_store_explicit(&bins->tiles_left, used, memory_order_relaxed);
+	task_group_t *group = fb->tasks;
+	task_t batch[RASTER_TILE_BATCH];
+	size_t nbatch = 0;
+	for (size_t i = 0; i < ntiles && used; ++i) {
+		if (!bins->bins[i].count)
+			continue;
+		--used;
+		batch[nbatch++] = (task_t){ process_fragment_bin_job,
+					    &bins->bins[i], STAGE_FRAGMENT,
+					    group };
+		if (nbatch == RASTER_TILE_BATCH || !used) {
+			thread_pool_submit_batch(batch, nbatch);
+			nbatch = 0;
+		}
+	}
+}
+
+void raster_bins_enter(RasterBins *bins)
+{
+	tl_bins = bins;
+}
+
+void raster_bins_leave(void)
+{
+	tl_bins = NULL;
+}
+
+void raster_bin_done(RasterBin *bin)
+{
+	RasterBins *bins = bin->bins;
+	if (atomic_fetch_sub_explicit(&bins->tiles_left, 1,
+				      memory_order_acq_rel) == 1)
+		raster_bins_free(bins);
+}
+
+/* Grow *@p p, holding *@p capacity elements of @p size, to at least
+ * @p need; doubles from @p initial. */
+static bool bin_reserve(void **p, uint32_t *capacity, uint32_t need,
+			size_t size, uint32_t initial)
+{
+	if (need <= *capacity)
+		return true;
+	uint32_t cap = *capacity ? *capacity * 2 : initial;
+	while (cap < need)
+		cap *= 2;
+	void *grown = MT_REALLOC(*p, (size_t)cap * size, STAGE_RASTER);
+	if (!grown)
+		return false;
+	*p = grown;
+	*capacity = cap;
+	return true;
+}
+
+/* Append @p ref to @p bin, starting a new chunk when the last is full. */
+static bool bin_append(RasterBins *bins, RasterBin *bin, uint32_t ref)
 {
-	uint8_t r = (uint8_t)(c[0] * 255.0f + 0.5f);
-	uint8_t g = (uint8_t)(c[1] * 255.0f + 0.5f);
-	uint8_t b = (uint8_t)(c[2] * 255.0f + 0.5f);
-	uint8_t a = (uint8_t)(c[3] * 255.0f + 0.5f);
-	/* Store colors in AARRGGBB layout */
-	return ((uint32_t)a << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) |
-	       (uint32_t)b;
+	uint32_t slot = bin->count % RASTER_BIN_CHUNK_REFS;
+	if (!slot) {
+		if (!bin_reserve((void **)&bins->chunks, &bins->chunks_capacity,
+				 bins->nchunks + 1, sizeof(RasterBinChunk),
+				 64))
+			return false;
+		uint32_t chunk = ++bins->nchunks;
+		bins->chunks[chunk - 1].next = 0;
+		if (bin->tail)
+			bins->chunks[bin->tail - 1].next = chunk;
+		else
+			bin->head = chunk;
+		bin->tail = chunk;
+	}
+	bins->chunks[bin->tail - 1].refs[slot] = ref;
+	bin->count++;
+	return true;
 }
 
-void pipeline_rasterize_triangle(const Triangle *restrict tri,
+/* Append @p t to @p bins and to the bin of every tile in its bounds that
+ * it neither misses nor is hidden in under depth function @p zfunc.
+ * Returns false if the triangle could not be stored. */
+static bool bin_triangle(RasterBins *bins, const BinnedTriangle *t,
+			 GLenum zfunc)
+{
+	Framebuffer *fb = bins->fb;
+	const uint32_t ts = fb->tile_size;
+	mtx_lock(&bins->lock);
+	uint32_t index = bins->ntris;
+	if (!bin_reserve((void **)&bins->tris, &bins->tris_capacity,
+			 index + 1, sizeof(BinnedTriangle), 64)) {
+		mtx_unlock(&bins->lock);
+		return false;
+	}
+	bins->tris[bins->ntris++] = *t;
+	for (uint32_t ty = t->y0 / ts; ty <= t->y1 / ts; ++ty) {
+		for (uint32_t tx = t->x0 / ts; tx <= t->x1 / ts; ++tx) {
+			uint32_t ex = tx * ts + ts - 1, ey = ty * ts + ts - 1;
+			uint32_t x0 = tx * ts > t->x0 ? tx * ts : t->x0;
+			uint32_t y0 = ty * ts > t->y0 ? ty * ts : t->y0;
+			uint32_t x1 = ex < t->x1 ? ex : t->x1;
+			uint32_t y1 = ey < t->y1 ? ey : t->y1;
+			int coverage = raster_classify_rect(
+				&t->edges, (int)x0, (int)y0, (int)x1, (int)y1);
+			uint32_t tile = ty * fb->tiles_x + tx;
+			if (coverage == RASTER_OUTSIDE ||
+			    tile_hidden(fb, tile, zfunc, t->depth))
+				continue;
+			RasterBin *bin = &bins->bins[tile];
+			if (!bin_append(bins, bin,
+					RASTER_BIN_REF(index,
+						       (uint32_t)coverage)))
+				LOG_ERROR("Dropped binned triangle in tile %u: "
+					  "out of memory",
+					  bin->tile);
+		}
+	}
+	mtx_unlock(&bins->lock);
+	return true;
+}
+
+void pipeline_rasterize_triangle(const RasterTriangle *restrict tri,
 				 const GLint *restrict viewport,
 				 Framebuffer *restrict fb)
 {
+	RasterEdges edges;
+	if (!raster_setup_edges(tri, &edges))
+		return;
 	float minx = tri->v0.x;
 	float maxx = tri->v0.x;
 	float miny = tri->v0.y;
 	float maxy = tri->v0.y;
 	for (int i = 1; i < 3; ++i) {
-		const Vertex *v = i == 1 ? &tri->v1 : &tri->v2;
+		const RasterVertex *v = i == 1 ? &tri->v1 : &tri->v2;
 		if (v->x < minx)
 			minx = v->x;
 		if (v->x > maxx)
@@ -43,16 +315,16 @@ void pipeline_rasterize_triangle(const Triangle *restrict tri,
 	int vp_y0 = viewport[1];
 	int vp_x1 = viewport[0] + viewport[2] - 1;
 	int vp_y1 = viewport[1] + viewport[3] - 1;
-	int iminx = (int)minx;
+	int iminx = (int)floorf(minx);
 	if (iminx < vp_x0)
 		iminx = vp_x0;
-	int iminy = (int)miny;
+	int iminy = (int)floorf(miny);
 	if (iminy < vp_y0)
 		iminy = vp_y0;
-	int imaxx = (int)maxx;
+	int imaxx = (int)floorf(maxx);
 	if (imaxx > vp_x1)
 		imaxx = vp_x1;
-	int imaxy = (int)maxy;
+	int imaxy = (int)floorf(maxy);
 	if (imaxy > vp_y1)
 		imaxy = vp_y1;
 	RenderContext *ctx = GetCurrentContext();
@@ -61,14 +333,6 @@ void pipeline_rasterize_triangle(const Triangle *restrict tri,
 		int sy = ctx->scissor_box[1];
 		int sx1 = sx + ctx->scissor_box[2] - 1;
 		int sy1 = sy + ctx->scissor_box[3] - 1;
-		if (sx < 0)
-			sx = 0;
-		if (sy < 0)
-			sy = 0;
-		if (sx1 >= (int)fb->width)
-			sx1 = fb->width - 1;
-		if (sy1 >= (int)fb->height)
-			sy1 = fb->height - 1;
 		if (iminx < sx)
 			iminx = sx;
 		if (iminy < sy)
@@ -78,37 +342,78 @@ void pipeline_rasterize_triangle(const Triangle *restrict tri,
 		if (imaxy > sy1)
 			imaxy = sy1;
 	}
+	if (iminx < 0)
+		iminx = 0;
+	if (iminy < 0)
+		iminy = 0;
+	if (imaxx >= (int)fb->width)
+		imaxx = fb->width - 1;
+	if (imaxy >= (int)fb->height)
+		imaxy = fb->height - 1;
 	if (iminx > imaxx || iminy > imaxy)
 		return;
-	int tiles_x = (imaxx - iminx) / fb->tile_size + 1;
-	int tiles_y = (imaxy - iminy) / fb->tile_size + 1;
-	LOG_DEBUG("Raster tri BB [%d,%d]-[%d,%d], %d tiles", iminx, iminy,
-		  imaxx, imaxy, tiles_x * tiles_y);
-	uint32_t color = pack_color(tri->v0.color);
-	for (int ty = iminy; ty <= imaxy; ty += fb->tile_size) {
-		for (int tx = iminx; tx <= imaxx; tx += fb->tile_size) {
-			int ex = tx + fb->tile_size - 1;
-			if (ex > imaxx)
-				ex = imaxx;
-			int ey = ty + fb->tile_size - 1;
-			if (ey > imaxy)
-				ey = imaxy;
-			FragmentTileJob *jobt = tile_job_acquire();
-			if (!jobt)
+	LOG_DEBUG("Raster tri BB [%d,%d]-[%d,%d]", iminx, iminy, imaxx,
+		  imaxy);
+	const GLenum zfunc = raster_bin_hiz_func(fb);
+	if (tl_bins && tl_bins->fb == fb) {
+		const BinnedTriangle t = {
+			.edges = edges,
+			.x0 = (uint32_t)iminx,
+			.y0 = (uint32_t)iminy,
+			.x1 = (uint32_t)imaxx,
+			.y1 = (uint32_t)imaxy,
+			.color = tri->v0.color,
+			.depth = tri->v0.z,
+		};
+		if (bin_triangle(tl_bins, &t, zfunc))
+			return;
+	}
+	const int ts = (int)fb->tile_size;
+	task_t batch[RASTER_TILE_BATCH];
+	size_t nbatch = 0;
+	/* One job per framebuffer tile the bounding box touches, clipped to
+	 * the box; tiles outside an edge or hidden are skipped here. */
+	for (int ty = iminy - iminy % ts; ty <= imaxy; ty += ts) {
+		for (int tx = iminx - iminx % ts; tx <= imaxx; tx += ts) {
+			int x0 = tx > iminx ? tx : iminx;
+			int y0 = ty > iminy ? ty : iminy;
+			int x1 = tx + ts - 1 < imaxx ? tx + ts - 1 : imaxx;
+			int y1 = ty + ts - 1 < imaxy ? ty + ts - 1 : imaxy;
+			int coverage =
+				raster_classify_rect(&edges, x0, y0, x1, y1);
+			uint32_t tile = ty / ts * fb->tiles_x + tx / ts;
+			if (coverage == RASTER_OUTSIDE ||
+			    tile_hidden(fb, tile, zfunc, tri->v0.z))
 				continue;
-			jobt->x0 = tx;
-			jobt->y0 = ty;
-			jobt->x1 = ex;
-			jobt->y1 = ey;
-			jobt->color = color;
+			FragmentTileJob *jobt;
+			while (!(jobt = tile_job_acquire())) {
+				/* Pool exhausted: publish what we have and
+				 * retire tiles until one comes back. */
+				thread_pool_submit_batch(batch, nbatch);
+				nbatch = 0;
+				thread_pool_run_pending(STAGE_FRAGMENT);
+			}
+			jobt->x0 = x0;
+			jobt->y0 = y0;
+			jobt->x1 = x1;
+			jobt->y1 = y1;
+			jobt->color = tri->v0.color;
 			jobt->depth = tri->v0.z;
 			jobt->fb = fb;
 			framebuffer_retain(jobt->fb);
 			jobt->sprite_mode = GL_FALSE;
-			thread_pool_submit(process_fragment_tile_job, jobt,
-					   STAGE_FRAGMENT);
+			jobt->coverage = (uint8_t)coverage;
+			jobt->edges = edges;
+			batch[nbatch++] = (task_t){ process_fragment_tile_job,
+						    jobt, STAGE_FRAGMENT,
+						    NULL };
+			if (nbatch == RASTER_TILE_BATCH) {
+				thread_pool_submit_batch(batch, nbatch);
+				nbatch = 0;
+			}
 		}
 	}
+	thread_pool_submit_batch(batch, nbatch);
 }
 
 void pipeline_rasterize_point(const Vertex *restrict v, GLfloat size,
@@ -155,24 +460,41 @@ void pipeline_rasterize_point(const Vertex *restrict v, GLfloat size,
 		if (y1 > sy1)
 			y1 = sy1;
 	}
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 >= (int)fb->width)
+		x1 = fb->width - 1;
+	if (y1 >= (int)fb->height)
+		y1 = fb->height - 1;
 	if (x0 > x1 || y0 > y1)
 		return;
 	int ptiles_x = (x1 - x0) / fb->tile_size + 1;
 	int ptiles_y = (y1 - y0) / fb->tile_size + 1;
 	LOG_DEBUG("Raster point BB [%d,%d]-[%d,%d], %d tiles", x0, y0, x1, y1,
 		  ptiles_x * ptiles_y);
-	uint32_t color = pack_color(v->color);
-	for (int ty = y0; ty <= y1; ty += fb->tile_size) {
-		for (int tx = x0; tx <= x1; tx += fb->tile_size) {
-			int ex = tx + fb->tile_size - 1;
+	uint32_t color = raster_pack_color(v->color);
+	task_t batch[RASTER_TILE_BATCH];
+	size_t nbatch = 0;
+	const int ts = (int)fb->tile_size;
+	/* Split at tile edges: a job never leaves the tile it locks. */
+	for (int ty = y0; ty <= y1; ty = ty - ty % ts + ts) {
+		for (int tx = x0; tx <= x1; tx = tx - tx % ts + ts) {
+			int ex = tx - tx % ts + ts - 1;
 			if (ex > x1)
 				ex = x1;
-			int ey = ty + fb->tile_size - 1;
+			int ey = ty - ty % ts + ts - 1;
 			if (ey > y1)
 				ey = y1;
-			FragmentTileJob *jobt = tile_job_acquire();
-			if (!jobt)
-				continue;
+			FragmentTileJob *jobt;
+			while (!(jobt = tile_job_acquire())) {
+				/* Pool exhausted: publish what we have and
+				 * retire tiles until one comes back. */
+				thread_pool_submit_batch(batch, nbatch);
+				nbatch = 0;
+				thread_pool_run_pending(STAGE_FRAGMENT);
+			}
 			jobt->x0 = tx;
 			jobt->y0 = ty;
 			jobt->x1 = ex;
@@ -182,20 +504,141 @@ void pipeline_rasterize_point(const Vertex *restrict v, GLfloat size,
 			jobt->fb = fb;
 			framebuffer_retain(jobt->fb);
 			jobt->sprite_mode = GL_TRUE;
+			jobt->coverage = RASTER_INSIDE;
 			jobt->sprite_cx = v->x;
 			jobt->sprite_cy = v->y;
 			jobt->sprite_size = size;
-			thread_pool_submit(process_fragment_tile_job, jobt,
-					   STAGE_FRAGMENT);
+			batch[nbatch++] = (task_t){ process_fragment_tile_job,
+						    jobt, STAGE_FRAGMENT,
+						    NULL };
+			if (nbatch == RASTER_TILE_BATCH) {
+				thread_pool_submit_batch(batch, nbatch);
+				nbatch = 0;
+			}
 		}
 	}
+	thread_pool_submit_batch(batch, nbatch);
+}
+
+/* Pixel bounds a line may touch: the viewport, scissor box and buffer. */
+typedef struct {
+	int x0, y0, x1, y1;
+} line_clip_t;
+
+/* Queue the span [x0,x1]x[y0,y1], which lies in a single tile. */
+static void queue_line_span(const line_clip_t *span, uint32_t color,
+			    float depth, Framebuffer *fb, task_t *batch,
+			    size_t *nbatch)
+{
+	FragmentTileJob *jobt;
+	while (!(jobt = tile_job_acquire())) {
+		thread_pool_submit_batch(batch, *nbatch);
+		*nbatch = 0;
+		thread_pool_run_pending(STAGE_FRAGMENT);
+	}
+	jobt->x0 = span->x0;
+	jobt->y0 = span->y0;
+	jobt->x1 = span->x1;
+	jobt->y1 = span->y1;
+	jobt->color = color;
+	jobt->depth = depth;
+	jobt->fb = fb;
+	framebuffer_retain(jobt->fb);
+	jobt->sprite_mode = GL_FALSE;
+	jobt->coverage = RASTER_INSIDE;
+	batch[(*nbatch)++] = (task_t){ process_fragment_tile_job, jobt,
+				       STAGE_FRAGMENT, NULL };
+	if (*nbatch == RASTER_TILE_BATCH) {
+		thread_pool_submit_batch(batch, *nbatch);
+		*nbatch = 0;
+	}
 }
 
-void process_raster_job(void *task_data)
+void pipeline_rasterize_line(const RasterVertex *restrict a,
+			     const RasterVertex *restrict b,
+			     const GLint *restrict viewport,
+			     Framebuffer *restrict fb)
 {
-	RasterJob *job = (RasterJob *)task_data;
-	plugin_invoke(STAGE_RASTER, job);
-	pipeline_rasterize_triangle(&job->tri, job->viewport, job->fb);
-	framebuffer_release(job->fb);
-	raster_job_release(job);
+	line_clip_t clip = { viewport[0], viewport[1],
+			     viewport[0] + viewport[2] - 1,
+			     viewport[1] + viewport[3] - 1 };
+	RenderContext *ctx = GetCurrentContext();
+	if (ctx->scissor_test_enabled) {
+		const GLint *sb = ctx->scissor_box;
+		if (clip.x0 < sb[0])
+			clip.x0 = sb[0];
+		if (clip.y0 < sb[1])
+			clip.y0 = sb[1];
+		if (clip.x1 > sb[0] + sb[2] - 1)
+			clip.x1 = sb[0] + sb[2] - 1;
+		if (clip.y1 > sb[1] + sb[3] - 1)
+			clip.y1 = sb[1] + sb[3] - 1;
+	}
+	if (clip.x0 < 0)
+		clip.x0 = 0;
+	if (clip.y0 < 0)
+		clip.y0 = 0;
+	if (clip.x1 >= (int)fb->width)
+		clip.x1 = fb->width - 1;
+	if (clip.y1 >= (int)fb->height)
+		clip.y1 = fb->height - 1;
+	if (clip.x0 > clip.x1 || clip.y0 > clip.y1)
+		return;
+
+	float dx = b->x - a->x;
+	float dy = b->y - a->y;
+	bool x_major = fabsf(dx) >= fabsf(dy);
+	int steps = (int)ceilf(x_major ? fabsf(dx) : fabsf(dy));
+	if (steps < 1)
+		steps = 1;
+	float sx = dx / steps;
+	float sy = dy / steps;
+	float sz = (b->z - a->z) / steps;
+	uint32_t color = a->color;
+	int ts = (int)fb->tile_size;
+	task_t batch[RASTER_TILE_BATCH];
+	size_t nbatch = 0;
+	line_clip_t span = { 0, 0, -1, -1 };
+	float span_z = 0.0f;
+	/* GL's diamond-exit rule leaves out the last pixel so connected
+	 * strip segments do not touch a shared pixel twice. */
+	for (int i = 0; i < steps; ++i) {
+		int px = (int)floorf(a->x + sx * i);
+		int py = (int)floorf(a->y + sy * i);
+		if (px < clip.x0 || px > clip.x1 || py < clip.y0 ||
+		    py > clip.y1)
+			continue;
+		bool open = span.x1 >= span.x0;
+		if (open && px >= span.x0 && px <= span.x1 && py >= span.y0 &&
+		    py <= span.y1)
+			continue; /* a sub-pixel step stayed on this pixel */
+		bool extend;
+		if (x_major)
+			extend = open && py == span.y0 &&
+				 px / ts == span.x0 / ts &&
+				 (px == span.x1 + 1 || px == span.x0 - 1);
+		else
+			extend = open && px == span.x0 &&
+				 py / ts == span.y0 / ts &&
+				 (py == span.y1 + 1 || py == span.y0 - 1);
+		if (extend) {
+			if (px < span.x0)
+				span.x0 = px;
+			if (px > span.x1)
+				span.x1 = px;
+			if (py < span.y0)
+				span.y0 = py;
+			if (py > span.y1)
+				span.y1 = py;
+			continue;
+		}
+		if (open)
+			queue_line_span(&span, color, span_z, fb, batch,
+					&nbatch);
+		span = (line_clip_t){ px, py, px, py };
+		span_z = a->z + sz * i;
+	}
+	if (span.x1 >= span.x0)
+		queue_line_span(&span, color, span_z, fb, batch, &nbatch);
+	thread_pool_submit_batch(batch, nbatch);
 }
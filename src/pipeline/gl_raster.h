@@ -9,15 +9,123 @@
 extern "C" {
 #endif
 
-void pipeline_rasterize_triangle(const Triangle *restrict tri,
+/* Clamp @p c to [0, 1] and pack it as AARRGGBB. */
+static inline uint32_t raster_pack_color(const GLfloat c[4])
+{
+	uint32_t out = 0;
+	static const int shift[4] = { 16, 8, 0, 24 };
+	for (int i = 0; i < 4; ++i) {
+		GLfloat v = c[i] < 0.0f ? 0.0f : c[i] > 1.0f ? 1.0f : c[i];
+		out |= (uint32_t)(v * 255.0f + 0.5f) << shift[i];
+	}
+	return out;
+}
+
+static inline void raster_unpack_color(uint32_t color, GLfloat c[4])
+{
+	c[0] = (GLfloat)((color >> 16) & 0xff) / 255.0f;
+	c[1] = (GLfloat)((color >> 8) & 0xff) / 255.0f;
+	c[2] = (GLfloat)(color & 0xff) / 255.0f;
+	c[3] = (GLfloat)(color >> 24) / 255.0f;
+}
+
+/* Sub-pixel bits of the fixed-point window coordinates triangles are
+ * rasterized with, and the side of the square blocks tiles are walked in. */
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_BLOCK_SIZE 8
+_Static_assert(RASTER_BLOCK_SIZE == FB_HIZ_BLOCK_SIZE,
+	       "raster blocks must match the depth bound blocks");
+
+/* The three edge functions of a triangle, positive inside. Edge k at the
+ * center of pixel (x, y) is c[k] + a[k] * x + b[k] * y; the top-left fill
+ * rule is folded into c so a pixel is covered when all three are >= 0. */
+typedef struct {
+	int64_t c[3];
+	int64_t a[3];
+	int64_t b[3];
+} RasterEdges;
+
+/* How much of a pixel rectangle a triangle covers. */
+enum { RASTER_OUTSIDE, RASTER_PARTIAL, RASTER_INSIDE };
+
+/* Classify the pixel centers of [x0, x1] x [y0, y1] against @p e from the
+ * rectangle corner that maximizes, then minimizes, each edge. */
+static inline int raster_classify_rect(const RasterEdges *e, int x0, int y0,
+				       int x1, int y1)
+{
+	int coverage = RASTER_INSIDE;
+	for (int k = 0; k < 3; ++k) {
+		int64_t hi = e->c[k] + e->a[k] * (e->a[k] > 0 ? x1 : x0) +
+			     e->b[k] * (e->b[k] > 0 ? y1 : y0);
+		if (hi < 0)
+			return RASTER_OUTSIDE;
+		int64_t lo = e->c[k] + e->a[k] * (e->a[k] > 0 ? x0 : x1) +
+			     e->b[k] * (e->b[k] > 0 ? y0 : y1);
+		if (lo < 0)
+			coverage = RASTER_PARTIAL;
+	}
+	return coverage;
+}
+
+/* Whether depth test @p func fails for every fragment with a depth in
+ * [zmin, zmax] against stored depths that all lie in [lo, hi]. */
+static inline bool raster_depth_rejects(GLenum func, float zmin, float zmax,
+					float lo, float hi)
+{
+	switch (func) {
+	case GL_NEVER:
+		return true;
+	case GL_LESS:
+		return zmin >= hi;
+	case GL_LEQUAL:
+		return zmin > hi;
+	case GL_GREATER:
+		return zmax <= lo;
+	case GL_GEQUAL:
+		return zmax < lo;
+	case GL_EQUAL:
+		return zmax < lo || zmin > hi;
+	default:
+		return false;
+	}
+}
+
+/* The depth function hierarchical Z may reject fragments by, or GL_ALWAYS
+ * when it must not: the depth test is off, or stencil operations would
+ * still run for the failing fragments. */
+GLenum raster_hiz_func(void);
+
+/* The depth function triangles may be rejected by against @p fb's tile
+ * bounds while they are binned, ahead of the fragment jobs still queued
+ * for the buffer. Only GL_LESS and GL_LEQUAL qualify, and only while no
+ * draw since the last framebuffer_wait() could have raised stored depth;
+ * otherwise GL_ALWAYS. */
+GLenum raster_bin_hiz_func(const Framebuffer *fb);
+
+/* Note a draw about to be recorded against @p fb with the current depth
+ * state, for raster_bin_hiz_func(). */
+void raster_hiz_note_draw(Framebuffer *fb);
+
+/* Bin @p tri, or queue fragment tile jobs for it outside a draw's bins,
+ * for its pixels inside the viewport and scissor box. Tiles the triangle
+ * misses or is hidden in get nothing; the rest carry its edges and its
+ * coverage. */
+void pipeline_rasterize_triangle(const RasterTriangle *restrict tri,
 				 const GLint *restrict viewport,
 				 Framebuffer *restrict fb);
 void pipeline_rasterize_point(const Vertex *restrict v, GLfloat size,
 			      const GLint *restrict viewport,
 			      Framebuffer *restrict fb);
+/* One pixel wide segment from @p a to @p b in @p a's color, emitted as
+ * row or column spans split at tile edges. */
+void pipeline_rasterize_line(const RasterVertex *restrict a,
+			     const RasterVertex *restrict b,
+			     const GLint *restrict viewport,
+			     Framebuffer *restrict fb);
 
 typedef struct {
-	alignas(64) uint32_t x0, y0, x1, y1;
+	alignas(64) uint32_t x0;
+	uint32_t y0, x1, y1;
 	uint32_t color;
 	float depth;
 	Framebuffer *fb;
@@ -25,22 +133,87 @@ typedef struct {
 	GLfloat sprite_cx;
 	GLfloat sprite_cy;
 	GLfloat sprite_size;
+	/* RASTER_INSIDE shades the whole rectangle; RASTER_PARTIAL walks it
+	 * in blocks and shades the pixels inside edges. */
+	uint8_t coverage;
+	RasterEdges edges;
 } FragmentTileJob;
-_Static_assert(sizeof(FragmentTileJob) == 256,
-	       "FragmentTileJob size must be 256 bytes");
+_Static_assert(sizeof(FragmentTileJob) == 128,
+	       "FragmentTileJob size must be 128 bytes");
 _Static_assert(alignof(FragmentTileJob) >= 64,
 	       "FragmentTileJob must be 64-byte aligned");
 
+void process_fragment_tile_job(void *task_data);
+
+/*
+ * Sort-middle binning. While the vertex tasks of a triangle draw run, the
+ * rasterizer appends each triangle to the lists of the framebuffer tiles
+ * it touches instead of queuing tile jobs. When the last task lets go of
+ * the draw's bins, every tile with a list gets one fragment job that
+ * shades its triangles in the order they were binned.
+ */
+typedef struct RasterBins RasterBins;
+
+/* A binned triangle: its edges, pixel bounds and flat color and depth. */
+typedef struct {
+	RasterEdges edges;
+	uint32_t x0, y0, x1, y1;
+	uint32_t color;
+	float depth;
+} BinnedTriangle;
+
+/* A bin reference: a triangle index and its coverage of the tile. */
+#define RASTER_BIN_REF(tri, coverage) ((tri) << 2 | (coverage))
+#define RASTER_BIN_TRIANGLE(ref) ((ref) >> 2)
+#define RASTER_BIN_COVERAGE(ref) ((ref) & 3)
+
+/* Bin references are kept in cache-line chunks shared by all of a draw's
+ * tiles, so a tile's list grows without an allocation of its own. */
+#define RASTER_BIN_CHUNK_REFS 15
+typedef struct {
+	uint32_t next; /* index + 1 of the next chunk, 0 at the end */
+	uint32_t refs[RASTER_BIN_CHUNK_REFS];
+} RasterBinChunk;
+_Static_assert(sizeof(RasterBinChunk) == 64,
+	       "RasterBinChunk must be 64 bytes");
+
+/* The triangles binned to one framebuffer tile. */
 typedef struct {
-	alignas(64) Triangle tri;
+	RasterBins *bins;
+	uint32_t tile; /* index into fb->tiles */
+	uint32_t count;
+	uint32_t head, tail; /* index + 1 of the first and last chunk */
+} RasterBin;
+
+struct RasterBins {
 	Framebuffer *fb;
-	GLint viewport[4];
-} RasterJob;
-_Static_assert(sizeof(RasterJob) == 256, "RasterJob size must be 256 bytes");
-_Static_assert(alignof(RasterJob) >= 64, "RasterJob must be 64-byte aligned");
+	atomic_int refs; /* the recording thread and unfinished tasks */
+	atomic_uint tiles_left; /* bin jobs still running */
+	mtx_t lock; /* guards appends while tasks are binning */
+	BinnedTriangle *tris;
+	uint32_t ntris;
+	uint32_t tris_capacity;
+	RasterBinChunk *chunks;
+	uint32_t nchunks;
+	uint32_t chunks_capacity;
+	RasterBin *bins; /* one per framebuffer tile */
+};
 
-void process_raster_job(void *task_data);
-void process_fragment_tile_job(void *task_data);
+/* Empty bins for a draw into @p fb, held by the caller; NULL when out of
+ * memory, in which case triangles are queued as tile jobs directly. */
+RasterBins *raster_bins_create(Framebuffer *fb);
+/* Take a reference for a task that will bin into @p bins (may be NULL). */
+void raster_bins_retain(RasterBins *bins);
+/* Drop a reference; the last one queues the tile jobs. */
+void raster_bins_release(RasterBins *bins);
+/* Bin this thread's triangles into @p bins until raster_bins_leave(). */
+void raster_bins_enter(RasterBins *bins);
+void raster_bins_leave(void);
+/* Called by a tile's fragment job once it has shaded @p bin. */
+void raster_bin_done(RasterBin *bin);
+
+/* Task body shading one RasterBin. */
+void process_fragment_bin_job(void *task_data);
 
 #ifdef __cplusplus
 }
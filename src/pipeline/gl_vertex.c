@@ -1,5 +1,7 @@
 #include "gl_vertex.h"
 #include "gl_primitive.h"
+#include "gl_raster.h"
+#include "gl_vertex_simd.h"
 #include "../gl_context.h"
 #include "../gl_logger.h"
 #define PIPELINE_USE_GLSTATE 0
@@ -22,17 +24,32 @@ _Static_assert(PIPELINE_USE_GLSTATE == 0, "pipeline must not touch gl_state");
  */
 
 void pipeline_transform_vertex(Vertex *restrict dst, const Vertex *restrict src,
-			       const mat4 *restrict mvp,
+			       const mat4 *restrict mvp, mat4_class cls,
 			       const mat4 *restrict normal_mat,
-			       const GLint *restrict viewport)
+			       const GLint *restrict viewport,
+			       GLfloat *restrict clip)
 {
 	GLfloat in[4] = { src->x, src->y, src->z, src->w };
 	GLfloat out[4];
-	mat4_transform_vec4(mvp, in, out);
-	GLfloat inv_w = out[3] != 0.0f ? 1.0f / out[3] : 1.0f;
-	GLfloat ndc_x = out[0] * inv_w;
-	GLfloat ndc_y = out[1] * inv_w;
-	GLfloat ndc_z = out[2] * inv_w;
+	GLfloat ndc_x, ndc_y, ndc_z;
+	if (cls <= MAT4_AFFINE && src->w == 1.0f) {
+		const GLfloat *m = mvp->data;
+		out[0] = m[0] * in[0] + m[4] * in[1] + m[8] * in[2] + m[12];
+		out[1] = m[1] * in[0] + m[5] * in[1] + m[9] * in[2] + m[13];
+		out[2] = m[2] * in[0] + m[6] * in[1] + m[10] * in[2] + m[14];
+		out[3] = 1.0f;
+		ndc_x = out[0];
+		ndc_y = out[1];
+		ndc_z = out[2];
+	} else {
+		mat4_transform_vec4(mvp, in, out);
+		GLfloat inv_w = out[3] != 0.0f ? 1.0f / out[3] : 1.0f;
+		ndc_x = out[0] * inv_w;
+		ndc_y = out[1] * inv_w;
+		ndc_z = out[2] * inv_w;
+	}
+	if (clip)
+		memcpy(clip, out, sizeof(out));
 	dst->x = viewport[0] + (ndc_x * 0.5f + 0.5f) * viewport[2];
 	dst->y = viewport[1] + (1.0f - (ndc_y * 0.5f + 0.5f)) * viewport[3];
 	dst->z = ndc_z;
@@ -56,6 +73,7 @@ void pipeline_transform_vertex(Vertex *restrict dst, const Vertex *restrict src,
 }
 
 static _Thread_local mat4 tl_mvp;
+static _Thread_local mat4_class tl_mvp_class;
 static _Thread_local mat4 tl_normal;
 static _Thread_local unsigned seen_mv, seen_proj;
 static _Thread_local unsigned seen_normal;
@@ -63,34 +81,29 @@ static _Thread_local LightState tl_lights[8];
 static _Thread_local unsigned seen_light[8];
 static _Thread_local MaterialState tl_mat;
 static _Thread_local unsigned seen_mat;
+static _Thread_local unsigned seen_normal_mode, seen_setup_mv;
+static _Thread_local bool tl_setup_valid;
+static _Thread_local LightingSetup tl_setup;
 
-static void apply_lighting(Vertex *v)
+void lighting_setup_init(LightingSetup *s, const LightState *lights,
+			 const MaterialState *mat, int normal_mode,
+			 const mat4 *normal_mat)
 {
-	RenderContext *ctx = GetCurrentContext();
-	for (int i = 0; i < 8; ++i) {
-		unsigned lv = atomic_load(&ctx->lights[i].version);
-		if (lv != seen_light[i]) {
-			memcpy(&tl_lights[i], &ctx->lights[i],
-			       sizeof(LightState));
-			seen_light[i] = lv;
-		}
-	}
-	unsigned mv = atomic_load(&ctx->material.version);
-	if (mv != seen_mat) {
-		memcpy(&tl_mat, &ctx->material, sizeof(MaterialState));
-		seen_mat = mv;
-	}
-	float r = tl_mat.emission[0];
-	float g = tl_mat.emission[1];
-	float b = tl_mat.emission[2];
-	float nx = v->normal[0];
-	float ny = v->normal[1];
-	float nz = v->normal[2];
-	vec3_normalize(&nx, &ny, &nz);
+	memset(s, 0, sizeof(*s));
+	s->normal_mode = normal_mode;
+	const GLfloat *n = normal_mat->data;
+	GLfloat len = GL_SQRT(n[8] * n[8] + n[9] * n[9] + n[10] * n[10]);
+	s->rescale = len > 0.0f ? 1.0f / len : 1.0f;
+	for (int c = 0; c < 3; ++c)
+		s->base[c] = mat->emission[c];
+	s->base[3] = mat->diffuse[3];
+	s->shininess = mat->shininess;
 	for (int li = 0; li < 8; ++li) {
-		LightState *lt = &tl_lights[li];
+		const LightState *lt = &lights[li];
 		if (!lt->enabled)
 			continue;
+		s->mask |= 1u << li;
+		LightTerms *t = &s->lights[s->count++];
 		float lx = -lt->position[0];
 		float ly = -lt->position[1];
 		float lz = -lt->position[2];
@@ -100,41 +113,120 @@ static void apply_lighting(Vertex *v)
 			ly /= dist;
 			lz /= dist;
 		}
-		float att = 1.0f / (lt->constant_attenuation +
-				    lt->linear_attenuation * dist +
-				    lt->quadratic_attenuation * dist * dist);
-		float dot = nx * lx + ny * ly + nz * lz;
-		dot = GL_MAX(dot, 0.0f);
+		/* Lights sit at a fixed direction from every vertex, so the
+		 * attenuation folds into the products below. */
+		float att = 1.0f;
+		if (lt->linear_attenuation != 0.0f ||
+		    lt->quadratic_attenuation != 0.0f ||
+		    lt->constant_attenuation != 1.0f)
+			att = 1.0f / (lt->constant_attenuation +
+				      lt->linear_attenuation * dist +
+				      lt->quadratic_attenuation * dist * dist);
+		t->l[0] = lx;
+		t->l[1] = ly;
+		t->l[2] = lz;
 		float hx = lx;
 		float hy = ly;
 		float hz = lz + 1.0f;
-		float spec = 0.0f;
-		if (hx != 0.0f || hy != 0.0f || hz != 0.0f) {
+		bool has_h = hx != 0.0f || hy != 0.0f || hz != 0.0f;
+		if (has_h)
 			vec3_normalize(&hx, &hy, &hz);
-			float spec_dot = nx * hx + ny * hy + nz * hz;
-			spec_dot = GL_MAX(spec_dot, 0.0f);
-			spec = GL_POW(spec_dot, tl_mat.shininess);
+		t->h[0] = hx;
+		t->h[1] = hy;
+		t->h[2] = hz;
+		for (int c = 0; c < 3; ++c) {
+			s->base[c] += mat->ambient[c] * lt->ambient[c] * att;
+			t->kd[c] = mat->diffuse[c] * lt->diffuse[c] * att;
+			t->ks[c] = mat->specular[c] * lt->specular[c] * att;
+			if (has_h && t->ks[c] != 0.0f)
+				t->specular = true;
+		}
+		s->specular |= t->specular;
+	}
+}
+
+void pipeline_light_vertex(GLfloat color[4], const GLfloat normal[3],
+			   const LightingSetup *s)
+{
+	float nx = normal[0];
+	float ny = normal[1];
+	float nz = normal[2];
+	if (s->normal_mode == NORMAL_NORMALIZE) {
+		vec3_normalize(&nx, &ny, &nz);
+	} else if (s->normal_mode == NORMAL_RESCALE) {
+		nx *= s->rescale;
+		ny *= s->rescale;
+		nz *= s->rescale;
+	}
+	float r = s->base[0];
+	float g = s->base[1];
+	float b = s->base[2];
+	for (int li = 0; li < s->count; ++li) {
+		const LightTerms *t = &s->lights[li];
+		float dot = nx * t->l[0] + ny * t->l[1] + nz * t->l[2];
+		dot = GL_MAX(dot, 0.0f);
+		r += t->kd[0] * dot;
+		g += t->kd[1] * dot;
+		b += t->kd[2] * dot;
+		if (!t->specular)
+			continue;
+		float spec_dot = nx * t->h[0] + ny * t->h[1] + nz * t->h[2];
+		float spec = GL_POW(GL_MAX(spec_dot, 0.0f), s->shininess);
+		r += t->ks[0] * spec;
+		g += t->ks[1] * spec;
+		b += t->ks[2] * spec;
+	}
+	color[0] = r;
+	color[1] = g;
+	color[2] = b;
+	color[3] = s->base[3];
+}
+
+/* Refresh this thread's lighting setup after update_matrices(). Returns
+ * false when lighting is disabled and vertex colors pass through. */
+static bool update_lighting(void)
+{
+	RenderContext *ctx = GetCurrentContext();
+	if (!ctx->lighting_enabled)
+		return false;
+	bool dirty = !tl_setup_valid;
+	for (int i = 0; i < 8; ++i) {
+		unsigned lv = atomic_load(&ctx->lights[i].version);
+		if (lv != seen_light[i] || !tl_setup_valid) {
+			memcpy(&tl_lights[i], &ctx->lights[i],
+			       sizeof(LightState));
+			seen_light[i] = lv;
+			dirty = true;
 		}
-		r += tl_mat.ambient[0] * lt->ambient[0] * att +
-		     tl_mat.diffuse[0] * lt->diffuse[0] * dot * att +
-		     tl_mat.specular[0] * lt->specular[0] * spec * att;
-		g += tl_mat.ambient[1] * lt->ambient[1] * att +
-		     tl_mat.diffuse[1] * lt->diffuse[1] * dot * att +
-		     tl_mat.specular[1] * lt->specular[1] * spec * att;
-		b += tl_mat.ambient[2] * lt->ambient[2] * att +
-		     tl_mat.diffuse[2] * lt->diffuse[2] * dot * att +
-		     tl_mat.specular[2] * lt->specular[2] * spec * att;
-	}
-	v->color[0] = r;
-	v->color[1] = g;
-	v->color[2] = b;
-	v->color[3] = tl_mat.diffuse[3];
+	}
+	unsigned mv = atomic_load(&ctx->material.version);
+	if (mv != seen_mat || !tl_setup_valid) {
+		memcpy(&tl_mat, &ctx->material, sizeof(MaterialState));
+		seen_mat = mv;
+		dirty = true;
+	}
+	int mode = ctx->normalize_enabled	 ? NORMAL_NORMALIZE :
+		   ctx->rescale_normal_enabled ? NORMAL_RESCALE :
+						 NORMAL_AS_IS;
+	if ((unsigned)mode != seen_normal_mode) {
+		seen_normal_mode = (unsigned)mode;
+		dirty = true;
+	}
+	if (mode == NORMAL_RESCALE && seen_normal != seen_setup_mv) {
+		seen_setup_mv = seen_normal;
+		dirty = true;
+	}
+	if (dirty) {
+		lighting_setup_init(&tl_setup, tl_lights, &tl_mat, mode,
+				    &tl_normal);
+		tl_setup_valid = true;
+	}
+	return true;
 }
 
-void process_vertex_job(void *task_data)
+/* Refresh this thread's copies of the MVP and normal matrices. */
+static void update_matrices(void)
 {
-	VertexJob *job = (VertexJob *)task_data;
-	plugin_invoke(STAGE_VERTEX, job);
 	RenderContext *ctx = GetCurrentContext();
 	unsigned mv = atomic_load(&ctx->version_modelview);
 	unsigned pr = atomic_load(&ctx->version_projection);
@@ -143,6 +235,8 @@ void process_vertex_job(void *task_data)
 		mat4_multiply(&mul, &ctx->projection_matrix,
 			      &ctx->modelview_matrix);
 		tl_mvp = mul;
+		tl_mvp_class = mat4_class_product(ctx->projection_class,
+						  ctx->modelview_class);
 		seen_mv = mv;
 		seen_proj = pr;
 	}
@@ -153,38 +247,179 @@ void process_vertex_job(void *task_data)
 		mat4_transpose(&tl_normal);
 		seen_normal = mv;
 	}
-	Vertex v0, v1, v2;
-	pipeline_transform_vertex(&v0, &job->in[0], &tl_mvp, &tl_normal,
-				  job->viewport);
-	pipeline_transform_vertex(&v1, &job->in[1], &tl_mvp, &tl_normal,
-				  job->viewport);
-	pipeline_transform_vertex(&v2, &job->in[2], &tl_mvp, &tl_normal,
-				  job->viewport);
-	apply_lighting(&v0);
-	apply_lighting(&v1);
-	apply_lighting(&v2);
-	LOG_DEBUG("Vertex0: (%.2f, %.2f, %.2f, %.2f) col(%.2f %.2f %.2f %.2f)",
-		  v0.x, v0.y, v0.z, v0.w, v0.color[0], v0.color[1], v0.color[2],
-		  v0.color[3]);
-	LOG_DEBUG("Vertex1: (%.2f, %.2f, %.2f, %.2f) col(%.2f %.2f %.2f %.2f)",
-		  v1.x, v1.y, v1.z, v1.w, v1.color[0], v1.color[1], v1.color[2],
-		  v1.color[3]);
-	LOG_DEBUG("Vertex2: (%.2f, %.2f, %.2f, %.2f) col(%.2f %.2f %.2f %.2f)",
-		  v2.x, v2.y, v2.z, v2.w, v2.color[0], v2.color[1], v2.color[2],
-		  v2.color[3]);
-	PrimitiveJob *pjob = MT_ALLOC(sizeof(PrimitiveJob), STAGE_PRIMITIVE);
-	if (!pjob) {
-		framebuffer_release(job->fb);
-		vertex_job_release(job);
+}
+
+/* Attribute arrays start on a cache line so the SoA loops stay aligned, and
+ * are padded to one so the vector kernels can run whole vectors. */
+static size_t batch_array_bytes(uint32_t n, size_t elem)
+{
+	return (n * elem + 63) & ~(size_t)63;
+}
+
+VertexBatch *vertex_batch_create(uint32_t nverts, GLenum mode,
+				 uint32_t nprims)
+{
+	uint32_t nelems = primitive_elements(mode, nprims);
+	size_t floats = batch_array_bytes(nverts, sizeof(GLfloat));
+	size_t size = batch_array_bytes(1, sizeof(VertexBatch)) +
+		      19 * floats + batch_array_bytes(nverts, 1) +
+		      batch_array_bytes(nverts, sizeof(RasterVertex)) +
+		      batch_array_bytes(nelems, sizeof(uint16_t));
+	uint8_t *mem = MT_ALIGNED_ALLOC(64, size, STAGE_VERTEX);
+	if (!mem)
+		return NULL;
+	VertexBatch *b = (VertexBatch *)mem;
+	memset(b, 0, sizeof(*b));
+	b->nverts = nverts;
+	b->nelems = nelems;
+	b->nprims = nprims;
+	b->mode = mode;
+	b->position_size = 4;
+	mem += batch_array_bytes(1, sizeof(VertexBatch));
+	GLfloat **arrays[18] = { &b->x,		  &b->y,	   &b->z,
+				 &b->w,		  &b->nx,	   &b->ny,
+				 &b->nz,	  &b->color[0],	   &b->color[1],
+				 &b->color[2],	  &b->color[3],	   &b->texcoord[0],
+				 &b->texcoord[1], &b->texcoord[2], &b->texcoord[3],
+				 &b->sx,	  &b->sy,	   &b->sz };
+	size_t used = nverts * sizeof(GLfloat);
+	for (int i = 0; i < 18; ++i) {
+		*arrays[i] = (GLfloat *)mem;
+		memset(mem + used, 0, floats - used);
+		mem += floats;
+	}
+	_Static_assert(sizeof(int32_t) == sizeof(GLfloat),
+		       "outcodes share the attribute array layout");
+	b->clip = (int32_t *)mem;
+	memset(mem + used, 0, floats - used);
+	mem += floats;
+	b->live = mem;
+	memset(mem, 1, nverts);
+	memset(mem + nverts, 0, batch_array_bytes(nverts, 1) - nverts);
+	mem += batch_array_bytes(nverts, 1);
+	b->out = (RasterVertex *)mem;
+	mem += batch_array_bytes(nverts, sizeof(RasterVertex));
+	b->elems = (uint16_t *)mem;
+	return b;
+}
+
+void vertex_batch_destroy(VertexBatch *batch)
+{
+	if (!batch)
+		return;
+	raster_bins_release(batch->bins);
+	framebuffer_release(batch->fb);
+	MT_FREE(batch, STAGE_VERTEX);
+}
+
+/* Pack the transformed and lit SoA attributes into out[] for assembly. */
+static void pack_batch(VertexBatch *restrict b)
+{
+	RasterVertex *restrict out = b->out;
+	for (uint32_t i = 0; i < b->nverts; ++i) {
+		if (!b->live[i])
+			continue;
+		const GLfloat c[4] = { b->color[0][i], b->color[1][i],
+				       b->color[2][i], b->color[3][i] };
+		out[i] = (RasterVertex){
+			.x = b->sx[i],
+			.y = b->sy[i],
+			.z = b->sz[i],
+			.inv_w = b->w[i] != 0.0f ? 1.0f / b->w[i] : 1.0f,
+			.s = b->texcoord[0][i],
+			.t = b->texcoord[1][i],
+			.color = raster_pack_color(c),
+		};
+	}
+}
+
+/* Mark the batch's triangles that culling discards and clear live[] for
+ * vertices only they use. Returns the number of surviving primitives. */
+static uint32_t cull_batch(VertexBatch *b)
+{
+	memset(b->live, 0, b->nverts);
+	uint32_t alive = 0;
+	for (uint32_t p = 0; p < b->nprims; ++p) {
+		uint32_t e[3];
+		GLfloat x[3], y[3], w[3];
+		primitive_vertices(b->mode, p, e);
+		for (int k = 0; k < 3; ++k) {
+			uint16_t s = b->elems[e[k]];
+			x[k] = b->x[s];
+			y[k] = b->y[s];
+			w[k] = b->w[s];
+		}
+		if (cull_triangle(x, y, w, b->cull)) {
+			b->culled[p >> 6] |= (uint64_t)1 << (p & 63);
+			continue;
+		}
+		for (int k = 0; k < 3; ++k)
+			b->live[b->elems[e[k]]] = 1;
+		++alive;
+	}
+	return alive;
+}
+
+/* STAGE_VERTEX plugins take a VertexJob. Hand them the batch's vertices
+ * three at a time, padding the last job with copies of the final vertex,
+ * and copy back what they change. */
+static void run_vertex_plugins(VertexBatch *restrict b)
+{
+	VertexJob job = { .fb = b->fb, .bins = b->bins, .cull = b->cull };
+	memcpy(job.viewport, b->viewport, sizeof(job.viewport));
+	for (uint32_t i = 0; i < b->nverts; i += 3) {
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t s = i + k < b->nverts ? i + k : b->nverts - 1;
+			Vertex *v = &job.in[k];
+			*v = (Vertex){ .x = b->x[s],
+				       .y = b->y[s],
+				       .z = b->z[s],
+				       .w = b->w[s],
+				       .normal = { b->nx[s], b->ny[s],
+						   b->nz[s] } };
+			for (int c = 0; c < 4; ++c) {
+				v->color[c] = b->color[c][s];
+				v->texcoord[c] = b->texcoord[c][s];
+			}
+		}
+		plugin_invoke(STAGE_VERTEX, &job);
+		for (uint32_t k = 0; k < 3 && i + k < b->nverts; ++k) {
+			const Vertex *v = &job.in[k];
+			uint32_t s = i + k;
+			b->x[s] = v->x;
+			b->y[s] = v->y;
+			b->z[s] = v->z;
+			b->w[s] = v->w;
+			b->nx[s] = v->normal[0];
+			b->ny[s] = v->normal[1];
+			b->nz[s] = v->normal[2];
+			for (int c = 0; c < 4; ++c) {
+				b->color[c][s] = v->color[c];
+				b->texcoord[c][s] = v->texcoord[c];
+			}
+		}
+	}
+	/* A plugin may have written z or w. */
+	b->position_size = 4;
+}
+
+void process_vertex_batch_job(void *task_data)
+{
+	VertexBatch *b = (VertexBatch *)task_data;
+	if (plugin_registered(STAGE_VERTEX))
+		run_vertex_plugins(b);
+	update_matrices();
+	bool lit = update_lighting();
+	vertex_transform_soa(b, &tl_mvp, tl_mvp_class, lit ? &tl_normal : NULL);
+	if (!primitive_is_line(b->mode) && !cull_batch(b)) {
+		vertex_batch_destroy(b);
 		return;
 	}
-	pjob->verts[0] = v0;
-	pjob->verts[1] = v1;
-	pjob->verts[2] = v2;
-	pjob->fb = job->fb;
-	framebuffer_retain(pjob->fb);
-	memcpy(pjob->viewport, job->viewport, sizeof(job->viewport));
-	framebuffer_release(job->fb);
-	vertex_job_release(job);
-	thread_pool_submit(process_primitive_job, pjob, STAGE_PRIMITIVE);
+	if (lit)
+		vertex_light_soa(b, &tl_setup);
+	pack_batch(b);
+	raster_bins_enter(b->bins);
+	pipeline_assemble_batch(b);
+	raster_bins_leave();
+	vertex_batch_destroy(b);
 }
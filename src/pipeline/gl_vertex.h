@@ -2,9 +2,13 @@
 #define GL_VERTEX_H
 
 #include "../gl_types.h"
+#include "../gl_context.h"
 #include "../matrix_utils.h"
 #include "gl_framebuffer.h"
+#include "gl_raster.h"
 #include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,16 +17,179 @@ extern "C" {
 typedef struct {
 	alignas(64) Vertex in[3];
 	Framebuffer *fb;
+	RasterBins *bins; /* the draw's bins, or NULL to queue tile jobs */
 	GLint viewport[4];
+	uint8_t cull; /* CULL_* windings to discard */
 } VertexJob;
 _Static_assert(sizeof(VertexJob) == 256, "VertexJob size must be 256 bytes");
 _Static_assert(alignof(VertexJob) >= 64, "VertexJob must be 64-byte aligned");
 
+/* Clip-space outcodes the vertex stage hands to the clip stage in
+ * gl_primitive.c. CLIP_GUARD marks a vertex outside the guard band: the
+ * NDC range of +-CLIP_GUARD_BAND in x and y inside which triangles are
+ * left to the rasterizer's viewport bounds instead of being clipped.
+ * Window coordinates stay well inside int range within the band. */
+#define CLIP_GUARD_BAND 8.0f
+enum {
+	CLIP_LEFT = 1 << 0,
+	CLIP_RIGHT = 1 << 1,
+	CLIP_BOTTOM = 1 << 2,
+	CLIP_TOP = 1 << 3,
+	CLIP_NEAR = 1 << 4,
+	CLIP_FAR = 1 << 5,
+	CLIP_GUARD = 1 << 6,
+};
+/* Bits that reject a primitive when all of its vertices share one. */
+#define CLIP_FRUSTUM_MASK 0x3f
+
+static inline int32_t clip_outcode(GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+	const GLfloat g = CLIP_GUARD_BAND * w;
+	return (x < -w ? CLIP_LEFT : 0) | (x > w ? CLIP_RIGHT : 0) |
+	       (y < -w ? CLIP_BOTTOM : 0) | (y > w ? CLIP_TOP : 0) |
+	       (z < -w ? CLIP_NEAR : 0) | (z > w ? CLIP_FAR : 0) |
+	       (x < -g || x > g || y < -g || y > g ? CLIP_GUARD : 0);
+}
+
+/* Triangle windings the cull state discards, by the orientation of the
+ * triangle in NDC (GL's window orientation for a positive viewport). */
+enum {
+	CULL_CCW = 1 << 0,
+	CULL_CW = 1 << 1,
+};
+
+/* Resolve glEnable(GL_CULL_FACE), glCullFace and glFrontFace to CULL_*
+ * bits; recorded with each draw. */
+static inline uint8_t cull_windings(GLboolean enabled, GLenum face,
+				    GLenum front_face)
+{
+	if (!enabled)
+		return 0;
+	uint8_t front = front_face == GL_CW ? CULL_CW : CULL_CCW;
+	uint8_t back = front ^ (CULL_CW | CULL_CCW);
+	switch (face) {
+	case GL_FRONT:
+		return front;
+	case GL_FRONT_AND_BACK:
+		return front | back;
+	default:
+		return back;
+	}
+}
+
+/* Whether the triangle with clip-space positions (x, y, w) is discarded.
+ * The sign of det[x y w] is its NDC winding (positive for CCW) and stays
+ * valid for vertices behind the eye, so facing is known before clipping
+ * or lighting. Zero-area triangles are always dropped. */
+static inline bool cull_triangle(const GLfloat x[3], const GLfloat y[3],
+				 const GLfloat w[3], uint8_t cull)
+{
+	GLfloat det = x[0] * (y[1] * w[2] - y[2] * w[1]) -
+		      y[0] * (x[1] * w[2] - x[2] * w[1]) +
+		      w[0] * (x[1] * y[2] - x[2] * y[1]);
+	if (det == 0.0f)
+		return true;
+	return (cull & (det > 0.0f ? CULL_CCW : CULL_CW)) != 0;
+}
+
+/* Primitives per vertex batch; bounds a batch at 3072 elements. */
+#define VERTEX_BATCH_MAX_PRIMITIVES 1024
+
+typedef struct VertexBatch VertexBatch;
+
+/*
+ * The unique vertices of part of a draw, in structure-of-arrays form. One
+ * task transforms and lights each vertex once into out[], then walks
+ * mode's topology over elems[] to assemble, clip and rasterize, so a
+ * vertex shared by several primitives is not processed again. STAGE_VERTEX
+ * plugins run on the unique vertices, three to a VertexJob, before the
+ * transform, so they must treat each vertex on its own. Attribute arrays
+ * are zero padded to a multiple of 16 floats for the vector kernels in
+ * gl_vertex_simd.h.
+ */
+struct VertexBatch {
+	uint32_t nverts;
+	uint32_t nelems;
+	uint32_t nprims;
+	GLenum mode; /* any triangle or line mode but GL_LINE_LOOP */
+	Framebuffer *fb;
+	RasterBins *bins; /* the draw's bins, or NULL to queue tile jobs */
+	GLint viewport[4];
+	uint8_t cull; /* CULL_* windings to discard */
+	/* Position components the draw supplied, 2 to 4; z beyond them is 0
+	 * and w is 1, which lets vertex_transform_soa() skip work. */
+	uint8_t position_size;
+	/* Set for primitives discarded by culling before lighting. */
+	uint64_t culled[VERTEX_BATCH_MAX_PRIMITIVES / 64];
+	/* Object-space attributes, nverts entries each. The transform turns
+	 * x/y/z/w into clip coordinates and fills sx/sy/sz and clip. */
+	GLfloat *x, *y, *z, *w;
+	GLfloat *nx, *ny, *nz;
+	GLfloat *color[4];
+	GLfloat *texcoord[4];
+	GLfloat *sx, *sy, *sz; /* window x and y, NDC depth */
+	int32_t *clip; /* clip_outcode() of each vertex */
+	/* Non-zero for vertices a surviving primitive uses; zero padded like
+	 * the attribute arrays. Lighting and packing skip the rest. */
+	uint8_t *live;
+	uint16_t *elems; /* nelems indices into out[], in draw order */
+	RasterVertex *out; /* post-transform vertices */
+};
+
+/* Allocate a batch with room for @p nverts vertices and @p nprims
+ * primitives of @p mode; returns NULL on allocation failure. */
+VertexBatch *vertex_batch_create(uint32_t nverts, GLenum mode,
+				 uint32_t nprims);
+/* Free @p batch and drop its framebuffer and bins references. */
+void vertex_batch_destroy(VertexBatch *batch);
+
+/* Transform @p src to window coordinates in @p dst. @p cls is the
+ * mat4_class of @p mvp; affine ones skip the divide when src->w is 1.
+ * @p clip, when not NULL, receives the clip-space position for the clip
+ * stage. */
 void pipeline_transform_vertex(Vertex *restrict dst, const Vertex *restrict src,
-			       const mat4 *restrict mvp,
+			       const mat4 *restrict mvp, mat4_class cls,
 			       const mat4 *restrict normal_mat,
-			       const GLint *restrict viewport);
-void process_vertex_job(void *task_data);
+			       const GLint *restrict viewport,
+			       GLfloat *restrict clip);
+/* How lighting treats incoming eye-space normals, from GL_NORMALIZE and
+ * GL_RESCALE_NORMAL. */
+enum { NORMAL_AS_IS, NORMAL_NORMALIZE, NORMAL_RESCALE };
+
+/* An enabled light combined with the material: every term of the lighting
+ * equation that does not depend on the vertex. */
+typedef struct {
+	GLfloat l[3]; /* unit vector towards the light */
+	GLfloat h[3]; /* unit half vector */
+	GLfloat kd[3]; /* material * light diffuse * attenuation */
+	GLfloat ks[3]; /* material * light specular * attenuation */
+	bool specular; /* ks is non-zero and h is defined */
+} LightTerms;
+
+/* Lighting state prepared once per light, material, normal mode or
+ * modelview change, so per-vertex work is dot products and pow only. */
+typedef struct {
+	unsigned mask; /* bit i set when GL_LIGHTi is enabled */
+	int count; /* enabled lights, packed into lights[] */
+	bool specular; /* any light has a specular term */
+	int normal_mode;
+	GLfloat rescale; /* GL_RESCALE_NORMAL factor */
+	GLfloat base[4]; /* emission plus all ambient products; alpha */
+	GLfloat shininess;
+	LightTerms lights[8];
+} LightingSetup;
+
+/* Build @p s from the eight lights and the material. @p normal_mat is the
+ * normal matrix the rescale factor is taken from. */
+void lighting_setup_init(LightingSetup *s, const LightState *lights,
+			 const MaterialState *mat, int normal_mode,
+			 const mat4 *normal_mat);
+/* Fixed-function lighting of one vertex with eye-space @p normal; the
+ * scalar reference for the kernels in gl_vertex_simd.h. */
+void pipeline_light_vertex(GLfloat color[4], const GLfloat normal[3],
+			   const LightingSetup *s);
+/* Task body for a VertexBatch. */
+void process_vertex_batch_job(void *task_data);
 
 #ifdef __cplusplus
 }
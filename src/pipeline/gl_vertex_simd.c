@@ -0,0 +1,109 @@
+#include "gl_vertex_simd.h"
+#define PIPELINE_USE_GLSTATE 0
+_Static_assert(PIPELINE_USE_GLSTATE == 0, "pipeline must not touch gl_state");
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+void vertex_transform_scalar(VertexBatch *restrict b, const mat4 *mvp,
+			     mat4_class cls, const mat4 *normal)
+{
+	const GLfloat *m = mvp->data;
+	const GLint *vp = b->viewport;
+	const int kind = vertex_transform_kind(b, cls);
+	for (uint32_t i = 0; i < b->nverts; ++i) {
+		GLfloat x = b->x[i], y = b->y[i];
+		GLfloat z = kind == TRANSFORM_2D ? 0.0f : b->z[i];
+		GLfloat w = kind == TRANSFORM_GENERAL ? b->w[i] : 1.0f;
+		GLfloat cx = m[0] * x + m[4] * y + m[8] * z + m[12] * w;
+		GLfloat cy = m[1] * x + m[5] * y + m[9] * z + m[13] * w;
+		GLfloat cz = m[2] * x + m[6] * y + m[10] * z + m[14] * w;
+		GLfloat cw = 1.0f;
+		if (kind == TRANSFORM_GENERAL)
+			cw = m[3] * x + m[7] * y + m[11] * z + m[15] * w;
+		GLfloat inv_w = cw != 0.0f ? 1.0f / cw : 1.0f;
+		b->x[i] = cx;
+		b->y[i] = cy;
+		b->z[i] = cz;
+		b->w[i] = cw;
+		b->sx[i] = vp[0] + (cx * inv_w * 0.5f + 0.5f) * vp[2];
+		b->sy[i] = vp[1] + (1.0f - (cy * inv_w * 0.5f + 0.5f)) * vp[3];
+		b->sz[i] = cz * inv_w;
+		b->clip[i] = clip_outcode(cx, cy, cz, cw);
+	}
+	if (!normal)
+		return;
+	const GLfloat *n = normal->data;
+	for (uint32_t i = 0; i < b->nverts; ++i) {
+		GLfloat x = b->nx[i], y = b->ny[i], z = b->nz[i];
+		b->nx[i] = n[0] * x + n[4] * y + n[8] * z;
+		b->ny[i] = n[1] * x + n[5] * y + n[9] * z;
+		b->nz[i] = n[2] * x + n[6] * y + n[10] * z;
+	}
+}
+
+void vertex_light_scalar(VertexBatch *restrict b, const LightingSetup *s)
+{
+	for (uint32_t i = 0; i < b->nverts; ++i) {
+		if (!b->live[i])
+			continue;
+		const GLfloat n[3] = { b->nx[i], b->ny[i], b->nz[i] };
+		GLfloat c[4];
+		pipeline_light_vertex(c, n, s);
+		for (int k = 0; k < 4; ++k)
+			b->color[k][i] = c[k];
+	}
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+typedef float vf4 __attribute__((vector_size(16)));
+typedef int32_t vi4 __attribute__((vector_size(16)));
+typedef float vf8 __attribute__((vector_size(32)));
+typedef int32_t vi8 __attribute__((vector_size(32)));
+
+#define SIMD_W 4
+#define VF vf4
+#define VI vi4
+#define SIMD_FN(name) name##_x4
+#include "gl_vertex_simd_impl.h"
+#undef SIMD_W
+#undef VF
+#undef VI
+#undef SIMD_FN
+
+#define SIMD_W 8
+#define VF vf8
+#define VI vi8
+#define SIMD_FN(name) name##_x8
+#include "gl_vertex_simd_impl.h"
+#undef SIMD_W
+#undef VF
+#undef VI
+#undef SIMD_FN
+
+#else
+
+void vertex_transform_x4(VertexBatch *restrict b, const mat4 *mvp,
+			 mat4_class cls, const mat4 *normal)
+{
+	vertex_transform_scalar(b, mvp, cls, normal);
+}
+
+void vertex_transform_x8(VertexBatch *restrict b, const mat4 *mvp,
+			 mat4_class cls, const mat4 *normal)
+{
+	vertex_transform_scalar(b, mvp, cls, normal);
+}
+
+void vertex_light_x4(VertexBatch *restrict b, const LightingSetup *s)
+{
+	vertex_light_scalar(b, s);
+}
+
+void vertex_light_x8(VertexBatch *restrict b, const LightingSetup *s)
+{
+	vertex_light_scalar(b, s);
+}
+
+#endif
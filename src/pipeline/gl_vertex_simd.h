@@ -0,0 +1,91 @@
+#ifndef GL_VERTEX_SIMD_H
+#define GL_VERTEX_SIMD_H
+
+/**
+ * @file gl_vertex_simd.h
+ * @brief Multi-vertex transform and lighting kernels for VertexBatch.
+ *
+ * Each kernel works in place on a batch's structure-of-arrays attributes.
+ * The transform kernels replace x/y/z/w with clip coordinates, fill sx/sy/sz
+ * with window coordinates and clip with outcodes and, unless the normal
+ * matrix is NULL, replace nx/ny/nz with eye-space normals. The MVP's
+ * mat4_class and the batch's position_size choose the loop: affine
+ * matrices on w = 1 positions skip the divide by w, and 2D positions under
+ * an ortho matrix take one multiply-add per coordinate.
+ * The lighting kernels then overwrite color[] with the lit color, skipping
+ * vertices culling left out of live[] (a vector at a time). The
+ * _scalar variants are the reference; _x4 and _x8 process four or eight
+ * vertices per step using GCC/Clang vector extensions, which lower to
+ * SSE/AVX on x86 and NEON on ARM. Compilers without vector extensions get
+ * the scalar code under every name.
+ */
+
+#include "gl_vertex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lanes of the kernels used by the vertex stage on this target. */
+#if defined(__AVX__)
+#define VERTEX_SIMD_WIDTH 8
+#elif defined(__GNUC__) || defined(__clang__)
+#define VERTEX_SIMD_WIDTH 4
+#else
+#define VERTEX_SIMD_WIDTH 1
+#endif
+
+/* Transform loops, from the full 4x4 with a divide by w down to 2D. */
+enum { TRANSFORM_GENERAL, TRANSFORM_AFFINE, TRANSFORM_2D };
+
+static inline int vertex_transform_kind(const VertexBatch *b,
+					mat4_class cls)
+{
+	if (cls > MAT4_AFFINE || b->position_size > 3)
+		return TRANSFORM_GENERAL;
+	if (cls > MAT4_ORTHO || b->position_size > 2)
+		return TRANSFORM_AFFINE;
+	return TRANSFORM_2D;
+}
+
+void vertex_transform_scalar(VertexBatch *restrict b, const mat4 *mvp,
+			     mat4_class cls, const mat4 *normal);
+void vertex_transform_x4(VertexBatch *restrict b, const mat4 *mvp,
+			 mat4_class cls, const mat4 *normal);
+void vertex_transform_x8(VertexBatch *restrict b, const mat4 *mvp,
+			 mat4_class cls, const mat4 *normal);
+
+void vertex_light_scalar(VertexBatch *restrict b, const LightingSetup *s);
+void vertex_light_x4(VertexBatch *restrict b, const LightingSetup *s);
+void vertex_light_x8(VertexBatch *restrict b, const LightingSetup *s);
+
+static inline void vertex_transform_soa(VertexBatch *restrict b,
+					const mat4 *mvp, mat4_class cls,
+					const mat4 *normal)
+{
+#if VERTEX_SIMD_WIDTH == 8
+	vertex_transform_x8(b, mvp, cls, normal);
+#elif VERTEX_SIMD_WIDTH == 4
+	vertex_transform_x4(b, mvp, cls, normal);
+#else
+	vertex_transform_scalar(b, mvp, cls, normal);
+#endif
+}
+
+static inline void vertex_light_soa(VertexBatch *restrict b,
+				    const LightingSetup *s)
+{
+#if VERTEX_SIMD_WIDTH == 8
+	vertex_light_x8(b, s);
+#elif VERTEX_SIMD_WIDTH == 4
+	vertex_light_x4(b, s);
+#else
+	vertex_light_scalar(b, s);
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GL_VERTEX_SIMD_H */
@@ -0,0 +1,243 @@
+/*
+ * Vector kernel bodies, included by gl_vertex_simd.c once per width with
+ * SIMD_W, VF (float vector), VI (matching int vector) and SIMD_FN(name)
+ * defined. Loops run whole vectors; VertexBatch pads every attribute array
+ * to a cache line so the last vector stays inside the allocation.
+ */
+
+static inline VF SIMD_FN(load)(const GLfloat *p)
+{
+	VF v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void SIMD_FN(store)(GLfloat *p, VF v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline VF SIMD_FN(splat)(GLfloat s)
+{
+	VF v = { 0 };
+	return v + s;
+}
+
+static inline VF SIMD_FN(select)(VI mask, VF a, VF b)
+{
+	return (VF)((mask & (VI)a) | (~mask & (VI)b));
+}
+
+static inline void SIMD_FN(store_int)(int32_t *p, VI v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+/* -1 lanes become @p bit, 0 lanes stay 0. */
+static inline VI SIMD_FN(bit)(VI mask, int32_t bit)
+{
+	return mask & bit;
+}
+
+/* Whether any of the vector's vertices is used by a surviving primitive. */
+static inline bool SIMD_FN(any_live)(const uint8_t *live)
+{
+	uint64_t m = 0;
+	memcpy(&m, live, SIMD_W);
+	return m != 0;
+}
+
+static inline VF SIMD_FN(max)(VF a, VF b)
+{
+	return SIMD_FN(select)(a > b, a, b);
+}
+
+/* Per lane; with -fno-math-errno this becomes a single vector sqrt. */
+static inline VF SIMD_FN(sqrt)(VF v)
+{
+	for (int i = 0; i < SIMD_W; ++i)
+		v[i] = sqrtf(v[i]);
+	return v;
+}
+
+static inline VF SIMD_FN(pow)(VF v, GLfloat e)
+{
+	for (int i = 0; i < SIMD_W; ++i)
+		v[i] = powf(v[i], e);
+	return v;
+}
+
+/* One transform pass for a vertex_transform_kind() known at compile time;
+ * only TRANSFORM_GENERAL reads w or divides by it. */
+static inline __attribute__((always_inline)) void
+SIMD_FN(transform_loop)(VertexBatch *restrict b, const GLfloat *m,
+			const int kind)
+{
+	const GLfloat vx = (GLfloat)b->viewport[0];
+	const GLfloat vy = (GLfloat)b->viewport[1];
+	const GLfloat vw = (GLfloat)b->viewport[2];
+	const GLfloat vh = (GLfloat)b->viewport[3];
+	const VF zero = SIMD_FN(splat)(0.0f);
+	const VF one = SIMD_FN(splat)(1.0f);
+	for (uint32_t i = 0; i < b->nverts; i += SIMD_W) {
+		VF x = SIMD_FN(load)(&b->x[i]);
+		VF y = SIMD_FN(load)(&b->y[i]);
+		VF cx, cy, cz, cw;
+		if (kind == TRANSFORM_2D) {
+			cx = m[0] * x + m[12];
+			cy = m[5] * y + m[13];
+			cz = SIMD_FN(splat)(m[14]);
+			cw = one;
+		} else if (kind == TRANSFORM_AFFINE) {
+			VF z = SIMD_FN(load)(&b->z[i]);
+			cx = m[0] * x + m[4] * y + m[8] * z + m[12];
+			cy = m[1] * x + m[5] * y + m[9] * z + m[13];
+			cz = m[2] * x + m[6] * y + m[10] * z + m[14];
+			cw = one;
+		} else {
+			VF z = SIMD_FN(load)(&b->z[i]);
+			VF w = SIMD_FN(load)(&b->w[i]);
+			cx = m[0] * x + m[4] * y + m[8] * z + m[12] * w;
+			cy = m[1] * x + m[5] * y + m[9] * z + m[13] * w;
+			cz = m[2] * x + m[6] * y + m[10] * z + m[14] * w;
+			cw = m[3] * x + m[7] * y + m[11] * z + m[15] * w;
+		}
+		VF nx = cx, ny = cy, nz = cz;
+		if (kind == TRANSFORM_GENERAL) {
+			VF inv_w = SIMD_FN(select)(cw != zero, one / cw, one);
+			nx *= inv_w;
+			ny *= inv_w;
+			nz *= inv_w;
+		}
+		SIMD_FN(store)(&b->x[i], cx);
+		SIMD_FN(store)(&b->y[i], cy);
+		SIMD_FN(store)(&b->z[i], cz);
+		SIMD_FN(store)(&b->w[i], cw);
+		SIMD_FN(store)(&b->sx[i], vx + (nx * 0.5f + 0.5f) * vw);
+		SIMD_FN(store)(&b->sy[i],
+			       vy + (1.0f - (ny * 0.5f + 0.5f)) * vh);
+		SIMD_FN(store)(&b->sz[i], nz);
+		VF g = cw * CLIP_GUARD_BAND;
+		VI code = SIMD_FN(bit)(cx < -cw, CLIP_LEFT) |
+			  SIMD_FN(bit)(cx > cw, CLIP_RIGHT) |
+			  SIMD_FN(bit)(cy < -cw, CLIP_BOTTOM) |
+			  SIMD_FN(bit)(cy > cw, CLIP_TOP) |
+			  SIMD_FN(bit)(cz < -cw, CLIP_NEAR) |
+			  SIMD_FN(bit)(cz > cw, CLIP_FAR) |
+			  SIMD_FN(bit)((cx < -g) | (cx > g) | (cy < -g) | (cy > g),
+				       CLIP_GUARD);
+		SIMD_FN(store_int)(&b->clip[i], code);
+	}
+}
+
+void SIMD_FN(vertex_transform)(VertexBatch *restrict b, const mat4 *mvp,
+			       mat4_class cls, const mat4 *normal)
+{
+	switch (vertex_transform_kind(b, cls)) {
+	case TRANSFORM_2D:
+		SIMD_FN(transform_loop)(b, mvp->data, TRANSFORM_2D);
+		break;
+	case TRANSFORM_AFFINE:
+		SIMD_FN(transform_loop)(b, mvp->data, TRANSFORM_AFFINE);
+		break;
+	default:
+		SIMD_FN(transform_loop)(b, mvp->data, TRANSFORM_GENERAL);
+		break;
+	}
+	if (!normal)
+		return;
+	const GLfloat *n = normal->data;
+	for (uint32_t i = 0; i < b->nverts; i += SIMD_W) {
+		VF x = SIMD_FN(load)(&b->nx[i]);
+		VF y = SIMD_FN(load)(&b->ny[i]);
+		VF z = SIMD_FN(load)(&b->nz[i]);
+		SIMD_FN(store)(&b->nx[i], n[0] * x + n[4] * y + n[8] * z);
+		SIMD_FN(store)(&b->ny[i], n[1] * x + n[5] * y + n[9] * z);
+		SIMD_FN(store)(&b->nz[i], n[2] * x + n[6] * y + n[10] * z);
+	}
+}
+
+/* One pass over the batch for a normal mode and specular setting known at
+ * compile time, so each combination gets its own branch-free loop. */
+static inline __attribute__((always_inline)) void
+SIMD_FN(light_loop)(VertexBatch *restrict b, const LightingSetup *s,
+		    const int normal_mode, const bool specular)
+{
+	const VF zero = SIMD_FN(splat)(0.0f);
+	const VF rescale = SIMD_FN(splat)(s->rescale);
+	const VF alpha = SIMD_FN(splat)(s->base[3]);
+	for (uint32_t i = 0; i < b->nverts; i += SIMD_W) {
+		if (!SIMD_FN(any_live)(&b->live[i]))
+			continue;
+		VF nx = SIMD_FN(load)(&b->nx[i]);
+		VF ny = SIMD_FN(load)(&b->ny[i]);
+		VF nz = SIMD_FN(load)(&b->nz[i]);
+		if (normal_mode == NORMAL_NORMALIZE) {
+			VF len = SIMD_FN(sqrt)(nx * nx + ny * ny + nz * nz);
+			VI live = len > zero;
+			nx = SIMD_FN(select)(live, nx / len, zero);
+			ny = SIMD_FN(select)(live, ny / len, zero);
+			nz = SIMD_FN(select)(live, nz / len, zero);
+		} else if (normal_mode == NORMAL_RESCALE) {
+			nx *= rescale;
+			ny *= rescale;
+			nz *= rescale;
+		}
+		VF r = SIMD_FN(splat)(s->base[0]);
+		VF g = SIMD_FN(splat)(s->base[1]);
+		VF bl = SIMD_FN(splat)(s->base[2]);
+		for (int li = 0; li < s->count; ++li) {
+			const LightTerms *t = &s->lights[li];
+			VF dot = nx * t->l[0] + ny * t->l[1] + nz * t->l[2];
+			dot = SIMD_FN(max)(dot, zero);
+			r += t->kd[0] * dot;
+			g += t->kd[1] * dot;
+			bl += t->kd[2] * dot;
+			if (!specular || !t->specular)
+				continue;
+			VF sd = nx * t->h[0] + ny * t->h[1] + nz * t->h[2];
+			VF spec = SIMD_FN(pow)(SIMD_FN(max)(sd, zero),
+					       s->shininess);
+			r += t->ks[0] * spec;
+			g += t->ks[1] * spec;
+			bl += t->ks[2] * spec;
+		}
+		SIMD_FN(store)(&b->color[0][i], r);
+		SIMD_FN(store)(&b->color[1][i], g);
+		SIMD_FN(store)(&b->color[2][i], bl);
+		SIMD_FN(store)(&b->color[3][i], alpha);
+	}
+}
+
+void SIMD_FN(vertex_light)(VertexBatch *restrict b, const LightingSetup *s)
+{
+	if (!s->count) {
+		/* Emission and ambient only: every vertex gets the same color. */
+		for (int k = 0; k < 4; ++k) {
+			const VF c = SIMD_FN(splat)(s->base[k]);
+			for (uint32_t i = 0; i < b->nverts; i += SIMD_W)
+				SIMD_FN(store)(&b->color[k][i], c);
+		}
+		return;
+	}
+	switch (s->normal_mode) {
+	case NORMAL_NORMALIZE:
+		if (s->specular)
+			SIMD_FN(light_loop)(b, s, NORMAL_NORMALIZE, true);
+		else
+			SIMD_FN(light_loop)(b, s, NORMAL_NORMALIZE, false);
+		break;
+	case NORMAL_RESCALE:
+		if (s->specular)
+			SIMD_FN(light_loop)(b, s, NORMAL_RESCALE, true);
+		else
+			SIMD_FN(light_loop)(b, s, NORMAL_RESCALE, false);
+		break;
+	default:
+		if (s->specular)
+			SIMD_FN(light_loop)(b, s, NORMAL_AS_IS, true);
+		else
+			SIMD_FN(light_loop)(b, s, NORMAL_AS_IS, false);
+		break;
+	}
+}
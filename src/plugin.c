@@ -44,6 +44,11 @@ void plugin_invoke(stage_tag_t stage, void *job)
 	}
 }
 
+bool plugin_registered(stage_tag_t stage)
+{
+	return stage >= 0 && stage < STAGE_COUNT && g_plugin_count[stage] > 0;
+}
+
 void plugin_submit(task_function_t fn, void *data, stage_tag_t stage)
 {
 	thread_pool_submit(fn, data, stage);
@@ -3,6 +3,7 @@
 
 #include "gl_thread.h" /* stage_tag_t */
 #include <GLES/gl.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,6 +14,8 @@ typedef void (*stage_plugin_fn)(void *job);
 const char *plugin_list(void);
 void plugin_register(stage_tag_t stage, stage_plugin_fn fn, const char *name);
 void plugin_invoke(stage_tag_t stage, void *job);
+/* Whether any plugin is registered for @p stage. */
+bool plugin_registered(stage_tag_t stage);
 
 /**
  * Submit a task to the internal thread pool from a plugin.
@@ -9,9 +9,9 @@ struct PoolNode {
 	struct PoolNode *next_all;
 	/* Padding ensures that the following object allocation begins on a
          * 64-byte boundary.  This avoids misaligned accesses when the object
-         * itself requires 64 byte alignment (e.g. VertexJob).  The exact size
-         * is computed so that sizeof(struct PoolNode) == 64 on both 32 and
-         * 64 bit builds.
+         * itself requires 64 byte alignment (e.g. FragmentTileJob).  The
+         * exact size is computed so that sizeof(struct PoolNode) == 64 on
+         * both 32 and 64 bit builds.
          */
 	unsigned char padding[64 - 2 * sizeof(void *)];
 };
@@ -27,8 +27,6 @@ struct ObjectPool {
 };
 
 /* global pools for common job types */
-static ObjectPool g_vertex_job_pool;
-static ObjectPool g_raster_job_pool;
 static ObjectPool g_tile_job_pool;
 #define JOB_POOL_CAPACITY 512
 
@@ -90,10 +88,6 @@ void pool_destroy(ObjectPool *pool)
 
 void job_pools_init(void)
 {
-	pool_init(&g_vertex_job_pool, sizeof(VertexJob), JOB_POOL_CAPACITY,
-		  STAGE_VERTEX);
-	pool_init(&g_raster_job_pool, sizeof(RasterJob), JOB_POOL_CAPACITY,
-		  STAGE_RASTER);
 	pool_init(&g_tile_job_pool, sizeof(FragmentTileJob), JOB_POOL_CAPACITY,
 		  STAGE_FRAGMENT);
 }
@@ -101,28 +95,6 @@ void job_pools_init(void)
 void job_pools_destroy(void)
 {
 	pool_destroy(&g_tile_job_pool);
-	pool_destroy(&g_raster_job_pool);
-	pool_destroy(&g_vertex_job_pool);
-}
-
-VertexJob *vertex_job_acquire(void)
-{
-	return (VertexJob *)pool_acquire(&g_vertex_job_pool);
-}
-
-void vertex_job_release(VertexJob *job)
-{
-	pool_release(&g_vertex_job_pool, job);
-}
-
-RasterJob *raster_job_acquire(void)
-{
-	return (RasterJob *)pool_acquire(&g_raster_job_pool);
-}
-
-void raster_job_release(RasterJob *job)
-{
-	pool_release(&g_raster_job_pool, job);
 }
 
 FragmentTileJob *tile_job_acquire(void)
@@ -21,10 +21,6 @@ void pool_destroy(ObjectPool *pool);
 /* Job specific helpers */
 void job_pools_init(void);
 void job_pools_destroy(void);
-VertexJob *vertex_job_acquire(void);
-void vertex_job_release(VertexJob *job);
-RasterJob *raster_job_acquire(void);
-void raster_job_release(RasterJob *job);
 FragmentTileJob *tile_job_acquire(void);
 void tile_job_release(FragmentTileJob *job);
 
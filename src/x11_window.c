@@ -255,6 +255,7 @@ void x11_window_show_image(X11Window *w, const struct Framebuffer *fb)
 		return;
 	}
 
+	framebuffer_resolve(fb);
 	pthread_mutex_lock(&x11_mutex);
 	unsigned width = w->width < fb->width ? w->width : fb->width;
 	unsigned height = w->height < fb->height ? w->height : fb->height;